@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#define ARENA_BLOCK_SIZE 16384 /* fits everything read from a full packet */
+
+// Bump allocator for objects which all go away together, like everything
+// read from one packet. Nothing is freed on its own, Reset() hands all of
+// the memory out again. Blocks are kept across resets, so once the arena
+// has grown to the largest packet seen it stops touching the heap.
+class Arena {
+public:
+  Arena(std::size_t blockSize = ARENA_BLOCK_SIZE)
+      : blockSize(blockSize), current(0), offset(0), used(0) {}
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *Allocate(std::size_t size,
+                 std::size_t align = alignof(std::max_align_t));
+
+  // Destructors are never run, so only types which do not need one
+  template <typename T> T *New(std::size_t n = 1) {
+    static_assert(std::is_trivially_destructible_v<T>);
+    T *items = static_cast<T *>(Allocate(sizeof(T) * n, alignof(T)));
+    for (std::size_t i = 0; i < n; i++) {
+      new (&items[i]) T();
+    }
+    return items;
+  }
+
+  uint8_t *Copy(const void *data, std::size_t size);
+
+  void Reset();
+
+  // Bytes handed out since the last reset
+  std::size_t Used() const { return used; }
+  std::size_t Capacity() const;
+
+private:
+  struct Block {
+    std::unique_ptr<uint8_t[]> data;
+    std::size_t size;
+  };
+
+  std::size_t blockSize;
+  std::vector<Block> blocks;
+  std::size_t current; // Block allocations are taken from
+  std::size_t offset;  // First free byte in it
+  std::size_t used;
+};
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#pragma once
+
+#include "dns/querykey.hpp"
+#include "net/netcommon.h"
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class DnsQuestion;
+
+// Upstream replies kept in wire format. Serving an entry only rewrites the
+// ID, a few header bits, the question name case and the TTLs.
+//
+// Negative answers (RFC 2308) live in a pool with its own budget so that a
+// flood of lookups for names which do not exist cannot push out positive
+// answers.
+//
+// With a stale window (RFC 8767) expired entries are kept around that much
+// longer so they can still be served while upstream servers do not answer.
+//
+// Entries which are hit often are reported for prefetch once they enter the
+// last part of their lifetime, so popular names are refreshed before they
+// expire for everyone at once.
+class ResponseCache {
+public:
+  enum Pool { Positive, Negative };
+
+  struct Entry {
+    std::string key;
+    std::vector<uint8_t> data;
+    // Offsets of TTL fields of all records except the psuedo header
+    std::vector<uint16_t> ttlOffsets;
+    std::time_t inserted;
+    uint32_t ttl;
+    Pool pool;
+    // Offset of RDLENGTH of the psuedo header, 0 if there is none
+    uint16_t optOffset;
+    uint32_t hits;
+
+    std::size_t Size() const;
+  };
+
+  ResponseCache(std::size_t budget, std::size_t negativeBudget = 0,
+                uint32_t staleWindow = 0)
+      : stats{}, pools{{budget, 0, {}}, {negativeBudget, 0, {}}},
+        staleWindow(staleWindow), prefetchHits(0), prefetchPercent(0) {}
+
+  // Entries hit at least hits times are due for prefetch during the last
+  // percent of their TTL. 0 hits disables prefetch.
+  void SetPrefetch(uint32_t hits, uint32_t percent) {
+    prefetchHits = hits;
+    prefetchPercent = percent;
+  }
+
+  // Query key followed by the forwarding flags
+  static std::string Key(const QueryKey &key, unsigned int flags);
+  static std::string Key(const DnsQuestion &question, unsigned int flags);
+
+  bool Insert(const std::string &key, const uint8_t *data, std::size_t size,
+              const std::vector<uint16_t> &ttlOffsets, uint32_t ttl,
+              const std::time_t &now, Pool pool = Positive,
+              uint16_t optOffset = 0);
+
+  // Writes the cached reply for key into bpb for a client which asked using
+  // id and name, the question name in wire format as the client sent it.
+  // Returns false on a miss. prefetch is set if the entry
+  // should be refreshed now.
+  bool Lookup(const std::string &key, std::span<const uint8_t> name,
+              uint16_t id, bool recursionDesired, const std::time_t &now,
+              BytePacketBuffer *bpb, bool *prefetch = nullptr);
+
+  // Like Lookup but also serves entries which expired less than the stale
+  // window ago. Those carry a short TTL and an extended DNS error.
+  bool LookupStale(const std::string &key, std::span<const uint8_t> name,
+                   uint16_t id, bool recursionDesired, const std::time_t &now,
+                   BytePacketBuffer *bpb);
+
+  // True if LookupStale would currently find an expired entry for key
+  bool HasStale(const std::string &key, const std::time_t &now) const;
+
+  bool Enabled() const { return Enabled(Positive) || Enabled(Negative); }
+  bool Enabled(Pool pool) const { return pools[pool].budget > 0; }
+  std::size_t Count() const { return index.size(); }
+  std::size_t Count(Pool pool) const { return pools[pool].entries.size(); }
+  std::size_t Used() const { return Used(Positive) + Used(Negative); }
+  std::size_t Used(Pool pool) const { return pools[pool].used; }
+
+  struct {
+    uint64_t hits;
+    uint64_t negativeHits;
+    uint64_t staleHits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+  } stats;
+
+private:
+  struct Lru {
+    std::size_t budget;
+    std::size_t used;
+    // Most recently used entry first
+    std::list<Entry> entries;
+  };
+
+  struct KeyHash {
+    std::size_t operator()(std::string_view key) const {
+      return QueryKey::HashBytes(key.data(), key.size());
+    }
+  };
+
+  void erase(std::list<Entry>::iterator it);
+  void serve(std::list<Entry>::iterator it, std::span<const uint8_t> name,
+             uint16_t id, bool recursionDesired, std::time_t elapsed,
+             BytePacketBuffer *bpb);
+
+  Lru pools[2];
+  uint32_t staleWindow;
+  uint32_t prefetchHits;
+  uint32_t prefetchPercent;
+  std::unordered_map<std::string_view, std::list<Entry>::iterator, KeyHash>
+      index;
+};
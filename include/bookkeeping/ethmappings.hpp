@@ -6,6 +6,7 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
  */
 
+#include "bookkeeping/timerwheel.hpp"
 #include "net/netcommon.h"
 #include "util.hpp"
 #include <cstddef>
@@ -19,14 +20,19 @@ public:
     bool ipv4;
     union IpAddress ipaddress;
     std::time_t time = GetNow();
+    bool used = false;
+    // Frees the mapping unless it is refreshed
+    TimerWheel::Timer expiry;
   };
 
+  EthMappings(TimerWheel &timers) : timers(timers) {}
+
   bool Add(const union EthAddress &ethaddress, const bool &ipv4,
            const union IpAddress &ipaddress);
   const MacMappingRecord *LookUp(const union IpAddress &ipaddress,
                                  const bool &ipv4) const;
 
 private:
-  std::size_t count = 0;
+  TimerWheel &timers;
   MacMappingRecord records[MAX_MAC_IP_MAPPINGS];
 };
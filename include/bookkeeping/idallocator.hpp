@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Random words fetched from the system at once
+#define ID_RANDOM_WORDS 256
+
+// Hands out DNS message IDs for the upstream queries of a worker. It sends
+// over UDP from one socket and source port per address family and matches
+// the replies on those and on its TCP connections by ID, so one allocator
+// covers every upstream socket and connection. IDs come out in random order
+// and never collide with one still in use. Both operations take constant
+// time however many IDs are out.
+//
+// The ID is what keeps spoofed replies out (RFC 5452), so the picks come
+// from the system's cryptographic generator, not a seeded engine whose
+// state can be worked out from the IDs seen on the wire.
+class IdAllocator {
+public:
+  IdAllocator();
+
+  // 0 when every ID is in use
+  uint16_t Allocate();
+  void Free(uint16_t id);
+  bool InUse(uint16_t id) const { return used[id]; }
+  std::size_t Available() const { return available; }
+
+private:
+  // Uniform in [0, n) without modulo bias
+  uint32_t pick(uint32_t n);
+  uint32_t random();
+
+  // The first available entries are the free IDs in no particular order.
+  // Allocate picks one of them at random, which keeps the order shuffled.
+  std::vector<uint16_t> ids;
+  std::size_t available;
+  std::bitset<0x10000> used;
+  std::array<uint32_t, ID_RANDOM_WORDS> words;
+  std::size_t nextWord;
+};
@@ -8,19 +8,26 @@
 
 #pragma once
 
+#include "bookkeeping/idallocator.hpp"
+#include "bookkeeping/slab.hpp"
+#include "bookkeeping/timerwheel.hpp"
+#include "dns/querykey.hpp"
 #include <boost/asio/ip/udp.hpp>
+#include <chrono>
 #include <cstdint>
 #include <ctime>
+#include <functional>
 #include <memory>
-#include <random>
 #include <sys/types.h>
+#include <vector>
 
-#define HASH_SIZE 32
+#define MAX_FWD_QUERIES 150 /* default in-flight upstream queries */
 
 #define PEER_CHECKING_DISABLED 1
 #define PEER_AD_QUESTION 2
 #define PEER_HAS_PSUEDO_HEADER 4
 #define PEER_USE_DEF_PKT_SZ 8
+#define PEER_DNSSEC_OK 16
 
 using boost::asio::ip::udp;
 
@@ -34,7 +41,13 @@ public:
       udp::endpoint endpoint;
       bool ipv4;
       uint16_t originalId;
-      std::unique_ptr<PeerSource> next;
+      // Largest reply the client takes, any size over TCP
+      uint16_t udpSize;
+      // TCP connection the query came on, 0 for UDP
+      uint64_t connection;
+      // Case of the question name as the client sent it
+      uint8_t nameCase[NAME_CASE_SIZE];
+      PeerSource *next;
     } source;
 
     // null means free. In future we will not send to all servers
@@ -44,39 +57,85 @@ public:
     // int forwardall;
     int flags;
     std::time_t time;
-    std::time_t forwardTimestamp;
-    unsigned char hash[HASH_SIZE];
-    bool fromTimedOut;
-    std::unique_ptr<PeerRequestRecord> next;
-
-    bool HasTimedOut() const;
+    std::chrono::steady_clock::time_point forwardTime;
+    // Times the query was sent upstream, retransmissions included
+    unsigned int attempts;
+    // Wire format of the forwarded query, kept for retransmission
+    std::vector<uint8_t> query;
+    QueryKey key;
+    // Sources were answered from stale cache, the reply only refreshes it
+    bool staleServed;
+    // Upstream replied truncated, later sends go over TCP
+    bool overTcp;
+    // Cache refresh, the first source was already answered from cache
+    bool prefetch;
+    // Handed out by GetNewRecord and present in both indexes
+    bool used;
+    // Frees the record if nothing else did. Freeing cancels all the timers.
+    TimerWheel::Timer expiry;
+    // Next send upstream or failure, armed by the server
+    TimerWheel::Timer retransmit;
+    // Answer from stale cache unless upstream replies first
+    TimerWheel::Timer staleDeadline;
+
+    bool HasTimedOut(const std::time_t &now) const;
+    // Sources waiting for the upstream reply
+    PeerSource *Clients() { return prefetch ? source.next : &source; }
   };
 
 public:
-  PeerRequests()
-      : distribute(1, 0xffff), records(nullptr), sources(nullptr),
-        sourceCount(0) {
-    std::random_device seed;
-    rng.seed(seed());
-  };
+  typedef std::function<void(PeerRequestRecord *)> ExpiryHandler;
+
+  PeerRequests(TimerWheel &timers, std::size_t capacity = MAX_FWD_QUERIES);
 
-  PeerRequestRecord *GetNewRecord(const std::time_t &now, bool force);
+  // Gets records nothing freed before they expired, it has to free them.
+  // Without one they are freed right away.
+  void OnExpiry(ExpiryHandler handler) { onExpiry = std::move(handler); }
 
-  PeerRequestRecord *Lookup(uint16_t id, void *hash) const;
+  // Record for a new upstream query with a fresh ID, indexed by that ID and
+  // by key. Null when all records are busy.
+  PeerRequestRecord *GetNewRecord(const std::time_t &now, const QueryKey &key,
+                                  unsigned int flags);
 
-  PeerRequestRecord *LookupByQuery(void *hash, unsigned int flags,
-                                   unsigned int flagmask) const;
+  PeerRequestRecord *Lookup(uint16_t id, const QueryKey &key);
+
+  // Queries without a key are never coalesced
+  PeerRequestRecord *LookupByQuery(const QueryKey &key, unsigned int flags,
+                                   unsigned int flagmask);
 
   void FreePeerRequestRecord(PeerRequests::PeerRequestRecord *r);
 
   PeerRequestRecord::PeerSource *GetNewPeerSource(const std::time_t &now);
 
-  uint16_t GetNewId();
+  void StartPrefetch(PeerRequestRecord *r);
+  unsigned int Prefetches() const { return prefetches; }
+  std::size_t InFlight() const { return records.InUse(); }
 
 private:
-  std::mt19937 rng;
-  std::uniform_int_distribution<uint16_t> distribute;
-  std::unique_ptr<PeerRequestRecord> records;
-  std::unique_ptr<PeerRequestRecord::PeerSource> sources;
-  uint16_t sourceCount;
+  // Open addressing over record positions with linear probing. Removal
+  // shifts the following entries back so no tombstones pile up.
+  struct Index {
+    std::vector<uint32_t> slots;
+    std::size_t mask;
+  };
+
+  static std::size_t idSlot(const Index &index, uint16_t id);
+  static std::size_t keySlot(const Index &index, const QueryKey &key);
+  void insert(Index &index, std::size_t slot, uint32_t pos);
+  template <typename Home>
+  void erase(Index &index, std::size_t slot, uint32_t pos, Home home);
+
+  // Replies from all upstream servers arrive on the worker's own upstream
+  // sockets, and a query may be retried on any server, so they share one ID
+  // space.
+  IdAllocator ids;
+  TimerWheel &timers;
+  // Records are referred to by address and by position in the indexes
+  Slab<PeerRequestRecord> records;
+  // Sources after the first of each record
+  Slab<PeerRequestRecord::PeerSource> sources;
+  Index byId;
+  Index byKey;
+  unsigned int prefetches;
+  ExpiryHandler onExpiry;
 };
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#pragma once
+
+#include "bookkeeping/server.hpp"
+#include "config.hpp"
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Picks the upstream server for each forwarded query from round trip times
+// measured per server. A server which stops answering looks slower the longer
+// it stays silent. A small share of queries is also copied to another server
+// so that a recovered server gets measured again.
+class UpstreamSelector {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  UpstreamSelector(UpstreamStrategy strategy, unsigned int explorePercent);
+
+  void Add(UpstreamServerInfo *server) { servers.push_back(server); }
+  bool FanOut() const { return strategy == UpstreamStrategy::All; }
+
+  UpstreamServerInfo *Select(const Clock::time_point &now);
+  // Another server to send a copy of the query to, or null
+  UpstreamServerInfo *Explore(UpstreamServerInfo *selected);
+  // Best server other than failed for retrying a query, failed itself if
+  // there is no other.
+  UpstreamServerInfo *Failover(UpstreamServerInfo *failed,
+                               const Clock::time_point &now) const;
+
+  void OnForward(UpstreamServerInfo *server, const Clock::time_point &now);
+  void OnReply(UpstreamServerInfo *server, const Clock::time_point &sent,
+               const Clock::time_point &now);
+  // Reply to a query which was already answered by another server. It gives
+  // no round trip time but shows the server is alive.
+  void OnLateReply(UpstreamServerInfo *server);
+
+  // Smoothed round trip time in microseconds with the silence penalty
+  // applied, 0 when the server has not been measured yet.
+  static uint64_t Score(const UpstreamServerInfo *server,
+                        const Clock::time_point &now);
+
+  // Retransmission timeout for a query to server (RFC 6298), doubled for
+  // every earlier attempt.
+  static std::chrono::microseconds Rto(const UpstreamServerInfo *server,
+                                       unsigned int attempt);
+
+private:
+  UpstreamServerInfo *fastest(const Clock::time_point &now,
+                              const UpstreamServerInfo *skip = nullptr) const;
+  UpstreamServerInfo *weightedRandom(const Clock::time_point &now);
+  UpstreamServerInfo *roundRobin(const Clock::time_point &now);
+
+  UpstreamStrategy strategy;
+  unsigned int explorePercent;
+  std::vector<UpstreamServerInfo *> servers;
+  std::vector<double> weights;
+  std::size_t next;
+  std::mt19937 rng;
+};
@@ -10,6 +10,7 @@
 
 #include "net/netcommon.h"
 #include <boost/asio/ip/udp.hpp>
+#include <chrono>
 #include <cstdint>
 
 using boost::asio::ip::udp;
@@ -20,6 +21,8 @@ struct UpstreamServerInfo {
   union IpAddress address;
   std::string displayAddress;
   Port port;
+  // Configured with protocol tcp or tls, every query goes over TCP
+  bool tcp;
   struct {
     uint32_t queries;
     uint32_t replies;
@@ -27,9 +30,13 @@ struct UpstreamServerInfo {
     uint32_t nosources;
     uint32_t timedouts;
     uint32_t failed;
-    std::time_t Latency;
-    std::time_t MMA;
+    // Smoothed round trip time and its variation in microseconds, 0 until
+    // the first reply
+    uint64_t rtt;
+    uint64_t rttvar;
   } stats;
+  // Time of the first query sent since the last reply, unset if none
+  std::chrono::steady_clock::time_point unansweredSince;
   time_t forwardtime;
   int forwardcount;
 };
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#define CACHE_LINE_SIZE 64
+
+// Fixed number of objects constructed up front in one contiguous block, each
+// starting on its own cache line. Free objects are chained through their
+// slots, so taking and returning one never touches the heap. Objects keep
+// their address for the life of the slab.
+template <typename T> class Slab {
+  struct alignas(CACHE_LINE_SIZE) Slot {
+    T item;
+    Slot *nextFree;
+  };
+
+public:
+  Slab(std::size_t capacity)
+      : slots(std::make_unique<Slot[]>(capacity)), capacity(capacity),
+        freeList(nullptr), available(capacity) {
+    // Lowest addresses first
+    for (std::size_t i = capacity; i > 0; i--) {
+      slots[i - 1].nextFree = freeList;
+      freeList = &slots[i - 1];
+    }
+  }
+
+  Slab(const Slab &) = delete;
+  Slab &operator=(const Slab &) = delete;
+
+  // Null when all objects are taken. The object is as it was returned.
+  T *Get() {
+    if (!freeList) {
+      return nullptr;
+    }
+
+    Slot *slot = freeList;
+    freeList = slot->nextFree;
+    slot->nextFree = nullptr;
+    available--;
+    return &slot->item;
+  }
+
+  void Put(T *item) {
+    Slot *slot = &slots[IndexOf(item)];
+    slot->nextFree = freeList;
+    freeList = slot;
+    available++;
+  }
+
+  uint32_t IndexOf(const T *item) const {
+    return (reinterpret_cast<const char *>(item) -
+            reinterpret_cast<const char *>(slots.get())) /
+           sizeof(Slot);
+  }
+
+  T &operator[](std::size_t i) { return slots[i].item; }
+  const T &operator[](std::size_t i) const { return slots[i].item; }
+
+  std::size_t Capacity() const { return capacity; }
+  std::size_t Available() const { return available; }
+  std::size_t InUse() const { return capacity - available; }
+
+private:
+  std::unique_ptr<Slot[]> slots;
+  std::size_t capacity;
+  Slot *freeList;
+  std::size_t available;
+};
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#pragma once
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+
+// Deadlines of one worker, kept in rings of slots by how far away they are.
+// Level 0 has a slot per tick, each level above has slots as long as a whole
+// ring of the level below, and timers move down a level as their slot comes
+// round. Arming and cancelling take constant time and the io_context is only
+// woken while timers are armed.
+class TimerWheel {
+  struct Node {
+    Node *prev;
+    Node *next;
+  };
+
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  // Embedded in the object the deadline belongs to. Destroying or cancelling
+  // it disarms it.
+  class Timer : private Node {
+  public:
+    Timer() : Node{nullptr, nullptr}, wheel(nullptr), tick(0) {}
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+    ~Timer() { Cancel(); }
+
+    bool Armed() const { return wheel != nullptr; }
+    void Cancel();
+
+  private:
+    friend class TimerWheel;
+
+    TimerWheel *wheel;
+    uint64_t tick;
+    std::function<void()> callback;
+  };
+
+  TimerWheel(boost::asio::io_context &io_context,
+             Clock::duration resolution = std::chrono::milliseconds(10));
+  ~TimerWheel();
+
+  // Runs callback once expiry has passed, at most one tick late. Deadlines
+  // further away than the wheel spans (2^24 ticks) fire at its end. Arming
+  // an armed timer moves it.
+  void Schedule(Timer &timer, Clock::time_point expiry,
+                std::function<void()> callback);
+  void Schedule(Timer &timer, Clock::duration after,
+                std::function<void()> callback) {
+    Schedule(timer, Clock::now() + after, std::move(callback));
+  }
+
+  // Runs the callbacks of all timers due by now
+  void Advance(Clock::time_point now);
+
+  std::size_t Armed() const { return armed; }
+
+private:
+  static void link(Node &list, Node &node);
+  static void unlink(Node &node);
+
+  void insert(Timer &timer);
+  void cascade(unsigned int level, std::size_t index);
+  void wake(uint64_t tick);
+  uint64_t nextWake() const;
+
+  Node slots[WHEEL_LEVELS][WHEEL_SLOTS];
+  Clock::time_point origin;
+  Clock::duration resolution;
+  // Next tick to process
+  uint64_t current;
+  std::size_t armed;
+
+  boost::asio::steady_timer ticker;
+  bool ticking;
+  uint64_t wakeTick;
+};
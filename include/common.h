@@ -24,7 +24,9 @@
 #define MAX_SERVERS 3
 #define SERVER_IP_1 "1.1.1.1"
 #define DNS_PORT 53
+#define DOT_PORT 853 /* DNS over TLS, RFC 7858 */
 #define UDP_TIMEOUT 10 /* drop UDP queries after TIMEOUT seconds */
+#define MAX_UDP_BATCH 256 /* datagrams per recvmmsg/sendmmsg call */
 
 #define EC_GOOD 0
 #define EC_BADCONF 1
@@ -18,6 +18,14 @@
 enum Protocol {
   Tcp,
   Udp,
+  Tls,
+};
+
+enum UpstreamStrategy {
+  Fastest,        // Lowest smoothed round trip time
+  WeightedRandom, // Random, weighted by inverse round trip time
+  RoundRobin,
+  All, // Every query to every server
 };
 
 struct UpstreamServer {
@@ -25,6 +33,9 @@ struct UpstreamServer {
   uint16_t port;
   Protocol protocol;
   IpProtocolVersion protocolVersion;
+  // Name the certificate of a TLS server is checked against, its address if
+  // empty
+  std::string tlsName;
 };
 
 class ConfigReader {
@@ -43,6 +54,28 @@ public:
   std::string ruleFile;
   uint16_t dnsPort;
   uint16_t tcpPort;
+  unsigned int tcpConnections;
+  unsigned int tcpIdleTimeout;
+  unsigned int workers;
+  unsigned int batchSize;
+  unsigned int statsInterval;
+  std::size_t cacheSize;
+  uint32_t cacheMaxTtl;
+  std::size_t negativeCacheSize;
+  uint32_t negativeCacheMaxTtl;
+  uint32_t staleWindow;
+  unsigned int staleDeadline;
+  uint32_t prefetchHits;
+  uint32_t prefetchPercent;
+  unsigned int prefetchConcurrency;
+  UpstreamStrategy upstreamStrategy;
+  unsigned int upstreamExplore;
+  unsigned int upstreamAttempts;
+  uint16_t upstreamEdnsSize;
+  unsigned int upstreamTcpConnections;
+  unsigned int upstreamConnectTimeout;
+  std::string tlsCaFile;
+  unsigned int maxQueries;
 
   std::vector<UpstreamServer> servers;
 
@@ -50,7 +83,7 @@ public:
 
 protected:
   void addServer(const std::string &host, uint16_t port,
-                 const std::string &protocol);
+                 const std::string &protocol, const std::string &tlsName);
 
   virtual std::string getStringValue(const std::string &key,
                                      const std::string &defValue) = 0;
@@ -14,6 +14,8 @@
 #include <boost/asio/io_context.hpp>
 #include <boost/interprocess/sync/named_mutex.hpp>
 #include <memory>
+#include <thread>
+#include <vector>
 
 class Daemon {
 public:
@@ -32,6 +34,10 @@ public:
 protected:
   virtual void signalHandler(boost::system::error_code, int) = 0;
 
+private:
+  void startWorkers();
+  void stopWorkers();
+
 private:
   bool lockOwned;
   boost::interprocess::named_mutex executionLock;
@@ -40,6 +46,11 @@ private:
 
   std::string userName;
 
+  // io_context for every worker except the first one which runs on
+  // ioContext in the main thread.
+  std::vector<std::unique_ptr<boost::asio::io_context>> workerContexts;
+  std::vector<std::thread> workerThreads;
+
 protected:
   std::unique_ptr<ConfigReader> configReader;
   ShmRuleEngine ruleEngine;
@@ -11,12 +11,15 @@
 #include "net/netcommon.h"
 
 #define MAX_JUMPS 5
+#define MAX_WIRE_NAME 255 /* RFC 1035 section 2.3.4 */
 
 #define SUCCESS 0
 #define ERROR_INVALID_PACKET 1
 
 #define S_QUERY 0 // Standard DNS Query
 
+#define EDNS_OPTION_EDE 15 /* RFC-8914 extended DNS error option code */
+
 /* RFC-8914 extended errors, negative values are our definitions */
 #define EDE_UNSET -1         /* No extended DNS error available */
 #define EDE_OTHER 0          /* Other */
@@ -54,6 +57,8 @@
 #define QT_A 1
 #define QT_NS 2
 #define QT_CNAME 5
+#define QT_SOA 6
+#define QT_PTR 12
 #define QT_MX 15
 #define QT_AAAA 28
 #define QT_OPT 41
@@ -66,10 +71,3 @@ enum PacketType {
   OutgoingRequest,
   OutgoingResponse
 };
-
-class DnsObject {
-public:
-  virtual int Read(BytePacketBuffer *bpb) = 0;
-  virtual int Validate(PacketType pt) const = 0;
-  virtual int Write(BytePacketBuffer *bpb) const = 0;
-};
@@ -13,6 +13,9 @@
 #include <cstdint>
 #include <iostream>
 #include <ostream>
+#include <span>
+
+#define HEADER_SIZE 12
 
 /*
  * Header format:
@@ -37,12 +40,16 @@
  *
  */
 
-class DnsHeader : DnsObject {
+class DnsHeader {
 public:
-  DnsHeader() {}
-  virtual ~DnsHeader() {}
+  DnsHeader()
+      : ID(0), hb3(0), hb4(0), QuestionCount(0), AnswerCount(0),
+        AuthorityCount(0), AdditionalCount(0) {}
 
   int Read(BytePacketBuffer *bpb);
+  // From the start of a packet held anywhere, TCP messages may be larger
+  // than the packet buffers
+  int Read(std::span<const uint8_t> packet);
   int Validate(PacketType pt) const;
   int Write(BytePacketBuffer *bpb) const;
 
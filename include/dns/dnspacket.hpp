@@ -8,32 +8,45 @@
 
 #pragma once
 
+#include "bookkeeping/arena.hpp"
 #include "dnsheader.hpp"
 #include "dnsrecord.hpp"
+#include "querykey.hpp"
 #include <cstdint>
-#include <memory>
+#include <functional>
+#include <vector>
 
-class DnsPacket : DnsObject {
+// Full object model of a packet. Questions, records and the names and data
+// in them are allocated from arena, which has to outlive the packet.
+class DnsPacket {
 public:
-  DnsPacket()
-      : header(nullptr), questions(nullptr), answers(nullptr),
+  DnsPacket(Arena &arena)
+      : arena(arena), questions(nullptr), answers(nullptr),
         authorities(nullptr), additionals(nullptr) {}
 
-  virtual ~DnsPacket() {}
-
   int Read(BytePacketBuffer *bpb);
   int Validate(PacketType pt) const;
   int Write(BytePacketBuffer *bpb) const;
-  int Hash(uint8_t *digest) const;
 
-  bool IsRequest() const { return !header->GetQueryResponse(); }
-  bool IsResponse() const { return header->GetQueryResponse(); }
-  bool IsTrucated() const { return header->GetTruncatedMessage(); }
-  bool HasCheckingDisabled() const { return header->GetCheckingDisabled(); }
-  uint16_t GetId() const { return header->ID; }
-  uint8_t GetResponseCode() const { return header->GetResponseCode(); }
-  uint16_t GetQuestionCount() const { return header->QuestionCount; }
-  uint16_t GetAnswerCount() const { return header->AnswerCount; }
+  bool IsRequest() const { return !header.GetQueryResponse(); }
+  bool IsResponse() const { return header.GetQueryResponse(); }
+  bool IsTrucated() const { return header.GetTruncatedMessage(); }
+  bool HasCheckingDisabled() const { return header.GetCheckingDisabled(); }
+  bool IsRecursionDesired() const { return header.GetRecursionDesired(); }
+  uint16_t GetId() const { return header.ID; }
+  uint8_t GetResponseCode() const { return header.GetResponseCode(); }
+  uint16_t GetQuestionCount() const { return header.QuestionCount; }
+  uint16_t GetAnswerCount() const { return header.AnswerCount; }
+  const DnsQuestion *GetQuestion() const {
+    return header.QuestionCount > 0 ? &questions[0] : nullptr;
+  }
+  DnsQuestion *GetQuestion() {
+    return header.QuestionCount > 0 ? &questions[0] : nullptr;
+  }
+  // Empty unless the packet was read and has exactly one question
+  const QueryKey &GetKey() const { return key; }
+  uint32_t GetMinTtl(std::vector<uint16_t> *ttlOffsets) const;
+  uint32_t GetNegativeTtl(std::vector<uint16_t> *ttlOffsets) const;
 
   void SetAsQueryResponse();
   void SetAsQueryRequest();
@@ -42,9 +55,13 @@ public:
   void SetRecursionAvailable(const bool &value);
   void SetCheckingDisabled(const bool &value);
   void SetResponseCode(const uint8_t &responseCode);
-  void SetAnswers(std::function<void(DnsQuestion *, DnsRecord *)> writeAnswer);
+  // One answer per question, filled in by writeAnswer
+  void SetAnswers(
+      std::function<void(const DnsQuestion *, DnsRecord *, Arena &)>
+          writeAnswer);
 
   bool HasPsuedoHeader() const;
+  uint16_t GetPsuedoHeaderLengthOffset() const;
   uint16_t GetUdpPayloadSize() const;
   uint16_t GetExtendedResponseCode() const;
   bool HasDoBit() const;
@@ -54,9 +71,11 @@ public:
   friend std::ostream &operator<<(std::ostream &stream, const DnsPacket &);
 
 private:
-  std::unique_ptr<DnsHeader> header;
-  std::unique_ptr<DnsQuestion[]> questions;
-  std::unique_ptr<DnsRecord[]> answers;
-  std::unique_ptr<DnsRecord[]> authorities;
-  std::unique_ptr<DnsRecord[]> additionals;
+  Arena &arena;
+  DnsHeader header;
+  DnsQuestion *questions;
+  DnsRecord *answers;
+  DnsRecord *authorities;
+  DnsRecord *additionals;
+  QueryKey key;
 };
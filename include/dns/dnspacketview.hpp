@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#pragma once
+
+#include "dnsheader.hpp"
+#include "dnsrecord.hpp"
+#include "querykey.hpp"
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <vector>
+
+// Smallest record is a root owner name and the fixed fields. Records of
+// larger packets, which only come over TCP, are kept on the heap.
+#define MAX_VIEW_RECORDS ((MAX_PACKET_SZ) / (1 + RRFIXEDSZ))
+
+// A packet read in place from the buffer it was received into. Only the
+// header and the question are looked at up front, the resource records are
+// located the first time something asks about them and never decoded into
+// objects. Forwarding and caching need no more than this, DnsPacket is left
+// for replies which have to be rebuilt.
+//
+// The buffer has to outlive the view. Setters patch the buffer in place.
+class DnsPacketView {
+public:
+  template <std::size_t N>
+  DnsPacketView(PacketBuffer<N> &pb)
+      : buf(pb.buf.data()), capacity(N), length(pb.size), nameStart(0),
+        nameEnd(0), questionsEnd(0), indexed(-1), records(0), opt(-1),
+        record(fixed) {}
+  DnsPacketView(const DnsPacketView &) = delete;
+  DnsPacketView &operator=(const DnsPacketView &) = delete;
+
+  int Read();
+  // Also locates every record and checks its RDATA against the codecs in
+  // rrtypes.hpp, so it rejects what DnsPacket::Read() would
+  int Validate(PacketType pt);
+
+  bool IsRequest() const { return !header.GetQueryResponse(); }
+  bool IsResponse() const { return header.GetQueryResponse(); }
+  bool IsTrucated() const { return header.GetTruncatedMessage(); }
+  bool HasCheckingDisabled() const { return header.GetCheckingDisabled(); }
+  bool IsRecursionDesired() const { return header.GetRecursionDesired(); }
+  uint16_t GetId() const { return header.ID; }
+  uint8_t GetResponseCode() const { return header.GetResponseCode(); }
+  uint16_t GetQuestionCount() const { return header.QuestionCount; }
+  uint16_t GetAnswerCount() const { return header.AnswerCount; }
+  // Empty unless the packet has exactly one question
+  const QueryKey &GetKey() const { return key; }
+  // Labels of the first question as they are in the packet, up to the
+  // terminating root label or a compression pointer.
+  std::span<uint8_t> GetQuestionName() const {
+    return std::span<uint8_t>(buf + nameStart, nameEnd - nameStart);
+  }
+  // Letter case of that name as QueryKey::SaveCase() has it, found while
+  // the key was lowercased
+  const uint8_t *GetNameCase() const { return nameCase; }
+
+  uint32_t GetMinTtl(std::vector<uint16_t> *ttlOffsets);
+  uint32_t GetNegativeTtl(std::vector<uint16_t> *ttlOffsets);
+  bool HasPsuedoHeader();
+  uint16_t GetPsuedoHeaderLengthOffset();
+  bool HasDoBit();
+  // Requestor's UDP payload size from the psuedo header, 0 without one
+  uint16_t GetUdpPayloadSize();
+  // Header, questions and psuedo header with TC set. What a client gets
+  // when the whole reply does not fit its payload size (RFC 6891 section 7)
+  int WriteTruncated(BytePacketBuffer *out);
+
+  void SetId(const uint16_t &id);
+  void SetAsQueryResponse();
+  void SetAsAuthoritativeAnswer(const bool &value);
+  void SetRecursionAvailable(const bool &value);
+  void SetResponseCode(const uint8_t &responseCode);
+  // Only if there is a psuedo header
+  void SetUdpPayloadSize(const uint16_t &size);
+  // Appends a psuedo header advertising size, packets which already have
+  // one are left as they are
+  int AddPsuedoHeader(const uint16_t &size);
+  int RemovePsuedoHeader();
+
+  const uint8_t *Data() const { return buf; }
+  // Header and questions, where the records start
+  std::size_t QuestionsEnd() const { return questionsEnd; }
+  std::size_t Size() const { return length; }
+
+  friend std::ostream &operator<<(std::ostream &stream,
+                                  const DnsPacketView &);
+
+private:
+  struct Record {
+    uint16_t ttl; // Offset of the TTL, type and class are just before it
+    uint16_t len; // RDLENGTH, RDATA follows it
+    uint16_t type;
+    DnsRecord::DnsRecordType section;
+  };
+
+  int index();
+  Record &addRecord();
+  void writeFlags();
+  void writeAdditionalCount(uint16_t count);
+  std::span<const uint8_t> packet() const {
+    return std::span<const uint8_t>(buf, length);
+  }
+
+  uint8_t *buf;
+  std::size_t capacity;
+  std::size_t &length; // The size field of the buffer
+  DnsHeader header;
+  QueryKey key;
+  uint8_t nameCase[NAME_CASE_SIZE];
+  uint16_t nameStart;
+  uint16_t nameEnd;
+  uint16_t questionsEnd;
+  int indexed; // Result of locating the records, -1 until then
+  uint16_t records;
+  int opt; // Record holding the psuedo header, -1 if there is none
+  // Either fixed or spilled, once there are more records than fit in place
+  Record *record;
+  Record fixed[MAX_VIEW_RECORDS];
+  std::vector<Record> spilled;
+};
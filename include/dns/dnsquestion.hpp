@@ -8,34 +8,61 @@
 
 #pragma once
 
+#include "bookkeeping/arena.hpp"
 #include "dnscommon.hpp"
 
+#include <array>
 #include <ostream>
+#include <span>
 
-struct SHA256_CTX;
+#define COMPRESSION_ENTRIES 64
 
-class DnsQuestion : DnsObject {
+// Suffixes of the names already written to a packet, so that later names
+// can point at them instead (RFC 1035 section 4.1.4). Only offsets which a
+// pointer can reach are kept, and nothing once the table is full.
+class CompressionTable {
 public:
-  DnsQuestion() {}
-  virtual ~DnsQuestion() {}
+  CompressionTable() : count(0) {}
 
+  // Labels up to the longest suffix written before, then a pointer to it
+  void WriteName(std::span<const uint8_t> name, BytePacketBuffer *bpb);
+
+private:
+  struct Entry {
+    std::span<const uint8_t> suffix; // Has to stay valid until done writing
+    uint16_t offset;
+  };
+
+  std::array<Entry, COMPRESSION_ENTRIES> entries;
+  std::size_t count;
+};
+
+// Names are kept in uncompressed wire format, root label included, in the
+// arena of the packet they belong to.
+class DnsQuestion {
+public:
   friend std::ostream &operator<<(std::ostream &stream, const DnsQuestion &);
 
-  int Read(BytePacketBuffer *bpb);
+  int Read(BytePacketBuffer *bpb, Arena &arena);
   int Validate(PacketType pt) const;
   int Write(BytePacketBuffer *bpb) const;
+  int Write(BytePacketBuffer *bpb, CompressionTable &names) const;
   bool IsQuestionOfType(uint16_t type);
 
-  int UpdateDigest(SHA256_CTX *) const;
+  // From a dotted name
+  int SetName(const char *name, Arena &arena);
+
+  // Dotted form of a wire format name
+  static void PrintName(std::ostream &stream, std::span<const uint8_t> name);
 
 protected:
-  int ReadLabel(BytePacketBuffer *bpb, char *storage);
-  int WriteLabel(const char *in, BytePacketBuffer *bpb) const;
-  int updateDigest(SHA256_CTX *) const;
+  // Follows compression pointers. The expanded name is written to out,
+  // which has room for MAX_WIRE_NAME bytes.
+  static int ReadName(BytePacketBuffer *bpb, uint8_t *out, std::size_t &size);
 
 public:
   std::size_t Start;
-  char Name[MAXDNAME];
+  std::span<const uint8_t> Name;
   uint16_t Type;
   uint16_t Class;
 };
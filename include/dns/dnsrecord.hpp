@@ -12,55 +12,43 @@
 #include "dnsquestion.hpp"
 #include <cstdint>
 
-struct Ipv4Address {
-  uint32_t n;
-};
-
-struct Ipv6Address {
-  uint32_t n1;
-  uint32_t n2;
-  uint32_t n3;
-  uint32_t n4;
-};
-
+// Record with its RDATA kept as bytes. Names inside RDATA are expanded when
+// the record is read, so the bytes can be written into any packet and the
+// names of the well known types compressed against it. Types without names
+// to expand, including all those not known here, are copied unchanged.
 class DnsRecord : public DnsQuestion {
 public:
   enum DnsRecordType { Answer, Authority, Additional };
 
-  DnsRecord() = default;
-  virtual ~DnsRecord() {
-    if (Type == QT_OPT && Address.Opt.octet) {
-      delete[] Address.Opt.octet;
-    }
-  }
-
-  int Read(BytePacketBuffer *bpb);
-  int Validate(PacketType pt) const;
+  // Also checks RDATA against the layout of its type, Validate() is that of
+  // the question
+  int Read(BytePacketBuffer *bpb, Arena &arena);
   int Write(BytePacketBuffer *bpb) const;
+  int Write(BytePacketBuffer *bpb, CompressionTable &names) const;
   void UpdateFromQuestion(const DnsQuestion *);
 
   friend std::ostream &operator<<(std::ostream &stream, const DnsRecord &);
 
   DnsRecordType RecordType;
-  uint16_t &UdpSize = Class;
 
+  // Psuedo header (OPT) fields
+  uint16_t GetUdpSize() const { return Class; }
+  void SetUdpSize(uint16_t size) { Class = size; }
   uint8_t GetExtendedRcode() const { return TTL >> 24; }
   bool GetDoBit() const { return (TTL & 0x8000) > 1; }
   bool GetAdBit() const { return (TTL & 0x2000) > 1; }
 
+  // MINIMUM of a SOA record, the last field of its RDATA
+  uint32_t GetSoaMinimum() const;
+
+  std::size_t TtlStart;
   uint32_t TTL;
-  uint16_t Len;
-  union {
-    Ipv4Address Ipv4;     // A
-    char NS[MAXDNAME];    // NS
-    char CName[MAXDNAME]; // CNAME
-    struct {              // MX
-      uint16_t priority;
-      char host[MAXDNAME];
-    } MailExchange;
-    Ipv6Address Ipv6; // AAAA
-    struct {          // OPT
-      uint8_t *octet;
-    } Opt;
-  } Address;
+  std::span<const uint8_t> Data;
+
+private:
+  // One instantiation per codec in RrTypes
+  template <typename Rr>
+  int readData(BytePacketBuffer *bpb, uint16_t len, Arena &arena);
+  template <typename Rr>
+  int writeData(BytePacketBuffer *bpb, CompressionTable &names) const;
 };
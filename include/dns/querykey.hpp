@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#pragma once
+
+#include "dnscommon.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <span>
+#include <string_view>
+
+#define NAME_CASE_SIZE 32 /* one bit per octet of a wire format name */
+
+class DnsQuestion;
+
+// Question of a query in canonical form: the name in uncompressed wire
+// format with ASCII letters lowercased, then QTYPE and QCLASS. Queries with
+// equal keys get the same answer whatever case the client used.
+class QueryKey {
+public:
+  QueryKey() : size(0), hash(0) {}
+
+  // From the question at pos, following compression pointers. The letter
+  // case of the name goes to nameCase, see SaveCase(), if one is given.
+  int Read(std::span<const uint8_t> packet, std::size_t pos,
+           uint8_t *nameCase = nullptr);
+  int Read(const BytePacketBuffer &bpb, std::size_t pos,
+           uint8_t *nameCase = nullptr) {
+    return Read(std::span<const uint8_t>(bpb.buf.data(), bpb.size), pos,
+                nameCase);
+  }
+  // From a question which was not read off the wire
+  int Set(const DnsQuestion &question);
+  void Clear() { size = hash = 0; }
+
+  bool Empty() const { return size == 0; }
+  uint64_t Hash() const { return hash; }
+  std::string_view Bytes() const {
+    return std::string_view((const char *)data, size);
+  }
+  // Lowercased name in wire format, without QTYPE and QCLASS
+  std::span<const uint8_t> Name() const {
+    return std::span<const uint8_t>(data, size > 4 ? size - 4 : 0);
+  }
+
+  bool operator==(const QueryKey &other) const {
+    return hash == other.hash && size == other.size &&
+           std::memcmp(data, other.data, size) == 0;
+  }
+
+  // Seeded per process so that nobody can pick names which collide
+  static uint64_t HashBytes(const void *data, std::size_t size);
+  // ASCII only, 32 or 16 bytes at a time with AVX2 or SSE2. If bits is
+  // given it gets the case bitmap of SaveCase() in the same pass.
+  static void ToLower(uint8_t *data, std::size_t size,
+                      uint8_t *bits = nullptr);
+
+  enum class Kernel { Scalar, Sse2, Avx2 };
+  // Picks how ToLower() runs, the best the CPU supports up to kernel. The
+  // best one is picked at startup, this is for tests and benchmarks.
+  static Kernel UseKernel(Kernel kernel);
+
+  // Letter case of a wire format name as a bitmap, so that a reply to a
+  // lowercased key can carry the case each client used.
+  static void SaveCase(std::span<const uint8_t> name, uint8_t *bits);
+  static void RestoreCase(std::span<uint8_t> name, const uint8_t *bits);
+
+  // Dotted name, type and class
+  friend std::ostream &operator<<(std::ostream &stream, const QueryKey &);
+
+private:
+  void finish(std::size_t nameSize, uint8_t *nameCase);
+
+  uint8_t data[MAX_WIRE_NAME + 4];
+  uint16_t size;
+  uint64_t hash;
+};
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#pragma once
+
+#include "dnspacketview.hpp"
+#include "net/netcommon.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#define RESPONDER_TEMPLATES 16
+#define RESPONDER_TTL 3600
+#define ANSWER_TEMPLATE_SZ (2 + RRFIXEDSZ + 4 * IPV6_SIZE)
+
+// Replies built straight from the bytes of a request. The header and the
+// question are echoed and for a redirect one answer pointing back at the
+// question name is appended, nothing is decoded into a DnsPacket. Answer
+// records are encoded once per target and query type and then copied.
+class Responder {
+public:
+  Responder() : next(0) {}
+
+  // Answer with target for A and AAAA questions, no data for other types
+  int Redirect(const DnsPacketView &request, const union IpAddress &target,
+               BytePacketBuffer *out);
+  // Reply without records, like REFUSED or NXDOMAIN
+  int Reject(const DnsPacketView &request, uint8_t responseCode,
+             BytePacketBuffer *out);
+
+private:
+  struct Template {
+    uint16_t type; // 0 while unused
+    union IpAddress target;
+    std::array<uint8_t, ANSWER_TEMPLATE_SZ> rr;
+    std::size_t size;
+  };
+
+  const Template &answer(const union IpAddress &target, uint16_t type);
+  int write(const DnsPacketView &request, uint8_t responseCode,
+            const Template *answer, BytePacketBuffer *out) const;
+
+  std::array<Template, RESPONDER_TEMPLATES> templates{};
+  std::size_t next; // Template replaced when none matches
+};
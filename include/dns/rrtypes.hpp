@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#pragma once
+
+#include "dnscommon.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+// RDATA layout of a record type: fixed fields before and after the names in
+// it. Names are expanded when read and compressed when written, so only
+// types from RFC 1035 may list them (RFC 3597 section 4).
+template <uint16_t type, uint16_t length, uint8_t prefix, uint8_t names,
+          uint8_t suffix, bool additionalOnly = false>
+struct RrCodec {
+  static constexpr uint16_t Type = type;
+  static constexpr uint16_t Length = length; // Of all RDATA, 0 if it varies
+  static constexpr uint8_t Prefix = prefix;
+  static constexpr uint8_t Names = names;
+  static constexpr uint8_t Suffix = suffix;
+  static constexpr bool AdditionalOnly = additionalOnly;
+  // Largest RDATA once its names are expanded
+  static constexpr std::size_t Expanded =
+      length ? length : prefix + names * MAX_WIRE_NAME + suffix;
+};
+
+struct RrA : RrCodec<QT_A, 4, 0, 0, 0> {};
+struct RrNs : RrCodec<QT_NS, 0, 0, 1, 0> {};
+struct RrCname : RrCodec<QT_CNAME, 0, 0, 1, 0> {};
+struct RrSoa : RrCodec<QT_SOA, 0, 0, 2, 5 * 4> {}; // MNAME, RNAME, 5 numbers
+struct RrPtr : RrCodec<QT_PTR, 0, 0, 1, 0> {};
+struct RrMx : RrCodec<QT_MX, 0, 2, 1, 0> {}; // PREFERENCE, EXCHANGE
+struct RrAaaa : RrCodec<QT_AAAA, 16, 0, 0, 0> {};
+struct RrOpt : RrCodec<QT_OPT, 0, 0, 0, 0, true> {};
+// Everything else, copied as it is
+struct RrOpaque : RrCodec<QT_Unknown, 0, 0, 0, 0> {};
+
+template <typename... Rr> struct RrRegistry {
+  // Calls codec.template operator()<Rr>() with the codec of type, one
+  // instantiation per codec so each is compiled for its own layout.
+  template <typename F> static int Dispatch(uint16_t type, F &&codec) {
+    int code = E_NOERROR;
+    bool known = ((type == Rr::Type &&
+                   (code = codec.template operator()<Rr>(), true)) ||
+                  ...);
+    return known ? code : codec.template operator()<RrOpaque>();
+  }
+};
+
+typedef RrRegistry<RrA, RrNs, RrCname, RrSoa, RrPtr, RrMx, RrAaaa, RrOpt>
+    RrTypes;
@@ -8,28 +8,44 @@
 
 #pragma once
 
+#include "bookkeeping/cache.hpp"
 #include "bookkeeping/ethmappings.hpp"
 #include "bookkeeping/peer.hpp"
+#include "bookkeeping/selector.hpp"
 #include "bookkeeping/server.hpp"
+#include "bookkeeping/timerwheel.hpp"
 #include "config.hpp"
 #include "dnspacket.hpp"
+#include "dnspacketview.hpp"
+#include "responder.hpp"
+#include "tcpconnection.hpp"
+#include "tcpupstream.hpp"
 #include "net/netcommon.h"
 #include "rule/shm.hpp"
 
 #include <boost/asio/generic/raw_protocol.hpp>
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ip/udp.hpp>
 #include <boost/asio/ip/v6_only.hpp>
-#include <boost/compute/detail/lru_cache.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/system/detail/error_code.hpp>
+#include <array>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <span>
+#include <string>
+#include <unordered_map>
 #include <vector>
-
-#define ONE_HOUR 1 * 60 * 60;
+#ifdef __linux
+#include <sys/socket.h>
+#endif /* __linux */
 
 using boost::asio::generic::raw_protocol;
+using boost::asio::ip::tcp;
 using boost::asio::ip::udp;
 
 class RuleEngine;
@@ -43,56 +59,215 @@ struct SocketData {
   RawPacketBuffer recvBuffer;
 };
 
+#ifdef __linux
+// Datagrams moved with a single recvmmsg/sendmmsg call.
+struct UdpBatch {
+  UdpBatch(std::size_t size)
+      : buffers(size), endpoints(size), headers(size), iovecs(size),
+        count(0) {}
+
+  std::size_t Capacity() const { return buffers.size(); }
+
+  std::vector<BytePacketBuffer> buffers;
+  std::vector<udp::endpoint> endpoints;
+  std::vector<mmsghdr> headers;
+  std::vector<iovec> iovecs;
+  std::size_t count;
+};
+
+#define FANOUT_SIZE 64
+#define FANOUT_IOVECS 4
+
+// One reply going out to every client waiting for it. Only the ID and the
+// case of the question name differ between the datagrams, everything else
+// is gathered from the reply itself.
+struct UdpFanout {
+  UdpFanout()
+      : ids(FANOUT_SIZE), names(FANOUT_SIZE), endpoints(FANOUT_SIZE),
+        headers(FANOUT_SIZE), iovecs(FANOUT_SIZE * FANOUT_IOVECS), count(0) {}
+
+  std::vector<std::array<uint8_t, 2>> ids;
+  std::vector<std::array<uint8_t, MAX_WIRE_NAME>> names;
+  std::vector<udp::endpoint> endpoints;
+  std::vector<mmsghdr> headers;
+  std::vector<iovec> iovecs;
+  std::size_t count;
+};
+#endif /* __linux */
+
+struct UdpSocketData {
+  UdpSocketData(boost::asio::io_context &ioContext, bool ipv4, bool upstream)
+      : socket(ioContext), endpoint{}, recvBuffer{}, ipv4(ipv4),
+        upstream(upstream) {}
+
+  udp::socket socket;
+  udp::endpoint endpoint;
+  BytePacketBuffer recvBuffer;
+  bool ipv4;
+  // Upstream sockets only carry responses from configured servers, listeners
+  // only carry requests from clients.
+  bool upstream;
+#ifdef __linux
+  // Only allocated when batched I/O is enabled
+  std::unique_ptr<UdpBatch> in;
+  std::unique_ptr<UdpBatch> out;
+#endif /* __linux */
+};
+
 class DnsServer {
 public:
   DnsServer(boost::asio::io_context &io_context, uint16_t port,
             const ConfigReader *configReader, ShmRuleEngine *ruleEngine);
   ~DnsServer();
 
-  void Resolve(DnsPacket *p, const udp::endpoint *e, const bool i);
+  void Resolve(DnsPacketView *p, const udp::endpoint *e, const bool i);
 
-  void Redirect(DnsPacket *p, const udp::endpoint *e, const bool i,
+  void Redirect(DnsPacketView *p, const udp::endpoint *e, const bool i,
                 const union IpAddress &target);
+  void Reject(DnsPacketView *p, const udp::endpoint *e, const bool i,
+              const uint8_t responseCode);
+  void Drop(DnsPacketView *p, const udp::endpoint *e);
 
 private:
-  void initUpstreamServers();
+  void initUpstreamServers(boost::asio::io_context &io_context);
+  std::unique_ptr<boost::asio::ssl::context> newTlsContext();
   void startRawSocketScan(boost::asio::io_context &io_context,
                           const uint16_t &port);
   void startDnsListeners(const uint16_t &port);
+  void openListener(UdpSocketData &d, const uint16_t &port);
+  void openUpstream(UdpSocketData &d);
+  void openTcpListener(tcp::acceptor &a, bool ipv4, const uint16_t &port);
+  void accept(tcp::acceptor &a);
+  void addTcpConnection(tcp::socket socket);
+  void processTcpQuery(TcpConnection &c, std::span<const uint8_t> message);
+  bool replyTo(const PeerRequests::PeerRequestRecord::PeerSource *s);
+  void noReply();
+  uint16_t clientUdpSize(DnsPacketView &packet) const;
 
-  void receive(boost::system::error_code ec, std::size_t, bool ipv4);
+  void receive(boost::system::error_code ec, std::size_t, UdpSocketData *d);
+  void processDatagram(BytePacketBuffer &bpb, udp::endpoint &endpoint,
+                       std::size_t n, UdpSocketData *d);
   void receiveRawData(boost::system::error_code ec, std::size_t, bool ipv4,
                       SocketData *d);
 
-  bool processRequest(DnsPacket &packet, int &res,
+  bool processRequest(DnsPacketView &packet, int &res,
                       const udp::endpoint &endpoint, bool ipv4);
-  bool processUpstreamResponse(DnsPacket &packet, int &res,
+  bool processUpstreamResponse(DnsPacketView &packet, int &res,
                                udp::endpoint &endpoint);
+  void processTcpReply(UpstreamServerInfo *server,
+                       std::span<const uint8_t> message);
+  void cacheResponse(DnsPacketView &packet, unsigned int flags,
+                     const std::time_t &now);
+  bool sendStale(const std::string &key, std::span<const uint8_t> name,
+                 uint16_t id, const udp::endpoint &endpoint, bool ipv4,
+                 uint16_t udpSize, const std::time_t &now);
+  bool serveStale(PeerRequests::PeerRequestRecord *r, const std::string &key,
+                  const std::time_t &now);
+  void addStaleDeadline(PeerRequests::PeerRequestRecord *r,
+                        const std::string &key);
 
-  void resolve(DnsPacket &packet, const udp::endpoint &endpoint, bool ipv4);
-  void sendPacket(const DnsPacket &packet, const udp::endpoint &endpoint,
-                  bool ipv4);
-  void updateErrorResponse(DnsPacket &packet, const uint8_t &errCode);
-  void updateRedirectResponse(DnsPacket &packet,
-                              const union IpAddress &target) const;
+  void resolve(DnsPacketView &packet, const udp::endpoint &endpoint,
+               bool ipv4);
+  void sendPacket(DnsPacketView &packet, const udp::endpoint &endpoint,
+                  bool ipv4, uint16_t udpSize);
+  void fitReply(BytePacketBuffer *out, uint16_t udpSize);
+  void sendToClients(DnsPacketView &packet,
+                     PeerRequests::PeerRequestRecord *r);
+  void forwardPacket(const DnsPacketView &packet,
+                     PeerRequests::PeerRequestRecord *r);
+  void sendQuery(PeerRequests::PeerRequestRecord *r,
+                 UpstreamServerInfo *server);
+  void addRetransmit(PeerRequests::PeerRequestRecord *r);
+  void retransmit(PeerRequests::PeerRequestRecord *r);
+  void failQuery(PeerRequests::PeerRequestRecord *r, const std::time_t &now);
+  void dropQuery(PeerRequests::PeerRequestRecord *r);
+  void sendResponse(const DnsPacketView &request,
+                    const udp::endpoint &endpoint, UdpSocketData &d,
+                    BytePacketBuffer *out, int res);
+  BytePacketBuffer *outBuffer(UdpSocketData &d);
+  bool send(UdpSocketData &d, BytePacketBuffer *out,
+            const udp::endpoint &endpoint);
+  void updateErrorResponse(DnsPacketView &packet, const uint8_t &errCode);
 
-  void receive4();
-  void receive6();
+  void receive(UdpSocketData *d);
   void receive(SocketData *d);
 
+#ifdef __linux
+  void receiveBatch(UdpSocketData *d);
+  void flush(UdpSocketData &d);
+  void flushAll();
+  void sendFanout(const DnsPacketView &packet,
+                  PeerRequests::PeerRequestRecord *r, UdpSocketData &d);
+  void flushFanout(UdpSocketData &d);
+#endif /* __linux */
+
+  void scheduleStats();
+  void logStats() const;
+
 private:
+  // Expiry of everything below
+  TimerWheel timers;
   PeerRequests peerRequests;
   EthMappings ethmappings;
+  ResponseCache cache;
+  std::vector<uint16_t> ttlOffsets;
 
-  udp::socket socket4;
-  udp::endpoint endpoint4;
-  BytePacketBuffer recvBuffer4;
-  udp::socket socket6;
-  udp::endpoint endpoint6;
-  BytePacketBuffer recvBuffer6;
+  UdpSocketData listener4;
+  UdpSocketData listener6;
+  UdpSocketData upstream4;
+  UdpSocketData upstream6;
+  tcp::acceptor acceptor4;
+  tcp::acceptor acceptor6;
+  // Sources refer to their connection by ID, a reply for a connection
+  // closed meanwhile finds nothing and is dropped
+  std::unordered_map<uint64_t, std::shared_ptr<TcpConnection>> tcpConnections;
+  uint64_t lastTcpId;
+  // Set while replying to a client connected over TCP, replies for the
+  // listeners go to it instead
+  TcpConnection *tcpClient;
+  BytePacketBuffer sendBuffer;
+  // TCP messages and the queries read from them, which may not fit the
+  // packet buffers
+  TcpPacketBuffer tcpBuffer;
+  Responder responder;
   std::vector<std::unique_ptr<SocketData>> socketData;
+  // Set while a received batch is processed, replies are queued and flushed
+  // together once the whole batch is done.
+  bool batching;
+#ifdef __linux
+  UdpFanout fanout;
+#endif /* __linux */
+  boost::asio::steady_timer statsTimer;
+
+  struct {
+    uint64_t receiveBatches;
+    uint64_t received;
+    uint64_t sendBatches;
+    uint64_t sent;
+    uint64_t fanouts;
+    uint64_t fanoutClients;
+    uint64_t truncated;
+    uint64_t tcpAccepted;
+    uint64_t tcpRefused;
+    uint64_t tcpQueries;
+    uint64_t tcpRetries;
+    uint64_t prefetches;
+    uint64_t prefetchesSkipped;
+    uint64_t retransmits;
+    uint64_t servfails;
+    uint64_t redirected;
+    uint64_t rejected;
+    uint64_t dropped;
+  } stats;
 
   const ConfigReader *configReader;
   ShmRuleEngine *ruleEngine;
   std::list<std::unique_ptr<UpstreamServerInfo>> servers;
+  // Shared by the TLS connections of all servers, created for the first one
+  std::unique_ptr<boost::asio::ssl::context> tlsContext;
+  // TCP connections of each server, for truncated replies and servers
+  // configured with protocol tcp or tls
+  std::unordered_map<const UpstreamServerInfo *, std::unique_ptr<TcpUpstream>>
+      tcpUpstreams;
+  UpstreamSelector selector;
 };
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#pragma once
+
+#include "bookkeeping/timerwheel.hpp"
+#include "net/netcommon.h"
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+// Read buffer of a connection, grown for larger messages while they last
+#define TCP_BUFFER_SIZE 4096
+// Queries of one connection waiting for a reply before reading stops
+#define TCP_PIPELINE 32
+// Replies queued for a client which does not read them before it is dropped
+#define TCP_MAX_QUEUED (256 * 1024)
+
+// Bytes read from a TCP connection, split into the DNS messages in them.
+// Each message is preceded by its length in two bytes (RFC 1035 section
+// 4.2.2), any number of them may arrive with one read. Messages take up to
+// PACKET_SZ_MAX bytes.
+class TcpFramer {
+public:
+  TcpFramer() : buf(TCP_BUFFER_SIZE), start(0), end(0) {}
+
+  // Room for the next read, what is left of a message is moved to the front
+  // and the buffer grown if it does not fit
+  std::span<uint8_t> Free();
+  void Commit(std::size_t n);
+
+  // Takes the next message off the buffer, false until all of it was read.
+  // The message stays valid until Free() is called.
+  bool Next(std::span<const uint8_t> &message);
+
+private:
+  std::vector<uint8_t> buf;
+  std::size_t start;
+  std::size_t end;
+};
+
+// A client connected over TCP. Queries are read while earlier ones are
+// still being resolved and replies are written as they become available,
+// the client tells them apart by ID (RFC 7766 section 6.2.1.1). Owned by
+// the server, pending reads and writes keep it alive until they complete.
+class TcpConnection : public std::enable_shared_from_this<TcpConnection> {
+public:
+  typedef std::function<void(TcpConnection &, std::span<const uint8_t>)>
+      QueryHandler;
+  typedef std::function<void(TcpConnection &)> CloseHandler;
+
+  TcpConnection(tcp::socket socket, uint64_t id, TimerWheel &timers,
+                std::chrono::milliseconds idleTimeout, QueryHandler onQuery,
+                CloseHandler onClose);
+
+  void Start();
+  // Written after replies still in progress
+  void Send(const uint8_t *data, std::size_t size);
+  // The query just handed over gets no reply
+  void Unanswered();
+  void Close();
+
+  uint64_t Id() const { return id; }
+  // Address of the client in the form UDP clients are known by
+  const udp::endpoint &Endpoint() const { return endpoint; }
+  bool Ipv4() const { return ipv4; }
+  unsigned int InFlight() const { return inFlight; }
+
+private:
+  void receive();
+  void resume();
+  void write();
+  void touch();
+
+  tcp::socket socket;
+  uint64_t id;
+  udp::endpoint endpoint;
+  bool ipv4;
+
+  TimerWheel &timers;
+  TimerWheel::Timer idle;
+  std::chrono::milliseconds idleTimeout;
+  QueryHandler onQuery;
+  CloseHandler onClose;
+
+  TcpFramer framer;
+  // Replies being written and those queued behind them, length prefixed
+  std::vector<uint8_t> writing;
+  std::vector<uint8_t> queued;
+  // Queries read and not answered yet
+  unsigned int inFlight;
+  bool reading;
+  // Stopped reading at TCP_PIPELINE queries in flight
+  bool paused;
+  bool closed;
+};
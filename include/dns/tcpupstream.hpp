@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#pragma once
+
+#include "bookkeeping/timerwheel.hpp"
+#include "tcpconnection.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+using boost::asio::ip::tcp;
+
+// Queries one connection carries before another one is opened
+#define UPSTREAM_PIPELINE 64
+// Wait before connecting again after a failure, doubled with every failure
+#define UPSTREAM_BACKOFF_MIN 100 /* ms */
+#define UPSTREAM_BACKOFF_MAX 10000 /* ms */
+
+// Persistent TCP connections to one upstream server, with TLS when a
+// context is given (RFC 7858). Queries are written without waiting for the
+// replies to earlier ones, which come back in any order (RFC 7766 section
+// 6.2.1.1) and are matched to their queries by ID like UDP replies.
+// Connections are opened when queries need them, up to the size of the
+// pool, and closed again after the idle timeout. Opening one, TLS
+// handshake included, may take up to the connect timeout.
+class TcpUpstream {
+public:
+  typedef std::function<void(std::span<const uint8_t>)> ReplyHandler;
+
+  // The certificate of a TLS server has to be valid for tlsName, or for the
+  // address of the server if that is empty. The context may be shared by
+  // the pools of a worker.
+  TcpUpstream(boost::asio::io_context &ioContext, TimerWheel &timers,
+              const tcp::endpoint &endpoint, unsigned int size,
+              std::chrono::milliseconds idleTimeout,
+              std::chrono::milliseconds connectTimeout, ReplyHandler onReply,
+              boost::asio::ssl::context *tls = nullptr,
+              const std::string &tlsName = "");
+  ~TcpUpstream();
+
+  // Sends over the connection with the fewest queries in flight. False if
+  // there is none to use, while waiting to reconnect after a failure.
+  bool Send(const uint8_t *data, std::size_t size);
+
+  // Connections currently open or being opened
+  std::size_t Open() const;
+  // Queries in flight on each of them
+  std::vector<unsigned int> InFlight() const;
+  bool Tls() const { return tls != nullptr; }
+
+  struct {
+    uint64_t queries;
+    uint64_t replies;
+    uint64_t connects;
+    uint64_t failures;
+    // Full TLS handshakes and those which resumed an earlier session
+    uint64_t handshakes;
+    uint64_t resumed;
+    // Most queries in flight on one connection
+    unsigned int maxInFlight;
+  } stats;
+
+private:
+  class Connection;
+
+  void connected();
+  void failed();
+  static int newSession(SSL *ssl, SSL_SESSION *session);
+
+  boost::asio::io_context &ioContext;
+  TimerWheel &timers;
+  tcp::endpoint endpoint;
+  std::chrono::milliseconds idleTimeout;
+  std::chrono::milliseconds connectTimeout;
+  ReplyHandler onReply;
+  // A slot for every connection of the pool, empty until first needed
+  std::vector<std::shared_ptr<Connection>> connections;
+  std::chrono::milliseconds backoff;
+  TimerWheel::Clock::time_point retryAfter;
+
+  boost::asio::ssl::context *tls;
+  std::string tlsName;
+  // Latest session the server handed out, the next connection resumes it
+  SSL_SESSION *session;
+};
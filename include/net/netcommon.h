@@ -61,7 +61,7 @@
   v = READ_U##b(bb);
 #define VREAD_U8(v, bb) _VREAD(bb, v, 1, 8)
 #define VREAD_U16(v, bb) _VREAD(bb, v, 2, 16)
-#define VREAD_U32(v, bb) _VREAD(bb, v, 2, 32)
+#define VREAD_U32(v, bb) _VREAD(bb, v, 4, 32)
 
 #define WRITE_BYTE(bb, b) bb->buf[bb->pos++] = b;
 #define WRITE_U8(bb, b) WRITE_BYTE(bb, b)
@@ -82,6 +82,8 @@ template <std::size_t N> struct PacketBuffer {
 
 typedef PacketBuffer<MAX_PACKET_SZ> BytePacketBuffer;
 typedef PacketBuffer<PACKET_SZ_MAX> RawPacketBuffer;
+// DNS messages over TCP, which take whatever their length prefix allows
+typedef PacketBuffer<PACKET_SZ_MAX> TcpPacketBuffer;
 
 union EthAddress {
   uint8_t v[ETH_ADDR_LEN];
@@ -23,6 +23,8 @@
 #define OPTION_DNS "dns"
 #define OPTION_REDIRECT "redirect"
 #define OPTION_DROP "drop"
+#define OPTION_REFUSE "refuse"
+#define OPTION_NXDOMAIN "nxdomain"
 #define OPTION_FILE "file"
 #define OPTION_TARGET "target"
 #define OPTION_TARGET_4 "target4"
@@ -13,11 +13,11 @@
 
 using boost::asio::ip::udp;
 
-class DnsPacket;
+class DnsPacketView;
 class DnsServer;
 
 struct Input {
-  DnsPacket *packet;
+  DnsPacketView *packet;
   DnsServer *server;
   const udp::endpoint *endpoint;
   const bool ipv4;
@@ -22,7 +22,10 @@
 
 #define DATA_SIZE 8192
 
-enum ActionType { Dns, Redirect };
+// New actions go at the end, rules in shared memory store the value
+enum ActionType { Dns, Redirect, Drop, Refuse, NxDomain };
+
+const char *ActionName(const ActionType &actionType);
 
 enum RuleType { IpAddress, EthAddress, IpAndEthAddress };
 
@@ -78,6 +81,11 @@ public:
   friend std::istream &operator>>(std::istream &ostream, ShmRuleEngine &engine);
 
 private:
+  // Action of the first rule matching input, or of the policy. The target
+  // of a redirect is copied out while the rules are locked.
+  ActionType match(const Input &input, union IpAddress &target) const;
+  // Every action but redirect, which needs a target
+  void apply(const ActionType &actionType, Input &input) const;
   Rule nextRule(uint8_t **loc) const;
   std::size_t insertRules(const Rule *rules, const std::size_t &size,
                           const std::size_t &index);
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "bookkeeping/arena.hpp"
+#include <algorithm>
+#include <cstring>
+
+void *Arena::Allocate(std::size_t size, std::size_t align) {
+  while (true) {
+    if (current < blocks.size()) {
+      Block &block = blocks[current];
+      uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+      std::size_t start = ((base + offset + align - 1) & ~(align - 1)) - base;
+      if (start + size <= block.size) {
+        offset = start + size;
+        used += size;
+        return block.data.get() + start;
+      }
+
+      // Rest of this block is wasted until the next reset
+      current++;
+      offset = 0;
+      continue;
+    }
+
+    // Larger allocations get a block of their own size
+    std::size_t n = std::max(blockSize, size + align);
+    blocks.push_back({std::make_unique_for_overwrite<uint8_t[]>(n), n});
+  }
+}
+
+uint8_t *Arena::Copy(const void *data, std::size_t size) {
+  uint8_t *copy = static_cast<uint8_t *>(Allocate(size, 1));
+  std::memcpy(copy, data, size);
+  return copy;
+}
+
+void Arena::Reset() {
+  current = 0;
+  offset = 0;
+  used = 0;
+}
+
+std::size_t Arena::Capacity() const {
+  std::size_t capacity = 0;
+  for (auto &block : blocks) {
+    capacity += block.size;
+  }
+  return capacity;
+}
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "bookkeeping/cache.hpp"
+#include "dns/dnscommon.hpp"
+#include "dns/dnsquestion.hpp"
+#include "net/netcommon.h"
+#include <cctype>
+#include <cstring>
+#include <ctime>
+
+#define HEADER_SIZE 12
+#define STALE_TTL 30 /* RFC 8767 section 4 */
+#define EDE_OPTION_SIZE 6
+
+std::size_t ResponseCache::Entry::Size() const {
+  // Rough accounting of list node, index slot and heap buffers
+  return sizeof(Entry) + 4 * sizeof(void *) + key.size() + data.size() +
+         ttlOffsets.size() * sizeof(uint16_t);
+}
+
+std::string ResponseCache::Key(const QueryKey &key, unsigned int flags) {
+  std::string bytes;
+  bytes.reserve(key.Bytes().size() + 1);
+  bytes.append(key.Bytes());
+  bytes.push_back(char(flags));
+
+  return bytes;
+}
+
+std::string ResponseCache::Key(const DnsQuestion &question,
+                               unsigned int flags) {
+  QueryKey key;
+  key.Set(question);
+  return Key(key, flags);
+}
+
+void ResponseCache::erase(std::list<Entry>::iterator it) {
+  Lru &lru = pools[it->pool];
+  lru.used -= it->Size();
+  index.erase(it->key);
+  lru.entries.erase(it);
+}
+
+bool ResponseCache::Insert(const std::string &key, const uint8_t *data,
+                           std::size_t size,
+                           const std::vector<uint16_t> &ttlOffsets,
+                           uint32_t ttl, const std::time_t &now, Pool pool,
+                           uint16_t optOffset) {
+  if (!Enabled(pool) || ttl == 0 || size < HEADER_SIZE ||
+      size > MAX_PACKET_SZ) {
+    return false;
+  }
+
+  auto found = index.find(key);
+  if (found != index.end()) {
+    erase(found->second);
+  }
+
+  Lru &lru = pools[pool];
+  lru.entries.push_front(Entry{key, std::vector<uint8_t>(data, data + size),
+                               ttlOffsets, now, ttl, pool, optOffset, 0});
+  auto it = lru.entries.begin();
+  std::size_t entrySize = it->Size();
+  if (entrySize > lru.budget) {
+    lru.entries.pop_front();
+    return false;
+  }
+
+  while (lru.used + entrySize > lru.budget && lru.entries.size() > 1) {
+    erase(std::prev(lru.entries.end()));
+    stats.evictions++;
+  }
+
+  index.emplace(it->key, it);
+  lru.used += entrySize;
+  stats.inserts++;
+  return true;
+}
+
+static void copyQuestionCase(uint8_t *buf, std::size_t size,
+                             std::span<const uint8_t> name) {
+  // Clients may randomise the case of the name (draft-vixie-dnsext-0x20) so
+  // the question is echoed the way this client asked it. Both are the same
+  // name, only the labels stored in place are copied.
+  std::size_t pos = HEADER_SIZE;
+  std::size_t i = 0;
+  while (pos < size && i < name.size() && buf[pos] != 0 &&
+         buf[pos] == name[i] && (buf[pos] & 0xc0) == 0) {
+    std::size_t len = 1 + buf[pos];
+    if (pos + len > size || i + len > name.size()) {
+      break;
+    }
+    std::memcpy(buf + pos, &name[i], len);
+    pos += len;
+    i += len;
+  }
+}
+
+static void writeTtl(uint8_t *buf, uint16_t offset, uint32_t ttl) {
+  buf[offset] = ttl >> 24;
+  buf[offset + 1] = ttl >> 16 & 0xff;
+  buf[offset + 2] = ttl >> 8 & 0xff;
+  buf[offset + 3] = ttl & 0xff;
+}
+
+void ResponseCache::serve(std::list<Entry>::iterator it,
+                          std::span<const uint8_t> name, uint16_t id,
+                          bool recursionDesired, std::time_t elapsed,
+                          BytePacketBuffer *bpb) {
+  std::list<Entry> &entries = pools[it->pool].entries;
+  entries.splice(entries.begin(), entries, it);
+
+  uint8_t *buf = bpb->buf.data();
+  std::memcpy(buf, it->data.data(), it->data.size());
+  bpb->pos = it->data.size();
+
+  buf[0] = id >> 8;
+  buf[1] = id & 0xff;
+  buf[2] = (buf[2] & ~1) | (recursionDesired ? 1 : 0);
+  buf[3] |= 0x80; // Recursion available
+
+  copyQuestionCase(buf, bpb->pos, name);
+
+  bool stale = elapsed >= it->ttl;
+  for (uint16_t offset : it->ttlOffsets) {
+    uint32_t ttl = uint32_t(buf[offset]) << 24 |
+                   uint32_t(buf[offset + 1]) << 16 |
+                   uint32_t(buf[offset + 2]) << 8 | uint32_t(buf[offset + 3]);
+    if (stale) {
+      ttl = STALE_TTL;
+    } else {
+      ttl = ttl > elapsed ? ttl - elapsed : 0;
+    }
+    writeTtl(buf, offset, ttl);
+  }
+
+  // The extended error can only be appended if the psuedo header is the last
+  // record, which is where servers put it unless the reply is signed.
+  uint16_t opt = it->optOffset;
+  if (!stale || opt == 0) {
+    return;
+  }
+  uint16_t optLen = uint16_t(buf[opt]) << 8 | buf[opt + 1];
+  if (std::size_t(opt) + 2 + optLen != bpb->pos ||
+      bpb->pos + EDE_OPTION_SIZE > bpb->buf.size()) {
+    return;
+  }
+
+  uint16_t info = (buf[3] & 0xf) == E_NXDOMAIN ? EDE_STALE_NXD : EDE_STALE;
+  optLen += EDE_OPTION_SIZE;
+  buf[opt] = optLen >> 8;
+  buf[opt + 1] = optLen & 0xff;
+  WRITE_U16(bpb, EDNS_OPTION_EDE)
+  WRITE_U16(bpb, 2)
+  WRITE_U16(bpb, info)
+}
+
+bool ResponseCache::Lookup(const std::string &key,
+                           std::span<const uint8_t> name, uint16_t id,
+                           bool recursionDesired, const std::time_t &now,
+                           BytePacketBuffer *bpb, bool *prefetch) {
+  auto found = index.find(key);
+  if (found == index.end()) {
+    stats.misses++;
+    return false;
+  }
+
+  auto it = found->second;
+  std::time_t elapsed = now > it->inserted ? now - it->inserted : 0;
+  if (elapsed >= it->ttl) {
+    // Kept for LookupStale until the stale window has passed as well
+    if (elapsed >= std::time_t(it->ttl) + staleWindow) {
+      erase(it);
+    }
+    stats.misses++;
+    return false;
+  }
+
+  stats.hits++;
+  if (it->pool == Negative) {
+    stats.negativeHits++;
+  }
+
+  it->hits++;
+  if (prefetch) {
+    uint64_t left = it->ttl - elapsed;
+    *prefetch = prefetchHits > 0 && it->hits >= prefetchHits &&
+                left * 100 <= uint64_t(it->ttl) * prefetchPercent;
+  }
+
+  serve(it, name, id, recursionDesired, elapsed, bpb);
+  return true;
+}
+
+bool ResponseCache::LookupStale(const std::string &key,
+                                std::span<const uint8_t> name, uint16_t id,
+                                bool recursionDesired, const std::time_t &now,
+                                BytePacketBuffer *bpb) {
+  auto found = index.find(key);
+  if (found == index.end()) {
+    return false;
+  }
+
+  auto it = found->second;
+  std::time_t elapsed = now > it->inserted ? now - it->inserted : 0;
+  if (elapsed >= std::time_t(it->ttl) + staleWindow) {
+    erase(it);
+    return false;
+  }
+
+  if (elapsed >= it->ttl) {
+    stats.staleHits++;
+  }
+
+  serve(it, name, id, recursionDesired, elapsed, bpb);
+  return true;
+}
+
+bool ResponseCache::HasStale(const std::string &key,
+                             const std::time_t &now) const {
+  if (staleWindow == 0) {
+    return false;
+  }
+
+  auto found = index.find(key);
+  if (found == index.end()) {
+    return false;
+  }
+
+  const Entry &entry = *found->second;
+  std::time_t elapsed = now > entry.inserted ? now - entry.inserted : 0;
+  return elapsed >= entry.ttl &&
+         elapsed < std::time_t(entry.ttl) + staleWindow;
+}
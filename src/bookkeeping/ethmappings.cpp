@@ -17,28 +17,21 @@
 
 bool EthMappings::Add(const union EthAddress &ethaddress, const bool &ipv4,
                       const union IpAddress &ipaddress) {
-  MacMappingRecord *oldest = nullptr;
+  MacMappingRecord *unused = nullptr;
   MacMappingRecord *target = nullptr;
-  auto now = GetNow();
 
-  for (std::size_t i = 0; i < count; i++) {
-    auto &r = records[i];
-    if (std::ranges::equal(r.ethaddress.v, ethaddress.v)) {
+  for (auto &r : records) {
+    if (!r.used) {
+      unused = unused ? unused : &r;
+    } else if (std::ranges::equal(r.ethaddress.v, ethaddress.v)) {
       target = &r;
       break;
     }
-
-    if (!oldest || oldest->time < r.time) {
-      oldest = &r;
-    }
-  }
-
-  if (!target && count < MAX_MAC_IP_MAPPINGS) {
-    target = &records[count++];
   }
 
-  if (!target && oldest && std::difftime(now, oldest->time) > TIMEOUT) {
-    target = oldest;
+  // Mappings not refreshed within TIMEOUT have been freed already
+  if (!target) {
+    target = unused;
   }
 
   if (target) {
@@ -49,7 +42,10 @@ bool EthMappings::Add(const union EthAddress &ethaddress, const bool &ipv4,
     } else {
       std::ranges::copy(ipaddress.Ipv6v, target->ipaddress.Ipv6v);
     }
-    target->time = now;
+    target->time = GetNow();
+    target->used = true;
+    timers.Schedule(target->expiry, std::chrono::seconds(TIMEOUT),
+                    [target]() { target->used = false; });
     return true;
   }
 
@@ -58,9 +54,8 @@ bool EthMappings::Add(const union EthAddress &ethaddress, const bool &ipv4,
 
 const EthMappings::MacMappingRecord *
 EthMappings::LookUp(const union IpAddress &ipaddress, const bool &ipv4) const {
-  for (std::size_t i = 0; i < count; i++) {
-    auto &r = records[i];
-    if (r.ipv4 == ipv4 &&
+  for (auto &r : records) {
+    if (r.used && r.ipv4 == ipv4 &&
         ((ipv4 && ipaddress.Ipv4 == r.ipaddress.Ipv4) ||
          (!ipv4 && std::ranges::equal(ipaddress.Ipv6, r.ipaddress.Ipv6)))) {
       return &r;
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "bookkeeping/idallocator.hpp"
+
+#include <cerrno>
+#include <random>
+#ifdef __linux
+#include <sys/random.h>
+#endif /* __linux */
+
+// ID 0 is never handed out so that it can mean none
+IdAllocator::IdAllocator()
+    : ids(0xffff), available(0xffff), words{}, nextWord(ID_RANDOM_WORDS) {
+  for (std::size_t i = 0; i < ids.size(); i++) {
+    ids[i] = i + 1;
+  }
+  used.set(0);
+}
+
+uint16_t IdAllocator::Allocate() {
+  if (available == 0) {
+    return 0;
+  }
+
+  std::size_t i = pick(available);
+  uint16_t id = ids[i];
+  ids[i] = ids[--available];
+  used.set(id);
+
+  return id;
+}
+
+void IdAllocator::Free(uint16_t id) {
+  if (!used[id] || id == 0) {
+    return;
+  }
+
+  used.reset(id);
+  ids[available++] = id;
+}
+
+uint32_t IdAllocator::pick(uint32_t n) {
+  // Words below 2^32 mod n would make the low indexes more likely
+  uint32_t threshold = uint32_t(-n) % n;
+  while (true) {
+    uint32_t r = random();
+    if (r >= threshold) {
+      return r % n;
+    }
+  }
+}
+
+// Fetched in blocks, a system call for every query would cost more than the
+// rest of forwarding it
+uint32_t IdAllocator::random() {
+  if (nextWord == words.size()) {
+    std::size_t filled = 0;
+#ifdef __linux
+    auto *bytes = reinterpret_cast<uint8_t *>(words.data());
+    while (filled < sizeof(words)) {
+      ssize_t n = getrandom(bytes + filled, sizeof(words) - filled, 0);
+      if (n < 0 && errno != EINTR) {
+        break;
+      }
+      filled += n > 0 ? n : 0;
+    }
+    filled /= sizeof(uint32_t);
+#endif /* __linux */
+    // Elsewhere, or without getrandom, the standard library's device is the
+    // system generator
+    if (filled < words.size()) {
+      std::random_device device;
+      for (; filled < words.size(); filled++) {
+        words[filled] = device();
+      }
+    }
+    nextWord = 0;
+  }
+
+  return words[nextWord++];
+}
@@ -8,26 +8,31 @@
 
 #include "bookkeeping/peer.hpp"
 #include "log.hpp"
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <utility>
 
-#define MAX_FWD_QUERIES 150
 #define TIMEOUT 10 /* drop UDP queries after TIMEOUT seconds */
+#define EXPIRY (4 * TIMEOUT) /* free records nobody freed after EXPIRY */
+#define EMPTY_SLOT UINT32_MAX
 
-bool PeerRequests::PeerRequestRecord::HasTimedOut() const {
-  return time > TIMEOUT;
+bool PeerRequests::PeerRequestRecord::HasTimedOut(
+    const std::time_t &now) const {
+  return std::difftime(now, time) >= TIMEOUT;
 }
 
-static void handleMaxFwdQueries(const std::time_t &now) {
-  static std::time_t lastLog = 0;
-  static uint32_t skipCount = 0;
+static void handleMaxFwdQueries(const std::time_t &now, std::size_t max) {
+  // Each worker thread owns its own PeerRequests
+  thread_local std::time_t lastLog = 0;
+  thread_local uint32_t skipCount = 0;
 
   // Do not flood logs
   if ((int)difftime(now, lastLog) > 5) {
     lastLog = now;
     LWARNING << "Maximum number of concurrent DNS queries reached (max: "
-             << MAX_FWD_QUERIES << ")";
+             << max << ")";
     if (skipCount > 0) {
       LWARNING << skipCount << " messages of the above kind have been skipped.";
     }
@@ -36,98 +41,146 @@ static void handleMaxFwdQueries(const std::time_t &now) {
   }
 }
 
-void PeerRequests::FreePeerRequestRecord(PeerRequests::PeerRequestRecord *r) {
-  PeerRequests::PeerRequestRecord::PeerSource *last;
-
-  // Essentially once source remains with record and others are added to
-  // PeerRequests::source for future use
-  for (last = r->source.next.get(); last && last->next; last = last->next.get())
-    ;
-  if (last) {
-    last->next = std::move(sources);
-    sources = std::move(r->source.next);
+// IDs are 16 bit so there can never be more queries in flight
+PeerRequests::PeerRequests(TimerWheel &timers, std::size_t capacity)
+    : timers(timers), records(std::clamp<std::size_t>(capacity, 1, 0xffff)),
+      sources(records.Capacity()), prefetches(0) {
+  for (std::size_t i = 0; i < records.Capacity(); i++) {
+    PeerRequestRecord &r = records[i];
+    r.source.next = nullptr;
+    r.sentTo = nullptr;
+    r.flags = 0;
+    r.attempts = 0;
+    r.staleServed = false;
+    r.overTcp = false;
+    r.prefetch = false;
+    r.used = false;
   }
 
-  r->source.next = nullptr;
-  r->sentTo = nullptr;
-  r->flags = 0;
+  // At most half full keeps probe sequences short
+  std::size_t size = 1;
+  while (size < 2 * records.Capacity()) {
+    size <<= 1;
+  }
+  for (Index *index : {&byId, &byKey}) {
+    index->slots.assign(size, EMPTY_SLOT);
+    index->mask = size - 1;
+  }
 }
 
-PeerRequests::PeerRequestRecord *
-PeerRequests::GetNewRecord(const std::time_t &now, bool force) {
-  PeerRequests::PeerRequestRecord *r, *oldest = nullptr, *target = nullptr;
-  int count = 0;
-
-  /* look for free records, garbage collect old records and count number in
-   * use by our server-group. */
-  for (r = records.get(); r; r = r->next.get()) {
-    if (!r->sentTo)
-      target = r;
-    else {
-      if (std::difftime(now, r->time) >= 4 * TIMEOUT) {
-        FreePeerRequestRecord(r);
-        r->fromTimedOut = true;
-        target = r;
-      } else if (!oldest || std::difftime(r->time, oldest->time) <= 0) {
-        oldest = r;
-      }
-    }
+std::size_t PeerRequests::idSlot(const Index &index, uint16_t id) {
+  return id & index.mask;
+}
 
-    if (r->sentTo && std::difftime(now, r->time) < TIMEOUT) {
-      count++;
-    }
+std::size_t PeerRequests::keySlot(const Index &index, const QueryKey &key) {
+  return key.Hash() & index.mask;
+}
+
+void PeerRequests::insert(Index &index, std::size_t slot, uint32_t pos) {
+  while (index.slots[slot] != EMPTY_SLOT) {
+    slot = (slot + 1) & index.mask;
   }
+  index.slots[slot] = pos;
+}
 
-  if (!force && count >= MAX_FWD_QUERIES) {
-    handleMaxFwdQueries(now);
-    return nullptr;
+template <typename Home>
+void PeerRequests::erase(Index &index, std::size_t slot, uint32_t pos,
+                         Home home) {
+  while (index.slots[slot] != pos) {
+    slot = (slot + 1) & index.mask;
   }
 
-  /* can't find empty one, use oldest if there is one and it's older than
-   * timeout */
-  if (!target && oldest && ((int)difftime(now, oldest->time)) >= TIMEOUT) {
-    FreePeerRequestRecord(oldest);
-    oldest->fromTimedOut = true;
-    target = oldest;
+  // Pull back every following entry of the run which may live in the hole,
+  // that is one whose home slot is not between the hole and itself.
+  std::size_t hole = slot;
+  for (slot = (slot + 1) & index.mask; index.slots[slot] != EMPTY_SLOT;
+       slot = (slot + 1) & index.mask) {
+    std::size_t from = home(index.slots[slot]);
+    if (((slot - from) & index.mask) >= ((slot - hole) & index.mask)) {
+      index.slots[hole] = index.slots[slot];
+      hole = slot;
+    }
   }
+  index.slots[hole] = EMPTY_SLOT;
+}
 
-  if (!target) {
-    target = new PeerRequestRecord;
-    target->fromTimedOut = false;
-    target->source.next = nullptr;
-    target->sentTo = nullptr;
-    target->next = std::move(records);
-    records = std::unique_ptr<PeerRequestRecord>(target);
+void PeerRequests::FreePeerRequestRecord(PeerRequests::PeerRequestRecord *r) {
+  // The first source stays with the record
+  while (PeerRequestRecord::PeerSource *s = r->source.next) {
+    r->source.next = s->next;
+    sources.Put(s);
   }
 
-  if (target) {
-    target->time = now;
+  r->sentTo = nullptr;
+  r->flags = 0;
+  r->attempts = 0;
+  r->staleServed = false;
+  r->overTcp = false;
+  r->expiry.Cancel();
+  r->retransmit.Cancel();
+  r->staleDeadline.Cancel();
+  if (r->prefetch) {
+    r->prefetch = false;
+    prefetches--;
   }
 
-  return target;
+  if (!r->used) {
+    return;
+  }
+
+  uint32_t pos = records.IndexOf(r);
+  erase(byId, idSlot(byId, r->newId), pos,
+        [this](uint32_t p) { return idSlot(byId, records[p].newId); });
+  erase(byKey, keySlot(byKey, r->key), pos,
+        [this](uint32_t p) { return keySlot(byKey, records[p].key); });
+  ids.Free(r->newId);
+  r->used = false;
+  records.Put(r);
 }
 
-void logQuery(uint16_t id, const unsigned char *hash) {
-  auto *t = hash;
-  std::stringstream ss;
-  for (int i = 0; i < HASH_SIZE; i++) {
-    ss << std::hex << (int)t[i] << " ";
+void PeerRequests::StartPrefetch(PeerRequests::PeerRequestRecord *r) {
+  r->prefetch = true;
+  prefetches++;
+}
+
+PeerRequests::PeerRequestRecord *
+PeerRequests::GetNewRecord(const std::time_t &now, const QueryKey &key,
+                           unsigned int flags) {
+  PeerRequestRecord *target = records.Get();
+  if (!target) {
+    handleMaxFwdQueries(now, records.Capacity());
+    return nullptr;
   }
-  LDEBUG << "Looking up for record: ID: " << id << ", Hash: " << ss.str()
-         << std::endl;
+
+  uint32_t pos = records.IndexOf(target);
+  target->used = true;
+  target->time = now;
+  target->newId = ids.Allocate();
+  target->flags = flags;
+  target->key = key;
+  insert(byId, idSlot(byId, target->newId), pos);
+  insert(byKey, keySlot(byKey, key), pos);
+  timers.Schedule(target->expiry, std::chrono::seconds(EXPIRY),
+                  [this, target]() {
+                    LDEBUG << "Dropping upstream query " << target->newId
+                           << " after " << EXPIRY << " seconds" << std::endl;
+                    if (onExpiry) {
+                      onExpiry(target);
+                    } else {
+                      FreePeerRequestRecord(target);
+                    }
+                  });
+
+  return target;
 }
 
 PeerRequests::PeerRequestRecord *PeerRequests::Lookup(uint16_t id,
-                                                      void *hash) const {
-  PeerRequestRecord *r;
-
-  if (hash) {
-    for (r = records.get(); r; r = r->next.get()) {
-      logQuery(r->newId, r->hash);
-      if (r->sentTo && r->newId == id &&
-          (memcmp(hash, r->hash, HASH_SIZE) == 0)) {
-        return r;
-      }
+                                                      const QueryKey &key) {
+  for (std::size_t slot = idSlot(byId, id); byId.slots[slot] != EMPTY_SLOT;
+       slot = (slot + 1) & byId.mask) {
+    PeerRequestRecord &r = records[byId.slots[slot]];
+    if (r.newId == id && r.key == key) {
+      return &r;
     }
   }
 
@@ -135,16 +188,20 @@ PeerRequests::PeerRequestRecord *PeerRequests::Lookup(uint16_t id,
 }
 
 PeerRequests::PeerRequestRecord *
-PeerRequests::LookupByQuery(void *hash, unsigned int flags,
-                            unsigned int flagmask) const {
-  PeerRequestRecord *f;
-  logQuery(0, (const unsigned char *)hash);
-
-  if (hash) {
-    for (f = records.get(); f; f = f->next.get())
-      if (f->sentTo && (f->flags & flagmask) == flags &&
-          std::memcmp(hash, f->hash, HASH_SIZE) == 0)
-        return f;
+PeerRequests::LookupByQuery(const QueryKey &key, unsigned int flags,
+                            unsigned int flagmask) {
+  if (key.Empty()) {
+    return nullptr;
+  }
+
+  // Same query with other flags is a separate upstream query, so a run may
+  // hold more than one record with this key.
+  for (std::size_t slot = keySlot(byKey, key); byKey.slots[slot] != EMPTY_SLOT;
+       slot = (slot + 1) & byKey.mask) {
+    PeerRequestRecord &r = records[byKey.slots[slot]];
+    if ((r.flags & flagmask) == flags && r.key == key) {
+      return &r;
+    }
   }
 
   return nullptr;
@@ -152,41 +209,12 @@ PeerRequests::LookupByQuery(void *hash, unsigned int flags,
 
 PeerRequests::PeerRequestRecord::PeerSource *
 PeerRequests::GetNewPeerSource(const std::time_t &now) {
-  PeerRequests::PeerRequestRecord::PeerSource *s = nullptr;
-  if (!sources && sourceCount < MAX_FWD_QUERIES) {
-    sources = std::make_unique<PeerRequests::PeerRequestRecord::PeerSource>();
-    sourceCount++;
-    sources->next = nullptr;
-  } else {
-    handleMaxFwdQueries(now);
-  }
-
-  if (sources) {
-    s = sources.get();
-    sources = std::move(sources->next);
-    s->next = nullptr;
+  PeerRequestRecord::PeerSource *s = sources.Get();
+  if (!s) {
+    handleMaxFwdQueries(now, records.Capacity());
+    return nullptr;
   }
 
+  s->next = nullptr;
   return s;
 }
-
-uint16_t PeerRequests::GetNewId() {
-  uint16_t ret = 0;
-
-  while (1) {
-    ret = distribute(rng);
-    bool found = false;
-    for (auto r = records.get(); r; r = r->next.get()) {
-      if (r->sentTo && r->newId == ret) {
-        found = true;
-        break;
-      }
-    }
-
-    if (!found) {
-      break;
-    }
-  }
-
-  return ret;
-}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "bookkeeping/selector.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+#define RTT_GAIN 8            /* weight of a new sample is 1/RTT_GAIN */
+#define DOWN_AFTER_US 1000000 /* minimum silence before a server is down */
+#define INITIAL_RTO_US 1000000 /* until the server is measured */
+#define MIN_RTO_US 50000
+#define MAX_RTO_US 4000000
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+
+UpstreamSelector::UpstreamSelector(UpstreamStrategy strategy,
+                                   unsigned int explorePercent)
+    : strategy(strategy), explorePercent(explorePercent), next(0) {
+  std::random_device seed;
+  rng.seed(seed());
+}
+
+void UpstreamSelector::OnForward(UpstreamServerInfo *server,
+                                 const Clock::time_point &now) {
+  if (server->unansweredSince == Clock::time_point{}) {
+    server->unansweredSince = now;
+  }
+}
+
+void UpstreamSelector::OnReply(UpstreamServerInfo *server,
+                               const Clock::time_point &sent,
+                               const Clock::time_point &now) {
+  server->unansweredSince = Clock::time_point{};
+
+  int64_t sample = std::max<int64_t>(
+      duration_cast<microseconds>(now - sent).count(), 1);
+  if (server->stats.rtt == 0) {
+    server->stats.rtt = sample;
+    server->stats.rttvar = sample / 2;
+  } else {
+    int64_t rtt = server->stats.rtt;
+    int64_t rttvar = server->stats.rttvar;
+    server->stats.rttvar = rttvar + (std::abs(rtt - sample) - rttvar) / 4;
+    server->stats.rtt = std::max<int64_t>(rtt + (sample - rtt) / RTT_GAIN, 1);
+  }
+}
+
+std::chrono::microseconds
+UpstreamSelector::Rto(const UpstreamServerInfo *server, unsigned int attempt) {
+  uint64_t rto = server->stats.rtt == 0
+                     ? INITIAL_RTO_US
+                     : server->stats.rtt + 4 * server->stats.rttvar;
+  rto = std::clamp<uint64_t>(rto, MIN_RTO_US, MAX_RTO_US);
+  rto <<= std::min(attempt, 8u);
+  return microseconds(std::min<uint64_t>(rto, MAX_RTO_US));
+}
+
+void UpstreamSelector::OnLateReply(UpstreamServerInfo *server) {
+  server->unansweredSince = Clock::time_point{};
+}
+
+uint64_t UpstreamSelector::Score(const UpstreamServerInfo *server,
+                                 const Clock::time_point &now) {
+  if (server->unansweredSince == Clock::time_point{}) {
+    return server->stats.rtt;
+  }
+
+  // A query waiting longer than the usual round trip means the server is at
+  // least that slow right now.
+  uint64_t silence =
+      duration_cast<microseconds>(now - server->unansweredSince).count();
+  return std::max(server->stats.rtt, silence);
+}
+
+static bool isDown(const UpstreamServerInfo *server, uint64_t score) {
+  return score > std::max<uint64_t>(DOWN_AFTER_US, 4 * server->stats.rtt);
+}
+
+UpstreamServerInfo *UpstreamSelector::Select(const Clock::time_point &now) {
+  if (servers.empty()) {
+    return nullptr;
+  }
+  if (servers.size() == 1) {
+    return servers[0];
+  }
+
+  switch (strategy) {
+  case UpstreamStrategy::WeightedRandom:
+    return weightedRandom(now);
+  case UpstreamStrategy::RoundRobin:
+    return roundRobin(now);
+  default:
+    break;
+  }
+
+  return fastest(now);
+}
+
+UpstreamServerInfo *UpstreamSelector::Explore(UpstreamServerInfo *selected) {
+  if (servers.size() < 2 || explorePercent == 0 ||
+      std::uniform_int_distribution<unsigned int>(1, 100)(rng) >
+          explorePercent) {
+    return nullptr;
+  }
+
+  // Any server but the selected one
+  std::size_t i =
+      std::uniform_int_distribution<std::size_t>(0, servers.size() - 2)(rng);
+  return servers[i] == selected ? servers.back() : servers[i];
+}
+
+UpstreamServerInfo *
+UpstreamSelector::Failover(UpstreamServerInfo *failed,
+                           const Clock::time_point &now) const {
+  UpstreamServerInfo *server = fastest(now, failed);
+  return server ? server : failed;
+}
+
+UpstreamServerInfo *
+UpstreamSelector::fastest(const Clock::time_point &now,
+                          const UpstreamServerInfo *skip) const {
+  UpstreamServerInfo *best = nullptr;
+  uint64_t bestScore = 0;
+
+  for (auto server : servers) {
+    if (server == skip) {
+      continue;
+    }
+    uint64_t score = Score(server, now);
+    if (!best || score < bestScore) {
+      best = server;
+      bestScore = score;
+    }
+  }
+
+  return best;
+}
+
+UpstreamServerInfo *
+UpstreamSelector::weightedRandom(const Clock::time_point &now) {
+  // Chance of a server is inversely proportional to its score. Servers not
+  // measured yet get the weight of a very fast one.
+  weights.resize(servers.size());
+  double total = 0;
+  for (std::size_t i = 0; i < servers.size(); i++) {
+    weights[i] = 1.0 / std::max<uint64_t>(Score(servers[i], now), 1);
+    total += weights[i];
+  }
+
+  double pick = std::uniform_real_distribution<double>(0, total)(rng);
+  for (std::size_t i = 0; i < servers.size(); i++) {
+    if (pick < weights[i]) {
+      return servers[i];
+    }
+    pick -= weights[i];
+  }
+
+  return servers.back();
+}
+
+UpstreamServerInfo *UpstreamSelector::roundRobin(const Clock::time_point &now) {
+  // Skip servers which went silent unless all of them did
+  for (std::size_t n = 0; n < servers.size(); n++) {
+    UpstreamServerInfo *server = servers[next];
+    next = (next + 1) % servers.size();
+    if (!isDown(server, Score(server, now))) {
+      return server;
+    }
+  }
+
+  return servers[next];
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "bookkeeping/timerwheel.hpp"
+#include <algorithm>
+
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_SPAN (uint64_t(1) << (WHEEL_LEVELS * WHEEL_SLOT_BITS))
+
+void TimerWheel::Timer::Cancel() {
+  if (!wheel) {
+    return;
+  }
+
+  TimerWheel::unlink(*this);
+  wheel->armed--;
+  wheel = nullptr;
+  callback = nullptr;
+}
+
+TimerWheel::TimerWheel(boost::asio::io_context &io_context,
+                       Clock::duration resolution)
+    : origin(Clock::now()), resolution(resolution), current(0), armed(0),
+      ticker(io_context), ticking(false), wakeTick(0) {
+  for (auto &level : slots) {
+    for (auto &slot : level) {
+      slot.prev = slot.next = &slot;
+    }
+  }
+}
+
+TimerWheel::~TimerWheel() {
+  for (auto &level : slots) {
+    for (auto &slot : level) {
+      while (slot.next != &slot) {
+        static_cast<Timer *>(slot.next)->Cancel();
+      }
+    }
+  }
+}
+
+void TimerWheel::link(Node &list, Node &node) {
+  node.prev = list.prev;
+  node.next = &list;
+  list.prev->next = &node;
+  list.prev = &node;
+}
+
+void TimerWheel::unlink(Node &node) {
+  node.prev->next = node.next;
+  node.next->prev = node.prev;
+  node.prev = node.next = nullptr;
+}
+
+void TimerWheel::Schedule(Timer &timer, Clock::time_point expiry,
+                          std::function<void()> callback) {
+  timer.Cancel();
+
+  // Rounded up so that no timer fires early
+  uint64_t tick = 0;
+  if (expiry > origin) {
+    tick = (expiry - origin + resolution - Clock::duration(1)) / resolution;
+  }
+  timer.tick = std::max(tick, current);
+  timer.callback = std::move(callback);
+  timer.wheel = this;
+  armed++;
+  insert(timer);
+
+  if (!ticking || timer.tick < wakeTick) {
+    wake(timer.tick);
+  }
+}
+
+void TimerWheel::insert(Timer &timer) {
+  if (timer.tick - current >= WHEEL_SPAN) {
+    timer.tick = current + WHEEL_SPAN - 1;
+  }
+
+  uint64_t delta = timer.tick - current;
+  unsigned int level = 0;
+  while (level + 1 < WHEEL_LEVELS &&
+         delta >= uint64_t(1) << ((level + 1) * WHEEL_SLOT_BITS)) {
+    level++;
+  }
+
+  link(slots[level][(timer.tick >> (level * WHEEL_SLOT_BITS)) & SLOT_MASK],
+       timer);
+}
+
+void TimerWheel::cascade(unsigned int level, std::size_t index) {
+  Node &slot = slots[level][index];
+  Node moving{slot.prev, slot.next};
+  if (slot.next == &slot) {
+    return;
+  }
+
+  moving.next->prev = moving.prev->next = &moving;
+  slot.prev = slot.next = &slot;
+  while (moving.next != &moving) {
+    Timer *timer = static_cast<Timer *>(moving.next);
+    unlink(*timer);
+    insert(*timer);
+  }
+}
+
+void TimerWheel::Advance(Clock::time_point now) {
+  if (now < origin) {
+    return;
+  }
+
+  uint64_t target = (now - origin) / resolution;
+  while (armed > 0 && current <= target) {
+    std::size_t index = current & SLOT_MASK;
+    // A ring came round, bring the next slot of the level above down
+    for (unsigned int level = 1; level < WHEEL_LEVELS && index == 0; level++) {
+      index = (current >> (level * WHEEL_SLOT_BITS)) & SLOT_MASK;
+      cascade(level, index);
+    }
+
+    Node &slot = slots[0][current & SLOT_MASK];
+    current++;
+    // Timers armed by the callbacks below go to the next tick at the earliest
+    while (slot.next != &slot) {
+      Timer *timer = static_cast<Timer *>(slot.next);
+      std::function<void()> callback = std::move(timer->callback);
+      timer->Cancel();
+      callback();
+    }
+  }
+
+  // Nothing can be due in between
+  if (armed == 0) {
+    current = std::max(current, target + 1);
+  }
+}
+
+uint64_t TimerWheel::nextWake() const {
+  // Next busy slot of this ring, or the end of the ring where the level
+  // above has to be looked at again
+  uint64_t end = (current | SLOT_MASK) + 1;
+  for (uint64_t tick = current; tick < end; tick++) {
+    const Node &slot = slots[0][tick & SLOT_MASK];
+    if (slot.next != &slot) {
+      return tick;
+    }
+  }
+
+  return end;
+}
+
+void TimerWheel::wake(uint64_t tick) {
+  ticking = true;
+  wakeTick = tick;
+  ticker.expires_at(origin + tick * resolution);
+  ticker.async_wait([this](boost::system::error_code ec) {
+    if (ec) { // Also when rearmed for an earlier tick
+      return;
+    }
+
+    ticking = false;
+    Advance(Clock::now());
+    if (armed > 0) {
+      wake(nextWake());
+    }
+  });
+}
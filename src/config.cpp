@@ -6,13 +6,16 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
  */
 
+#include <algorithm>
 #include <boost/property_tree/ini_parser.hpp>
 #include <cstdint>
 #include <iostream>
 #include <string>
+#include <thread>
 
 #include "common.h"
 #include "config.hpp"
+#include "net/netcommon.h"
 #include "util.hpp"
 
 namespace pt = boost::property_tree;
@@ -33,10 +36,12 @@ bool IniConfigReader::getBoolValue(const std::string &key,
 }
 
 void ConfigReader::addServer(const std::string &host, uint16_t port,
-                             const std::string &protocol) {
-  if (protocol != "udp" && protocol != "tcp") {
-    std::cerr << "Expected value for protocol is udp or tcp, provided value: "
-              << protocol << std::endl;
+                             const std::string &protocol,
+                             const std::string &tlsName) {
+  if (protocol != "udp" && protocol != "tcp" && protocol != "tls") {
+    std::cerr
+        << "Expected value for protocol is udp, tcp or tls, provided value: "
+        << protocol << std::endl;
     throw std::invalid_argument("Invalid protocol value");
   }
 
@@ -49,8 +54,28 @@ void ConfigReader::addServer(const std::string &host, uint16_t port,
 
   std::cout << "Upstream server identified as: " << protocol << "://" << host
             << ":" << port << std::endl;
-  servers.push_back(
-      {host, port, protocol == "udp" ? Protocol::Udp : Protocol::Tcp, ipv});
+  servers.push_back({host, port,
+                     protocol == "udp"   ? Protocol::Udp
+                     : protocol == "tcp" ? Protocol::Tcp
+                                         : Protocol::Tls,
+                     ipv, tlsName});
+}
+
+static UpstreamStrategy toUpstreamStrategy(const std::string &value) {
+  if (value == "fastest") {
+    return UpstreamStrategy::Fastest;
+  } else if (value == "random") {
+    return UpstreamStrategy::WeightedRandom;
+  } else if (value == "roundrobin") {
+    return UpstreamStrategy::RoundRobin;
+  } else if (value == "all") {
+    return UpstreamStrategy::All;
+  }
+
+  std::cerr << "Expected value for upstreamStrategy is fastest, random, "
+               "roundrobin or all, provided value: "
+            << value << std::endl;
+  throw std::invalid_argument("Invalid upstreamStrategy value");
 }
 
 void ConfigReader::LoadConfiguration() {
@@ -59,6 +84,78 @@ void ConfigReader::LoadConfiguration() {
   logLevel = Log::ToLogLevel(
       getStringValue("logLevel", Log::FromLogLevel(LogLevel::info)));
   dnsPort = (uint16_t)getLongValue("dnsPort", DNS_PORT);
+  // 0 disables the TCP listener
+  tcpPort = (uint16_t)getLongValue("tcpPort", dnsPort);
+  // Open TCP connections per worker, further ones are closed right away
+  tcpConnections =
+      (unsigned int)std::max(getLongValue("tcpConnections", 1024), 1L);
+  // Milliseconds a TCP connection is kept without traffic
+  tcpIdleTimeout =
+      (unsigned int)std::max(getLongValue("tcpIdleTimeout", 10000), 1L);
+
+  // 0 means one worker per available core
+  long w = getLongValue("workers", 1);
+  if (w < 0) {
+    std::cerr << "Expected value for workers is 0 or more, provided value: "
+              << w << std::endl;
+    throw std::invalid_argument("Invalid workers value");
+  }
+  workers = w == 0 ? std::max(1u, std::thread::hardware_concurrency())
+                   : (unsigned int)w;
+
+  // 1 disables batched receive/send
+  batchSize = (unsigned int)std::clamp(getLongValue("batchSize", 1), 1L,
+                                       (long)MAX_UDP_BATCH);
+  statsInterval =
+      (unsigned int)std::max(getLongValue("statsInterval", 300), 0L);
+
+  // Per worker memory budget in KiB, 0 disables the cache
+  cacheSize =
+      (std::size_t)std::max(getLongValue("cacheSize", 4096), 0L) * 1024;
+  cacheMaxTtl = (uint32_t)std::max(getLongValue("cacheMaxTtl", 86400), 0L);
+  negativeCacheSize =
+      (std::size_t)std::max(getLongValue("negativeCacheSize", 1024), 0L) *
+      1024;
+  // RFC 2308 section 5 suggests one to three hours
+  negativeCacheMaxTtl =
+      (uint32_t)std::max(getLongValue("negativeCacheMaxTtl", 10800), 0L);
+  // Serve-stale (RFC 8767), 0 disables it
+  staleWindow = (uint32_t)std::max(getLongValue("staleWindow", 0), 0L);
+  // Milliseconds to wait for upstream before answering with stale data
+  staleDeadline =
+      (unsigned int)std::max(getLongValue("staleDeadline", 1800), 0L);
+  // Refresh entries hit prefetchHits times once they are in the last
+  // prefetchPercent of their TTL, 0 hits disables prefetch
+  prefetchHits = (uint32_t)std::max(getLongValue("prefetchHits", 0), 0L);
+  prefetchPercent =
+      (uint32_t)std::clamp(getLongValue("prefetchPercent", 10), 0L, 100L);
+  prefetchConcurrency =
+      (unsigned int)std::max(getLongValue("prefetchConcurrency", 10), 0L);
+  upstreamStrategy =
+      toUpstreamStrategy(getStringValue("upstreamStrategy", "fastest"));
+  // Share of queries sent to a server other than the preferred one
+  upstreamExplore =
+      (unsigned int)std::clamp(getLongValue("upstreamExplore", 5), 0L, 100L);
+  // Sends of a query, retransmissions to the next server included
+  upstreamAttempts =
+      (unsigned int)std::clamp(getLongValue("upstreamAttempts", 3), 1L, 10L);
+  // UDP payload size advertised upstream in place of the client's. Replies
+  // have to fit the receive buffers.
+  upstreamEdnsSize = (uint16_t)std::clamp(
+      getLongValue("upstreamEdnsSize", EDNS_PKTSZ), (long)PACKETSZ,
+      (long)(MAX_PACKET_SZ));
+  // Connections per upstream server and worker, opened when needed
+  upstreamTcpConnections = (unsigned int)std::clamp(
+      getLongValue("upstreamTcpConnections", 2), 1L, 16L);
+  // Milliseconds connecting to one, TLS handshake included, may take
+  upstreamConnectTimeout = (unsigned int)std::max(
+      getLongValue("upstreamConnectTimeout", 2000), 1L);
+  // Certificates of TLS servers are checked against these, the system ones
+  // if empty
+  tlsCaFile = getStringValue("tlsCaFile", "");
+  // In-flight upstream queries per worker, bounded by the 16 bit query ID
+  maxQueries =
+      (unsigned int)std::clamp(getLongValue("maxQueries", 150), 1L, 65535L);
 #ifdef __unix__
   pidFile = getStringValue("pidFile", PID_FILE);
 #endif /* __unix__ */
@@ -66,22 +163,25 @@ void ConfigReader::LoadConfiguration() {
   ruleFile = getStringValue("ruleFile", RULES_FILE);
 
   std::string host = getStringValue("serverIp1", SERVER_IP_1);
-  uint16_t port = (uint16_t)getLongValue("serverPort1", DNS_PORT);
   std::string protocol = getStringValue("protocol1", "udp");
-  addServer(host, port, protocol);
+  uint16_t port = (uint16_t)getLongValue(
+      "serverPort1", protocol == "tls" ? DOT_PORT : DNS_PORT);
+  addServer(host, port, protocol, getStringValue("tlsName1", ""));
 
   host = getStringValue("serverIp2", "");
   if (!host.empty()) {
-    port = (uint16_t)getLongValue("serverPort2", DNS_PORT);
     protocol = getStringValue("protocol2", "udp");
-    addServer(host, port, protocol);
+    port = (uint16_t)getLongValue("serverPort2",
+                                  protocol == "tls" ? DOT_PORT : DNS_PORT);
+    addServer(host, port, protocol, getStringValue("tlsName2", ""));
   }
 
   host = getStringValue("serverIp3", "");
   if (!host.empty()) {
-    port = (uint16_t)getLongValue("serverPort3", DNS_PORT);
     protocol = getStringValue("protocol3", "udp");
-    addServer(host, port, protocol);
+    port = (uint16_t)getLongValue("serverPort3",
+                                  protocol == "tls" ? DOT_PORT : DNS_PORT);
+    addServer(host, port, protocol, getStringValue("tlsName3", ""));
   }
 }
 
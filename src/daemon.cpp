@@ -82,10 +82,56 @@ void Daemon::Initialize() {
   platformInit();
 }
 
+void Daemon::startWorkers() {
+  for (std::size_t i = 0; i < workerContexts.size(); i++) {
+    boost::asio::io_context *context = workerContexts[i].get();
+    workerThreads.emplace_back([context, i]() {
+      LTRACE << "Worker " << i + 1 << " started" << std::endl;
+      try {
+        context->run();
+      } catch (std::exception &e) {
+        LERROR << "Exception in worker " << i + 1 << ": " << e.what()
+               << std::endl;
+      }
+      LTRACE << "Worker " << i + 1 << " stopped" << std::endl;
+    });
+  }
+}
+
+void Daemon::stopWorkers() {
+  for (auto &context : workerContexts) {
+    context->stop();
+  }
+
+  for (auto &thread : workerThreads) {
+    thread.join();
+  }
+
+  workerThreads.clear();
+}
+
 int Daemon::Start() {
   try {
-    DnsServer dnsServer(ioContext, configReader->dnsPort, configReader.get(),
-                        &ruleEngine);
+    unsigned int workers = configReader->workers;
+#ifndef __linux
+    if (workers > 1) {
+      LWARNING << "Multiple workers are only supported on Linux. Using one."
+               << std::endl;
+      workers = 1;
+    }
+#endif /* __linux */
+
+    // Each worker owns its own io_context, sockets and bookkeeping so no
+    // state is shared between workers on the hot path.
+    std::vector<std::unique_ptr<DnsServer>> dnsServers;
+    dnsServers.push_back(std::make_unique<DnsServer>(
+        ioContext, configReader->dnsPort, configReader.get(), &ruleEngine));
+    for (unsigned int i = 1; i < workers; i++) {
+      workerContexts.push_back(std::make_unique<boost::asio::io_context>(1));
+      dnsServers.push_back(std::make_unique<DnsServer>(
+          *workerContexts.back(), configReader->dnsPort, configReader.get(),
+          &ruleEngine));
+    }
 
     boost::asio::signal_set signals(ioContext, SIGINT, SIGTERM);
     signals.async_wait([&](boost::system::error_code ec, int signo) {
@@ -93,11 +139,27 @@ int Daemon::Start() {
       this->signalHandler(ec, signo);
     });
     ioContext.notify_fork(boost::asio::io_context::fork_prepare);
+    for (auto &context : workerContexts) {
+      context->notify_fork(boost::asio::io_context::fork_prepare);
+    }
     forkAndSetupDaemon();
     ioContext.notify_fork(boost::asio::io_context::fork_child);
+    for (auto &context : workerContexts) {
+      context->notify_fork(boost::asio::io_context::fork_child);
+    }
 
-    LTRACE << "Daemon started on port: " << configReader->dnsPort << std::endl;
-    ioContext.run();
+    // Threads do not survive fork so workers are started afterwards.
+    startWorkers();
+
+    LTRACE << "Daemon started on port: " << configReader->dnsPort
+           << " with workers: " << workers << std::endl;
+    try {
+      ioContext.run();
+    } catch (...) {
+      stopWorkers();
+      throw;
+    }
+    stopWorkers();
     LTRACE << "Daemon stopped on port: " << configReader->dnsPort << std::endl;
 
     return EC_GOOD;
@@ -117,4 +179,9 @@ int Daemon::Start() {
   }
 }
 
-void Daemon::Stop() { ioContext.stop(); }
+void Daemon::Stop() {
+  ioContext.stop();
+  for (auto &context : workerContexts) {
+    context->stop();
+  }
+}
@@ -10,8 +10,6 @@
 #include "dns/dnscommon.hpp"
 #include "log.hpp"
 
-#define HEADER_SIZE 12
-
 int DnsHeader::Read(BytePacketBuffer *bpb) {
   if (!PACKET_SZ_VALID(bpb, HEADER_SIZE)) {
     LERROR_X << "Header size is invalid (" << (bpb->pos + HEADER_SIZE) << " > "
@@ -30,6 +28,24 @@ int DnsHeader::Read(BytePacketBuffer *bpb) {
   return E_NOERROR;
 }
 
+int DnsHeader::Read(std::span<const uint8_t> packet) {
+  if (packet.size() < HEADER_SIZE) {
+    LERROR_X << "Header size is invalid (" << HEADER_SIZE << " > "
+             << packet.size() << ")" << std::endl;
+    return E_FORMERR;
+  }
+
+  ID = uint16_t(packet[0]) << 8 | packet[1];
+  hb3 = packet[2];
+  hb4 = packet[3];
+  QuestionCount = uint16_t(packet[4]) << 8 | packet[5];
+  AnswerCount = uint16_t(packet[6]) << 8 | packet[7];
+  AuthorityCount = uint16_t(packet[8]) << 8 | packet[9];
+  AdditionalCount = uint16_t(packet[10]) << 8 | packet[11];
+
+  return E_NOERROR;
+}
+
 int DnsHeader::Validate(PacketType pt) const {
   if (pt == PacketType::IncomingRequest) {
     if (GetQueryResponse()) {
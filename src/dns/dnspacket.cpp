@@ -9,16 +9,15 @@
 #include "dns/dnspacket.hpp"
 #include "dns/dnscommon.hpp"
 #include "log.hpp"
-#include "tp/sha256.hpp"
+#include <algorithm>
 #include <cstdint>
-#include <memory>
 
 #define _READ_RECORD(what, class, field, typer)                                \
-  if (header && header->what##Count > 0) {                                     \
-    field = std::make_unique<Dns##class[]>(header->what##Count);               \
-    for (int i = 0; i < header->what##Count; i++) {                            \
+  if (header.what##Count > 0) {                                                \
+    field = arena.New<Dns##class>(header.what##Count);                         \
+    for (int i = 0; i < header.what##Count; i++) {                             \
       typer;                                                                   \
-      code = field[i].Read(bpb);                                               \
+      code = field[i].Read(bpb, arena);                                        \
       if (code != E_NOERROR) {                                                 \
         return code;                                                           \
       }                                                                        \
@@ -31,13 +30,20 @@
 #define READ_QUESTION(what, field) _READ_RECORD(what, what, field, ;)
 
 int DnsPacket::Read(BytePacketBuffer *bpb) {
-  header = std::make_unique_for_overwrite<DnsHeader>();
-  int code = header->Read(bpb);
+  int code = header.Read(bpb);
   if (code != E_NOERROR) {
     return code;
   }
 
   READ_QUESTION(Question, questions)
+  if (header.QuestionCount == 1) {
+    code = key.Read(*bpb, questions[0].Start);
+    if (code != E_NOERROR) {
+      return code;
+    }
+  } else {
+    key.Clear();
+  }
   READ_RECORD(Answer, answers)
   READ_RECORD(Authority, authorities)
   READ_RECORD(Additional, additionals)
@@ -50,7 +56,7 @@ int DnsPacket::Read(BytePacketBuffer *bpb) {
 }
 
 #define VALIDATE_RECORD(what, field)                                           \
-  for (int i = 0; i < header->what##Count; i++) {                              \
+  for (int i = 0; i < header.what##Count; i++) {                               \
     code = field[i].Validate(pt);                                              \
     if (code != E_NOERROR) {                                                   \
       return code;                                                             \
@@ -58,13 +64,9 @@ int DnsPacket::Read(BytePacketBuffer *bpb) {
   }
 
 int DnsPacket::Validate(PacketType pt) const {
-  int code = E_NOERROR;
-  if (header) {
-    if (!(code = header->Validate(pt))) {
-      return code;
-    };
-  } else {
-    return E_FORMERR;
+  int code = header.Validate(pt);
+  if (code != E_NOERROR) {
+    return code;
   }
 
   if (pt == PacketType::IncomingRequest || pt == IncomingResponse) {
@@ -75,7 +77,7 @@ int DnsPacket::Validate(PacketType pt) const {
   }
 
   int psuedoHeaderCount = 0;
-  for (int i = 0; i < header->AdditionalCount; i++) {
+  for (int i = 0; i < header.AdditionalCount; i++) {
     psuedoHeaderCount += (additionals[i].Type == QT_OPT);
   }
 
@@ -89,16 +91,13 @@ int DnsPacket::Validate(PacketType pt) const {
 }
 
 #define WRITE_RECORD(what, field)                                              \
-  if (header && header->what##Count > 0) {                                     \
-    for (int i = 0; i < header->what##Count; i++) {                            \
-      field[i].Write(bpb);                                                     \
-    }                                                                          \
+  for (int i = 0; i < header.what##Count; i++) {                               \
+    field[i].Write(bpb, names);                                                \
   }
 
 int DnsPacket::Write(BytePacketBuffer *bpb) const {
-  if (header) {
-    header->Write(bpb);
-  }
+  CompressionTable names;
+  header.Write(bpb);
 
   WRITE_RECORD(Question, questions)
   WRITE_RECORD(Answer, answers)
@@ -108,25 +107,43 @@ int DnsPacket::Write(BytePacketBuffer *bpb) const {
   return E_NOERROR;
 }
 
-int DnsPacket::Hash(uint8_t *digest) const {
-  SHA256_CTX ctx;
+#define COLLECT_TTL(what, field)                                               \
+  for (int i = 0; i < header.what##Count; i++) {                               \
+    if (field[i].Type != QT_OPT) {                                             \
+      minTtl = std::min(minTtl, field[i].TTL);                                 \
+      if (ttlOffsets) {                                                        \
+        ttlOffsets->push_back(field[i].TtlStart);                              \
+      }                                                                        \
+    }                                                                          \
+  }
 
-  sha256_init(&ctx);
+uint32_t DnsPacket::GetMinTtl(std::vector<uint16_t> *ttlOffsets) const {
+  uint32_t minTtl = UINT32_MAX;
 
-  for (int i = 0; i < header->QuestionCount; i++) {
-    auto question = questions[i];
-    question.UpdateDigest(&ctx);
-  }
+  COLLECT_TTL(Answer, answers)
+  COLLECT_TTL(Authority, authorities)
+  COLLECT_TTL(Additional, additionals)
+
+  return minTtl == UINT32_MAX ? 0 : minTtl;
+}
 
-  sha256_final(&ctx, (_BYTE *)digest);
+uint32_t DnsPacket::GetNegativeTtl(std::vector<uint16_t> *ttlOffsets) const {
+  // RFC 2308 section 5: the lesser of the SOA TTL and its MINIMUM field. A
+  // reply without SOA must not be cached.
+  for (int i = 0; i < header.AuthorityCount; i++) {
+    if (authorities[i].Type == QT_SOA) {
+      GetMinTtl(ttlOffsets);
+      return std::min(authorities[i].TTL, authorities[i].GetSoaMinimum());
+    }
+  }
 
   return 0;
 }
 
 #define OUTPUT_RECORD(what, field)                                             \
-  if (dp.header && dp.header->what##Count > 0) {                               \
-    stream << #what "s: " << dp.header->what##Count << endl;                   \
-    for (int i = 0; i < dp.header->what##Count; i++) {                         \
+  if (dp.header.what##Count > 0) {                                             \
+    stream << #what "s: " << dp.header.what##Count << endl;                    \
+    for (int i = 0; i < dp.header.what##Count; i++) {                          \
       stream << #what " #" << i + 1 << ": ";                                   \
       stream << dp.field[i];                                                   \
     }                                                                          \
@@ -137,9 +154,7 @@ int DnsPacket::Hash(uint8_t *digest) const {
 std::ostream &operator<<(std::ostream &stream, const DnsPacket &dp) {
   using namespace std;
 
-  if (dp.header) {
-    stream << *dp.header;
-  }
+  stream << dp.header;
 
   OUTPUT_RECORD(Question, questions)
   OUTPUT_RECORD(Answer, answers)
@@ -149,45 +164,47 @@ std::ostream &operator<<(std::ostream &stream, const DnsPacket &dp) {
   return stream;
 }
 
-void DnsPacket::SetAsQueryRequest() { header->SetQueryResponse(false); }
+void DnsPacket::SetAsQueryRequest() { header.SetQueryResponse(false); }
 
-void DnsPacket::SetAsQueryResponse() { header->SetQueryResponse(true); }
+void DnsPacket::SetAsQueryResponse() { header.SetQueryResponse(true); }
 
-void DnsPacket::SetId(const uint16_t &id) { header->ID = id; }
+void DnsPacket::SetId(const uint16_t &id) { header.ID = id; }
 
 void DnsPacket::SetAsAuthoritativeAnswer(const bool &value) {
-  header->SetAuthoritativeAnswer(value);
+  header.SetAuthoritativeAnswer(value);
 }
 
 void DnsPacket::SetRecursionAvailable(const bool &value) {
-  header->SetRecursionAvailable(value);
+  header.SetRecursionAvailable(value);
 }
 
 void DnsPacket::SetCheckingDisabled(const bool &value) {
-  header->SetCheckingDisabled(value);
+  header.SetCheckingDisabled(value);
 }
 
 void DnsPacket::SetResponseCode(const uint8_t &responseCode) {
-  header->SetResponseCode(responseCode);
+  header.SetResponseCode(responseCode);
 }
 
 void DnsPacket::SetAnswers(
-    std::function<void(DnsQuestion *, DnsRecord *)> writeAnswer) {
-  if (header->QuestionCount == 0 || !questions) {
+    std::function<void(const DnsQuestion *, DnsRecord *, Arena &)>
+        writeAnswer) {
+  if (header.QuestionCount == 0 || !questions) {
     return;
   }
 
-  answers = std::make_unique<DnsRecord[]>(header->QuestionCount);
-  for (int i = 0; i < header->QuestionCount; i++) {
-    writeAnswer(&questions[i], &answers[i]);
+  answers = arena.New<DnsRecord>(header.QuestionCount);
+  for (int i = 0; i < header.QuestionCount; i++) {
+    answers[i].RecordType = DnsRecord::Answer;
+    writeAnswer(&questions[i], &answers[i], arena);
   }
 
-  header->AnswerCount = header->QuestionCount;
+  header.AnswerCount = header.QuestionCount;
 }
 
 #define _OPT_PROCESSOR(match, nomatch)                                         \
-  for (int i = 0; i < header->AdditionalCount; i++) {                          \
-    auto additional = additionals[i];                                          \
+  for (int i = 0; i < header.AdditionalCount; i++) {                           \
+    auto &additional = additionals[i];                                         \
     if (additional.Type == QT_OPT) {                                           \
       match                                                                    \
     }                                                                          \
@@ -201,13 +218,18 @@ void DnsPacket::SetAnswers(
 
 bool DnsPacket::HasPsuedoHeader() const { OPT_GET(true, false); }
 
+uint16_t DnsPacket::GetPsuedoHeaderLengthOffset() const {
+  // RDLENGTH follows the TTL field
+  OPT_GET(additional.TtlStart + 4, 0);
+}
+
 uint16_t DnsPacket::GetUdpPayloadSize() const {
-  OPT_GET(additional.UdpSize, 0);
+  OPT_GET(additional.GetUdpSize(), 0);
 }
 
 uint16_t DnsPacket::GetExtendedResponseCode() const {
-  OPT_GET(header->GetResponseCode() | (additional.GetExtendedRcode() << 4),
-          header->GetResponseCode());
+  OPT_GET(header.GetResponseCode() | (additional.GetExtendedRcode() << 4),
+          header.GetResponseCode());
 }
 
 bool DnsPacket::HasDoBit() const { OPT_GET(additional.GetDoBit(), false); }
@@ -215,5 +237,5 @@ bool DnsPacket::HasDoBit() const { OPT_GET(additional.GetDoBit(), false); }
 bool DnsPacket::HasAdBit() const { OPT_GET(additional.GetAdBit(), false); }
 
 void DnsPacket::SetUdpPayloadSize(const uint16_t &size) {
-  OPT_SET(additional.UdpSize = size);
+  OPT_SET(additional.SetUdpSize(size));
 }
@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "dns/dnspacketview.hpp"
+#include "dns/dnscommon.hpp"
+#include "dns/dnsquestion.hpp"
+#include "dns/rrtypes.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <cstring>
+
+static uint16_t readU16(const uint8_t *buf, std::size_t pos) {
+  return uint16_t(buf[pos]) << 8 | buf[pos + 1];
+}
+
+static uint32_t readU32(const uint8_t *buf, std::size_t pos) {
+  return uint32_t(readU16(buf, pos)) << 16 | readU16(buf, pos + 2);
+}
+
+// Moves pos past the name at pos. Compression pointers are checked but not
+// followed, labels is where the labels stored in place end.
+static int skipName(std::span<const uint8_t> packet, std::size_t &pos,
+                    std::size_t &labels) {
+  while (true) {
+    if (pos >= packet.size()) {
+      return E_FORMERR;
+    }
+
+    uint8_t c = packet[pos];
+    if ((c & 0xc0) == 0xc0) {
+      if (pos + 2 > packet.size() ||
+          (std::size_t(c & 0x3f) << 8 | packet[pos + 1]) >= packet.size()) {
+        LERROR_X << "Illegal label offset" << std::endl;
+        return E_FORMERR;
+      }
+      labels = pos;
+      pos += 2;
+      return E_NOERROR;
+    } else if (c & 0xc0) {
+      return E_NOTIMP;
+    }
+
+    pos += 1 + c;
+    if (c == 0) {
+      labels = pos;
+      return pos <= packet.size() ? E_NOERROR : E_FORMERR;
+    }
+  }
+}
+
+int DnsPacketView::Read() {
+  int code = header.Read(packet());
+  if (code != E_NOERROR) {
+    return code;
+  }
+
+  std::size_t pos = HEADER_SIZE;
+  std::size_t labels = pos;
+  nameStart = nameEnd = pos;
+  for (int i = 0; i < header.QuestionCount; i++) {
+    std::size_t start = pos;
+    code = skipName(packet(), pos, labels);
+    if (code != E_NOERROR) {
+      return code;
+    }
+    if (i == 0) {
+      nameStart = start;
+      nameEnd = labels;
+    }
+
+    pos += 4; // QTYPE and QCLASS
+    if (pos > length) {
+      LERROR_X << "Question is truncated" << std::endl;
+      return E_FORMERR;
+    }
+  }
+  questionsEnd = pos;
+  indexed = -1;
+
+  if (header.QuestionCount == 1) {
+    return key.Read(packet(), nameStart, nameCase);
+  }
+
+  key.Clear();
+  std::memset(nameCase, 0, NAME_CASE_SIZE);
+  return E_NOERROR;
+}
+
+// Checks the RDATA at pos against the layout DnsRecord reads it with. Names
+// are skipped rather than expanded, they only have to end where the fixed
+// fields after them start.
+template <typename Rr>
+static int checkData(std::span<const uint8_t> packet, std::size_t pos,
+                     uint16_t len) {
+  if (Rr::Length && len != Rr::Length) {
+    LERROR_X << "Invalid length for record: " << len << std::endl;
+    return E_FORMERR;
+  }
+
+  if constexpr (Rr::Names > 0) {
+    std::size_t end = pos + len;
+    std::size_t labels;
+    pos += Rr::Prefix;
+    for (int i = 0; i < Rr::Names && pos <= end; i++) {
+      int code = skipName(packet, pos, labels);
+      if (code != E_NOERROR) {
+        return code;
+      }
+    }
+
+    if (pos + Rr::Suffix != end) {
+      LERROR_X << "Record data does not match its length: " << len
+               << std::endl;
+      return E_FORMERR;
+    }
+  }
+
+  return E_NOERROR;
+}
+
+int DnsPacketView::index() {
+  if (indexed >= 0) {
+    return indexed;
+  }
+
+  const uint16_t counts[] = {header.AnswerCount, header.AuthorityCount,
+                             header.AdditionalCount};
+  std::size_t pos = questionsEnd;
+  std::size_t labels;
+  records = 0;
+  opt = -1;
+  record = fixed;
+  spilled.clear();
+
+  for (int section = DnsRecord::Answer; section <= DnsRecord::Additional;
+       section++) {
+    for (int i = 0; i < counts[section]; i++) {
+      int code = skipName(packet(), pos, labels);
+      if (code != E_NOERROR) {
+        return indexed = code;
+      }
+      if (pos + RRFIXEDSZ > length) {
+        LERROR_X << "Record is truncated" << std::endl;
+        return indexed = E_FORMERR;
+      }
+
+      Record &rr = addRecord();
+      rr.type = readU16(buf, pos);
+      rr.ttl = pos + 4;
+      rr.len = readU16(buf, pos + 8);
+      rr.section = DnsRecord::DnsRecordType(section);
+      pos += RRFIXEDSZ + rr.len;
+      if (pos > length) {
+        LERROR_X << "Record data is truncated" << std::endl;
+        return indexed = E_FORMERR;
+      }
+
+      if (rr.type != QT_OPT) {
+        continue;
+      }
+      // Psuedo record is only allowed once and as additional record
+      if (section != DnsRecord::Additional) {
+        LERROR_X << "Psuedo record not allowed here " << section << std::endl;
+        return indexed = E_FORMERR;
+      }
+      if (opt >= 0) {
+        LWARNING << "More than one psuedo header found" << std::endl;
+        return indexed = E_FORMERR;
+      }
+      opt = records - 1;
+    }
+  }
+
+  if (pos < length) {
+    LWARNING << "Packet contains extra data: " << *this << std::endl;
+  }
+
+  return indexed = E_NOERROR;
+}
+
+DnsPacketView::Record &DnsPacketView::addRecord() {
+  if (records < MAX_VIEW_RECORDS) {
+    return fixed[records++];
+  }
+
+  if (spilled.empty()) {
+    spilled.assign(fixed, fixed + MAX_VIEW_RECORDS);
+  }
+  spilled.emplace_back();
+  record = spilled.data();
+  records++;
+  return spilled.back();
+}
+
+int DnsPacketView::Validate(PacketType pt) {
+  int code = header.Validate(pt);
+  if (code != E_NOERROR) {
+    return code;
+  }
+
+  code = index();
+  if (code != E_NOERROR) {
+    return code;
+  }
+
+  // The psuedo header was placed by index() already
+  for (int i = 0; i < records; i++) {
+    std::size_t rdata = record[i].ttl + 6;
+    uint16_t len = record[i].len;
+    code = RrTypes::Dispatch(record[i].type, [&]<typename Rr>() {
+      return checkData<Rr>(packet(), rdata, len);
+    });
+    if (code != E_NOERROR) {
+      return code;
+    }
+  }
+
+  return E_NOERROR;
+}
+
+uint32_t DnsPacketView::GetMinTtl(std::vector<uint16_t> *ttlOffsets) {
+  uint32_t minTtl = UINT32_MAX;
+  if (index() != E_NOERROR) {
+    return 0;
+  }
+
+  for (int i = 0; i < records; i++) {
+    if (record[i].type != QT_OPT) {
+      minTtl = std::min(minTtl, readU32(buf, record[i].ttl));
+      if (ttlOffsets) {
+        ttlOffsets->push_back(record[i].ttl);
+      }
+    }
+  }
+
+  return minTtl == UINT32_MAX ? 0 : minTtl;
+}
+
+uint32_t DnsPacketView::GetNegativeTtl(std::vector<uint16_t> *ttlOffsets) {
+  if (index() != E_NOERROR) {
+    return 0;
+  }
+
+  // RFC 2308 section 5: the lesser of the SOA TTL and its MINIMUM field. A
+  // reply without SOA must not be cached. MINIMUM ends the RDATA, after two
+  // names and four other counters.
+  for (int i = 0; i < records; i++) {
+    const Record &rr = record[i];
+    if (rr.section == DnsRecord::Authority && rr.type == QT_SOA &&
+        rr.len >= 2 + 5 * 4) {
+      GetMinTtl(ttlOffsets);
+      return std::min(readU32(buf, rr.ttl),
+                      readU32(buf, rr.ttl + 6 + rr.len - 4));
+    }
+  }
+
+  return 0;
+}
+
+bool DnsPacketView::HasPsuedoHeader() {
+  return index() == E_NOERROR && opt >= 0;
+}
+
+uint16_t DnsPacketView::GetPsuedoHeaderLengthOffset() {
+  // RDLENGTH follows the TTL field
+  return HasPsuedoHeader() ? record[opt].ttl + 4 : 0;
+}
+
+bool DnsPacketView::HasDoBit() {
+  return HasPsuedoHeader() && (readU32(buf, record[opt].ttl) & 0x8000);
+}
+
+uint16_t DnsPacketView::GetUdpPayloadSize() {
+  // Carried in the CLASS field, just before the TTL
+  return HasPsuedoHeader() ? readU16(buf, record[opt].ttl - 2) : 0;
+}
+
+int DnsPacketView::WriteTruncated(BytePacketBuffer *out) {
+  int code = index();
+  if (code != E_NOERROR) {
+    return code;
+  }
+
+  // Only TCP messages have questions or a psuedo header too large for it
+  std::size_t size = questionsEnd;
+  std::size_t psuedo = opt >= 0 ? 1 + RRFIXEDSZ + record[opt].len : 0;
+  if (size + psuedo > out->buf.size()) {
+    return E_FORMERR;
+  }
+
+  std::memcpy(out->buf.data(), buf, size);
+  out->buf[2] |= 0x02;             // TC
+  std::memset(&out->buf[6], 0, 6); // Only the questions are left
+
+  if (opt >= 0) {
+    // Root owner, then TYPE, CLASS, TTL, RDLENGTH and RDATA as they were
+    const Record &r = record[opt];
+    std::size_t n = RRFIXEDSZ + r.len;
+    out->buf[size++] = 0;
+    std::memcpy(&out->buf[size], &buf[r.ttl - 4], n);
+    size += n;
+    out->buf[11] = 1;
+  }
+
+  out->pos = size;
+  return E_NOERROR;
+}
+
+void DnsPacketView::SetId(const uint16_t &id) {
+  header.ID = id;
+  buf[0] = id >> 8;
+  buf[1] = id & 0xff;
+}
+
+void DnsPacketView::SetUdpPayloadSize(const uint16_t &size) {
+  if (HasPsuedoHeader()) {
+    buf[record[opt].ttl - 2] = size >> 8;
+    buf[record[opt].ttl - 1] = size & 0xff;
+  }
+}
+
+int DnsPacketView::AddPsuedoHeader(const uint16_t &size) {
+  int code = index();
+  if (code != E_NOERROR || opt >= 0) {
+    return code;
+  }
+
+  // Root owner, TYPE, CLASS holding the size, TTL and RDLENGTH, no options
+  const uint8_t rr[] = {0, 0, QT_OPT, uint8_t(size >> 8), uint8_t(size & 0xff),
+                        0, 0, 0,      0,                  0, 0};
+  if (length + sizeof(rr) > capacity) {
+    return E_FORMERR;
+  }
+
+  std::memcpy(&buf[length], rr, sizeof(rr));
+  length += sizeof(rr);
+  writeAdditionalCount(header.AdditionalCount + 1);
+  return E_NOERROR;
+}
+
+int DnsPacketView::RemovePsuedoHeader() {
+  int code = index();
+  if (code != E_NOERROR || opt < 0) {
+    return code;
+  }
+
+  // The owner is the root, a single byte before TYPE and CLASS
+  std::size_t start = record[opt].ttl - 5;
+  std::size_t end = record[opt].ttl + 6 + record[opt].len;
+  if (buf[start] != 0) {
+    return E_FORMERR;
+  }
+
+  std::memmove(&buf[start], &buf[end], length - end);
+  length -= end - start;
+  writeAdditionalCount(header.AdditionalCount - 1);
+  return E_NOERROR;
+}
+
+// Records are located again the next time they are needed
+void DnsPacketView::writeAdditionalCount(uint16_t count) {
+  header.AdditionalCount = count;
+  buf[10] = count >> 8;
+  buf[11] = count & 0xff;
+  indexed = -1;
+}
+
+void DnsPacketView::writeFlags() {
+  buf[2] = header.hb3;
+  buf[3] = header.hb4;
+}
+
+void DnsPacketView::SetAsQueryResponse() {
+  header.SetQueryResponse(true);
+  writeFlags();
+}
+
+void DnsPacketView::SetAsAuthoritativeAnswer(const bool &value) {
+  header.SetAuthoritativeAnswer(value);
+  writeFlags();
+}
+
+void DnsPacketView::SetRecursionAvailable(const bool &value) {
+  header.SetRecursionAvailable(value);
+  writeFlags();
+}
+
+void DnsPacketView::SetResponseCode(const uint8_t &responseCode) {
+  header.SetResponseCode(responseCode);
+  writeFlags();
+}
+
+std::ostream &operator<<(std::ostream &stream, const DnsPacketView &dp) {
+  stream << dp.header;
+  if (dp.header.QuestionCount == 1) {
+    stream << "Question: " << dp.key << std::endl;
+  }
+
+  return stream;
+}
@@ -9,7 +9,7 @@
 #include "dns/dnsquestion.hpp"
 #include "dns/dnscommon.hpp"
 #include "log.hpp"
-#include "tp/sha256.hpp"
+#include <algorithm>
 #include <cstring>
 
 /*
@@ -26,23 +26,16 @@
  *  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
  */
 
-int DnsQuestion::ReadLabel(BytePacketBuffer *bpb, char *storage) {
+int DnsQuestion::ReadName(BytePacketBuffer *bpb, uint8_t *out,
+                          std::size_t &size) {
+  std::size_t pos = 0; // Where the name ends in the packet
   int jumps = 0;
-  size_t pos = 0;
-
-  Start = bpb->pos;
-  int size = 0;
   uint8_t c, d;
 
-  VREAD_U8(c, bpb);
-
-  // Empty name is possible for psuedo header
-  if (c == 0) {
-    storage[0] = '\0';
-    return E_NOERROR;
-  }
+  size = 0;
+  while (true) {
+    VREAD_U8(c, bpb);
 
-  while (c && jumps < MAX_JUMPS) {
     if ((c & 0xc0) == 0xc0) {
       VREAD_U8(d, bpb);
       uint16_t t = (uint16_t(c ^ 0xc0) << 8 | d);
@@ -50,45 +43,51 @@ int DnsQuestion::ReadLabel(BytePacketBuffer *bpb, char *storage) {
         LERROR_X << "Illegal label offset" << std::endl;
         return E_FORMERR;
       }
-      pos = bpb->pos;
+      if (++jumps > MAX_JUMPS) {
+        LERROR_X << "Too many label jumps" << std::endl;
+        return E_FORMERR;
+      }
+      if (jumps == 1) {
+        pos = bpb->pos;
+      }
       bpb->pos = t;
-      jumps += 1;
     } else if ((c & 0x40) == 0x40 || (c & 0x80) == 0x80) {
       return E_NOTIMP;
     } else {
       // In this case c is the number of bytes to be read
-      if (bpb->pos + c >= bpb->size) {
-        LERROR_X << "Illegal label size" << std::endl;
+      if (size + 1 + c > MAX_WIRE_NAME) {
+        LERROR_X << "Name too long" << std::endl;
         return E_FORMERR;
       }
-
-      for (uint8_t i = 0; i < c; i++) {
-        storage[size++] = READ_BYTE(bpb);
+      _VALIDATE(bpb, c)
+
+      out[size++] = c;
+      std::memcpy(out + size, &bpb->buf[bpb->pos], c);
+      size += c;
+      bpb->pos += c;
+      if (c == 0) {
+        break;
       }
-      storage[size++] = '.';
     }
-
-    VREAD_U8(c, bpb);
   }
 
-  if (jumps == MAX_JUMPS) {
-    LERROR_X << "Too many label jumps" << std::endl;
-    return E_FORMERR;
-  }
-
-  if (pos > 0) {
+  if (jumps > 0) {
     bpb->pos = pos;
   }
 
-  storage[--size] = '\0';
   return E_NOERROR;
 }
 
-int DnsQuestion::Read(BytePacketBuffer *bytePacketBuffer) {
-  int code = ReadLabel(bytePacketBuffer, Name);
+int DnsQuestion::Read(BytePacketBuffer *bytePacketBuffer, Arena &arena) {
+  uint8_t storage[MAX_WIRE_NAME];
+  std::size_t size;
+
+  Start = bytePacketBuffer->pos;
+  int code = ReadName(bytePacketBuffer, storage, size);
   if (code != SUCCESS) {
     return code;
   }
+  Name = std::span<const uint8_t>(arena.Copy(storage, size), size);
 
   VREAD_U16(Type, bytePacketBuffer);
   VREAD_U16(Class, bytePacketBuffer);
@@ -96,13 +95,32 @@ int DnsQuestion::Read(BytePacketBuffer *bytePacketBuffer) {
   return E_NOERROR;
 }
 
-int DnsQuestion::Validate(PacketType pt) const {
-  if (pt == PacketType::IncomingRequest) {
-    if (Type != QT_A && Type != QT_AAAA && Type != QT_NS && Type != QT_CNAME &&
-        Type != QT_MX && Type != QT_OPT) {
-      return E_NOTIMP;
+int DnsQuestion::SetName(const char *name, Arena &arena) {
+  uint8_t storage[MAX_WIRE_NAME];
+  std::size_t size = 0;
+
+  // Root is the empty name or a single dot, a trailing dot is optional
+  for (const char *label = name; *label && std::strcmp(label, ".") != 0;) {
+    const char *dot = std::strchr(label, '.');
+    std::size_t n = dot ? dot - label : std::strlen(label);
+    if (n == 0 || n > 63 || size + 1 + n + 1 > MAX_WIRE_NAME) {
+      return E_FORMERR;
     }
 
+    storage[size++] = n;
+    std::memcpy(storage + size, label, n);
+    size += n;
+    label += dot ? n + 1 : n;
+  }
+  storage[size++] = 0;
+
+  Name = std::span<const uint8_t>(arena.Copy(storage, size), size);
+  return E_NOERROR;
+}
+
+int DnsQuestion::Validate(PacketType pt) const {
+  // Any type is forwarded, records of types not known here are kept opaque
+  if (pt == PacketType::IncomingRequest) {
     if (Type != QT_OPT && Class != QTC_IN) {
       return E_NOTIMP;
     }
@@ -111,40 +129,39 @@ int DnsQuestion::Validate(PacketType pt) const {
   return E_NOERROR;
 }
 
-#define WRITE_LENGTH(bpb)                                                      \
-  {                                                                            \
-    std::size_t t = bpb->pos;                                                  \
-    bpb->pos = pos;                                                            \
-    WRITE_U8(bpb, len)                                                         \
-    len = 0;                                                                   \
-    pos = t;                                                                   \
-    bpb->pos = ++t;                                                            \
-  }
-
-int DnsQuestion::WriteLabel(const char *in, BytePacketBuffer *bpb) const {
-  std::size_t pos = bpb->pos++;
-  uint8_t len = 0;
+void CompressionTable::WriteName(std::span<const uint8_t> name,
+                                 BytePacketBuffer *bpb) {
+  std::size_t i = 0;
+  while (i < name.size() && name[i] != 0) {
+    std::span<const uint8_t> suffix = name.subspan(i);
+    for (std::size_t e = 0; e < count; e++) {
+      if (std::ranges::equal(entries[e].suffix, suffix)) {
+        uint16_t pointer = 0xc000 | entries[e].offset;
+        WRITE_U16(bpb, pointer)
+        return;
+      }
+    }
 
-  for (const char *c = in; *c; c++) {
-    if (*c == '.') {
-      WRITE_LENGTH(bpb)
-    } else {
-      WRITE_BYTE(bpb, *c)
-      len++;
+    if (count < entries.size() && bpb->pos < 0x4000) {
+      entries[count++] = {suffix, uint16_t(bpb->pos)};
     }
+
+    std::size_t n = 1 + name[i];
+    std::memcpy(&bpb->buf[bpb->pos], &name[i], n);
+    bpb->pos += n;
+    i += n;
   }
 
-  WRITE_LENGTH(bpb)
-  bpb->buf[bpb->pos] = 0;
-  return E_NOERROR;
+  WRITE_BYTE(bpb, 0)
 }
 
 int DnsQuestion::Write(BytePacketBuffer *bpb) const {
-  int code = WriteLabel(Name, bpb);
-  if (code != SUCCESS) {
-    return code;
-  }
+  CompressionTable names;
+  return Write(bpb, names);
+}
 
+int DnsQuestion::Write(BytePacketBuffer *bpb, CompressionTable &names) const {
+  names.WriteName(Name, bpb);
   WRITE_U16(bpb, Type)
   WRITE_U16(bpb, Class)
 
@@ -153,20 +170,26 @@ int DnsQuestion::Write(BytePacketBuffer *bpb) const {
 
 bool DnsQuestion::IsQuestionOfType(uint16_t type) { return Type == type; }
 
-int DnsQuestion::UpdateDigest(SHA256_CTX *ctx) const {
-  LDEBUG << "Hashing values:: Name: " << Name << ":" << strlen(Name)
-         << ", Type: " << Type << ", Class: " << Class << std::endl;
-  sha256_update(ctx, (const _BYTE *)Name, strlen(Name));
-  sha256_update(ctx, (const _BYTE *)&Type, 2);
-  sha256_update(ctx, (const _BYTE *)&Class, 2);
-  return 0;
+void DnsQuestion::PrintName(std::ostream &stream,
+                            std::span<const uint8_t> name) {
+  if (name.empty() || name[0] == 0) { // Root
+    stream << '.';
+    return;
+  }
+
+  for (std::size_t i = 0; i < name.size() && name[i];) {
+    stream.write((const char *)&name[i + 1], name[i]);
+    i += 1 + name[i];
+    stream << '.';
+  }
 }
 
 std::ostream &operator<<(std::ostream &stream, const DnsQuestion &dq) {
   using namespace std;
 
-  stream << "Name: " << dq.Name << ", Type: " << dq.Type
-         << ", Class: " << dq.Class << endl;
+  stream << "Name: ";
+  DnsQuestion::PrintName(stream, dq.Name);
+  stream << ", Type: " << dq.Type << ", Class: " << dq.Class << endl;
 
   return stream;
 }
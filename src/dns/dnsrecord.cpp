@@ -8,171 +8,185 @@
 
 #include "dns/dnsrecord.hpp"
 #include "dns/dnscommon.hpp"
+#include "dns/rrtypes.hpp"
+#include "log.hpp"
+#include <algorithm>
 #include <cstdint>
-#include <memory>
+#include <cstring>
 #include <ostream>
 
 void DnsRecord::UpdateFromQuestion(const DnsQuestion *question) {
   Start = question->Start;
+  Name = question->Name;
   Type = question->Type;
   Class = question->Class;
+}
 
-  const char *c = question->Name;
-  char *d = Name;
-  while (*c) {
-    *d++ = *c++;
+// RDATA is read and checked in one go, each codec is compiled for its layout
+template <typename Rr>
+int DnsRecord::readData(BytePacketBuffer *bpb, uint16_t len, Arena &arena) {
+  if (Rr::AdditionalOnly && RecordType != DnsRecordType::Additional) {
+    // Psuedo record is only allowed as additional record.
+    LERROR_X << "Psuedo record not allowed here " << RecordType << std::endl;
+    return E_FORMERR;
   }
-  *d = 0;
-}
 
-int DnsRecord::Read(BytePacketBuffer *bpb) {
-  int code = DnsQuestion::Read(bpb);
-  if (code != E_NOERROR) {
-    return code;
+  if (Rr::Length && len != Rr::Length) {
+    LERROR_X << "Invalid length for record: " << len << std::endl;
+    return E_FORMERR;
   }
 
-  VREAD_U32(TTL, bpb);
-  VREAD_U16(Len, bpb);
-
-  switch (Type) {
-  case QT_A:
-    VREAD_U32(Address.Ipv4.n, bpb);
-    break;
-  case QT_NS:
-    code = ReadLabel(bpb, Address.NS);
-    break;
-  case QT_CNAME:
-    code = ReadLabel(bpb, Address.CName);
-    break;
-  case QT_MX:
-    VREAD_U16(Address.MailExchange.priority, bpb);
-    code = ReadLabel(bpb, Address.MailExchange.host);
-    break;
-  case QT_AAAA:
-    VREAD_U32(Address.Ipv6.n1, bpb);
-    VREAD_U32(Address.Ipv6.n2, bpb);
-    VREAD_U32(Address.Ipv6.n3, bpb);
-    VREAD_U32(Address.Ipv6.n4, bpb);
-    break;
-  case QT_OPT:
-    // Psuedo record is only allowed as additional record.
-    if (RecordType != DnsRecordType::Additional) {
-      LERROR_X << "Psuedo record not allowed here " << RecordType << std::endl;
+  if constexpr (Rr::Names == 0) { // Nothing to expand, taken as it is
+    Data = std::span<const uint8_t>(arena.Copy(&bpb->buf[bpb->pos], len), len);
+    bpb->pos += len;
+  } else {
+    // Names are expanded in place, the fixed fields around them are copied
+    std::size_t end = bpb->pos + len;
+    if (len < Rr::Prefix + Rr::Suffix) {
+      LERROR_X << "Record data does not match its length: " << len
+               << std::endl;
       return E_FORMERR;
     }
-    if (Len > 0) {
-      Address.Opt.octet = new uint8_t[Len];
-      for (int i = 0; i < Len; i++) {
-        VREAD_BYTE(Address.Opt.octet[i], bpb);
+
+    uint8_t rdata[Rr::Expanded];
+    std::memcpy(rdata, &bpb->buf[bpb->pos], Rr::Prefix);
+    bpb->pos += Rr::Prefix;
+    std::size_t size = Rr::Prefix;
+
+    for (int i = 0; i < Rr::Names; i++) {
+      std::size_t n;
+      int code = ReadName(bpb, rdata + size, n);
+      if (code != E_NOERROR) {
+        return code;
       }
-    } else {
-      Address.Opt.octet = nullptr;
+      size += n;
+    }
+
+    if (bpb->pos + Rr::Suffix != end) {
+      LERROR_X << "Record data does not match its length: " << len
+               << std::endl;
+      return E_FORMERR;
     }
-    break;
-  default:
-    return E_SERVFAIL;
+    std::memcpy(rdata + size, &bpb->buf[bpb->pos], Rr::Suffix);
+    size += Rr::Suffix;
+
+    Data = std::span<const uint8_t>(arena.Copy(rdata, size), size);
+    bpb->pos = end;
   }
 
-  return code;
+  return E_NOERROR;
 }
 
-int DnsRecord::Validate(PacketType pt) const {
-  int code = DnsQuestion::Validate(pt);
+int DnsRecord::Read(BytePacketBuffer *bpb, Arena &arena) {
+  int code = DnsQuestion::Read(bpb, arena);
   if (code != E_NOERROR) {
     return code;
   }
 
-  switch (Type) {
-  case QT_A:
-    if (Len != 4) {
-      LERROR_X << "Invalid length for record: " << Len << std::endl;
-      return E_FORMERR;
-    }
-    break;
-  case QT_AAAA:
-    if (Len != 16) {
-      LERROR_X << "Invalid length for record: " << Len << std::endl;
-      return E_FORMERR;
+  uint16_t len;
+  TtlStart = bpb->pos;
+  VREAD_U32(TTL, bpb);
+  VREAD_U16(len, bpb);
+  _VALIDATE(bpb, len)
+
+  return RrTypes::Dispatch(Type, [&]<typename Rr>() {
+    return readData<Rr>(bpb, len, arena);
+  });
+}
+
+// Writes the name at the start of data and returns what follows it
+static std::span<const uint8_t> writeName(std::span<const uint8_t> data,
+                                          BytePacketBuffer *bpb,
+                                          CompressionTable &names) {
+  std::size_t n = 0;
+  while (n < data.size() && data[n]) {
+    n += 1 + data[n];
+  }
+  n = std::min(n + 1, data.size());
+
+  names.WriteName(data.first(n), bpb);
+  return data.subspan(n);
+}
+
+template <typename Rr>
+int DnsRecord::writeData(BytePacketBuffer *bpb,
+                         CompressionTable &names) const {
+  std::span<const uint8_t> rest = Data;
+  if constexpr (Rr::Names > 0) {
+    if (rest.size() > Rr::Prefix) {
+      std::memcpy(&bpb->buf[bpb->pos], rest.data(), Rr::Prefix);
+      bpb->pos += Rr::Prefix;
+      rest = rest.subspan(Rr::Prefix);
+      for (int i = 0; i < Rr::Names; i++) {
+        rest = writeName(rest, bpb, names);
+      }
     }
-    break;
-    // TODO add other validations
   }
+  std::memcpy(&bpb->buf[bpb->pos], rest.data(), rest.size());
+  bpb->pos += rest.size();
 
   return E_NOERROR;
 }
 
 int DnsRecord::Write(BytePacketBuffer *bpb) const {
-  int code = DnsQuestion::Write(bpb);
+  CompressionTable names;
+  return Write(bpb, names);
+}
+
+int DnsRecord::Write(BytePacketBuffer *bpb, CompressionTable &names) const {
+  int code = DnsQuestion::Write(bpb, names);
   if (code != E_NOERROR) {
     return code;
   }
 
   WRITE_U32(bpb, TTL)
-  WRITE_U16(bpb, Len);
-  switch (Type) {
-  case QT_A:
-    WRITE_U32(bpb, Address.Ipv4.n)
-    break;
-  case QT_NS:
-    code = WriteLabel(Address.NS, bpb);
-    break;
-  case QT_CNAME:
-    code = WriteLabel(Address.CName, bpb);
-    break;
-  case QT_MX:
-    WRITE_U16(bpb, Address.MailExchange.priority);
-    code = WriteLabel(Address.MailExchange.host, bpb);
-    break;
-  case QT_AAAA:
-    WRITE_U32(bpb, Address.Ipv6.n1);
-    WRITE_U32(bpb, Address.Ipv6.n2);
-    WRITE_U32(bpb, Address.Ipv6.n3);
-    WRITE_U32(bpb, Address.Ipv6.n4);
-    break;
-  }
-
-  return code;
-}
+  // Compressed names make the length known only afterwards
+  std::size_t lenPos = bpb->pos;
+  bpb->pos += 2;
 
-std::ostream &operator<<(std::ostream &stream, const Ipv4Address &addr) {
-  using namespace std;
+  RrTypes::Dispatch(Type, [&]<typename Rr>() {
+    return writeData<Rr>(bpb, names);
+  });
 
-  stream << ((addr.n & 0xff000000) >> 24) << "." << ((addr.n & 0xff0000) >> 16)
-         << "." << ((addr.n & 0xff00) >> 8) << "." << (addr.n & 0xff);
+  uint16_t len = bpb->pos - lenPos - 2;
+  bpb->buf[lenPos] = len >> 8;
+  bpb->buf[lenPos + 1] = len & 0xff;
 
-  return stream;
+  return E_NOERROR;
 }
 
-#define IPV6_OUT(n)                                                            \
-  ((addr.n & 0xff000000) >> 24)                                                \
-      << ":" << ((addr.n & 0xff0000) >> 16) << ":" << ((addr.n & 0xff00) >> 8) \
-      << ":" << (addr.n & 0xff)
-
-std::ostream &operator<<(std::ostream &stream, const Ipv6Address &addr) {
-  using namespace std;
-
-  stream << IPV6_OUT(n1) << ":" << IPV6_OUT(n2) << ":" << IPV6_OUT(n3) << ":"
-         << IPV6_OUT(n4);
+uint32_t DnsRecord::GetSoaMinimum() const {
+  if (Data.size() < 4) {
+    return 0;
+  }
 
-  return stream;
+  const uint8_t *p = Data.data() + Data.size() - 4;
+  return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 |
+         p[3];
 }
 
 std::ostream &operator<<(std::ostream &stream, const DnsRecord &dp) {
   using namespace std;
 
-  stream << "Name: " << dp.Name << ", Type: " << dp.Type
-         << ", Class: " << dp.Class << ", TTL: " << dp.TTL
-         << ", Len: " << dp.Len << ", Address: ";
-
-  switch (dp.Type) {
-  case QT_A:
-    stream << dp.Address.Ipv4;
-    break;
-  case QT_AAAA:
-    stream << dp.Address.Ipv6;
-    break;
-  default:
-    stream << " Unsupported record type : " << dp.Type;
+  stream << "Name: ";
+  DnsQuestion::PrintName(stream, dp.Name);
+  stream << ", Type: " << dp.Type << ", Class: " << dp.Class
+         << ", TTL: " << dp.TTL << ", Len: " << dp.Data.size()
+         << ", Address: ";
+
+  if (dp.Type == QT_A && dp.Data.size() == 4) {
+    stream << int(dp.Data[0]) << "." << int(dp.Data[1]) << "."
+           << int(dp.Data[2]) << "." << int(dp.Data[3]);
+  } else if (dp.Type == QT_AAAA && dp.Data.size() == 16) {
+    stream << hex;
+    for (std::size_t i = 0; i < 16; i += 2) {
+      stream << (i ? ":" : "") << (dp.Data[i] << 8 | dp.Data[i + 1]);
+    }
+    stream << dec;
+  } else if (dp.Type == QT_NS || dp.Type == QT_CNAME || dp.Type == QT_PTR) {
+    DnsQuestion::PrintName(stream, dp.Data);
+  } else {
+    stream << "(opaque)";
   }
 
   stream << endl;
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "dns/querykey.hpp"
+#include "dns/dnscommon.hpp"
+#include "dns/dnsquestion.hpp"
+#include <random>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+#if defined(__GNUC__) && defined(__SSE2__) &&                                  \
+    (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL
+#endif
+
+int QueryKey::Read(std::span<const uint8_t> packet, std::size_t pos,
+                   uint8_t *nameCase) {
+  std::size_t len = 0;
+  std::size_t end = 0; // Where QTYPE starts
+  int jumps = 0;
+
+  Clear();
+  while (true) {
+    if (pos >= packet.size()) {
+      return E_FORMERR;
+    }
+
+    uint8_t c = packet[pos];
+    if ((c & 0xc0) == 0xc0) {
+      if (pos + 1 >= packet.size() || ++jumps > MAX_JUMPS) {
+        return E_FORMERR;
+      }
+      end = end ? end : pos + 2;
+      pos = std::size_t(c & 0x3f) << 8 | packet[pos + 1];
+      continue;
+    } else if (c & 0xc0) {
+      return E_NOTIMP;
+    }
+
+    if (pos + 1 + c > packet.size() || len + 1 + c > MAX_WIRE_NAME) {
+      return E_FORMERR;
+    }
+    std::memcpy(data + len, &packet[pos], 1 + c);
+    len += 1 + c;
+    pos += 1 + c;
+    if (c == 0) {
+      break;
+    }
+  }
+
+  end = end ? end : pos;
+  if (end + 4 > packet.size()) {
+    return E_FORMERR;
+  }
+  std::memcpy(data + len, &packet[end], 4);
+  finish(len, nameCase);
+
+  return E_NOERROR;
+}
+
+int QueryKey::Set(const DnsQuestion &question) {
+  std::size_t len = question.Name.size();
+
+  Clear();
+  if (len == 0 || len > MAX_WIRE_NAME) {
+    return E_FORMERR;
+  }
+
+  std::memcpy(data, question.Name.data(), len);
+  data[len] = question.Type >> 8;
+  data[len + 1] = question.Type & 0xff;
+  data[len + 2] = question.Class >> 8;
+  data[len + 3] = question.Class & 0xff;
+  finish(len, nullptr);
+
+  return E_NOERROR;
+}
+
+void QueryKey::finish(std::size_t nameSize, uint8_t *nameCase) {
+  // Length octets are below 64 and never look like letters
+  ToLower(data, nameSize, nameCase);
+  size = nameSize + 4;
+  hash = HashBytes(data, size);
+}
+
+// Bytes from i on, one at a time
+static void lowerTail(uint8_t *data, std::size_t i, std::size_t size,
+                      uint8_t *bits) {
+  for (; i < size; i++) {
+    if (data[i] >= 'A' && data[i] <= 'Z') {
+      data[i] |= 0x20;
+      if (bits && i < NAME_CASE_SIZE * 8) {
+        bits[i / 8] |= 1 << (i % 8);
+      }
+    }
+  }
+}
+
+static void lowerScalar(uint8_t *data, std::size_t size, uint8_t *bits) {
+  lowerTail(data, 0, size, bits);
+}
+
+#ifdef __SSE2__
+// Signed compares, bytes from 0x80 up are negative and stay as they are.
+// The mask of letters found is the case bitmap of those 16 bytes.
+static void lowerSse2From(uint8_t *data, std::size_t i, std::size_t size,
+                          uint8_t *bits) {
+  const __m128i before = _mm_set1_epi8('A' - 1);
+  const __m128i after = _mm_set1_epi8('Z' + 1);
+  const __m128i bit = _mm_set1_epi8(0x20);
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i upper =
+        _mm_and_si128(_mm_cmpgt_epi8(v, before), _mm_cmplt_epi8(v, after));
+    v = _mm_or_si128(v, _mm_and_si128(upper, bit));
+    _mm_storeu_si128((__m128i *)(data + i), v);
+    if (bits && i < NAME_CASE_SIZE * 8) {
+      uint16_t mask = _mm_movemask_epi8(upper);
+      std::memcpy(bits + i / 8, &mask, 2);
+    }
+  }
+  lowerTail(data, i, size, bits);
+}
+
+static void lowerSse2(uint8_t *data, std::size_t size, uint8_t *bits) {
+  lowerSse2From(data, 0, size, bits);
+}
+#endif /* __SSE2__ */
+
+#ifdef HAVE_AVX2_KERNEL
+__attribute__((target("avx2"))) static void
+lowerAvx2(uint8_t *data, std::size_t size, uint8_t *bits) {
+  const __m256i before = _mm256_set1_epi8('A' - 1);
+  const __m256i after = _mm256_set1_epi8('Z' + 1);
+  const __m256i bit = _mm256_set1_epi8(0x20);
+  std::size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, before),
+                                     _mm256_cmpgt_epi8(after, v));
+    v = _mm256_or_si256(v, _mm256_and_si256(upper, bit));
+    _mm256_storeu_si256((__m256i *)(data + i), v);
+    if (bits && i < NAME_CASE_SIZE * 8) {
+      uint32_t mask = _mm256_movemask_epi8(upper);
+      std::memcpy(bits + i / 8, &mask, 4);
+    }
+  }
+  // Nothing else is built for AVX, leaving the upper halves dirty would slow
+  // down every SSE instruction after this one
+  _mm256_zeroupper();
+  // Most names are shorter than 32 bytes
+  lowerSse2From(data, i, size, bits);
+}
+#endif /* HAVE_AVX2_KERNEL */
+
+typedef void (*LowerFn)(uint8_t *data, std::size_t size, uint8_t *bits);
+
+static LowerFn lower = lowerScalar;
+// Best the CPU has, until told otherwise
+[[maybe_unused]] static const QueryKey::Kernel picked =
+    QueryKey::UseKernel(QueryKey::Kernel::Avx2);
+
+QueryKey::Kernel QueryKey::UseKernel(Kernel kernel) {
+#ifdef HAVE_AVX2_KERNEL
+  if (kernel == Kernel::Avx2 && __builtin_cpu_supports("avx2")) {
+    lower = lowerAvx2;
+    return Kernel::Avx2;
+  }
+#endif /* HAVE_AVX2_KERNEL */
+#ifdef __SSE2__
+  if (kernel != Kernel::Scalar) {
+    lower = lowerSse2;
+    return Kernel::Sse2;
+  }
+#endif /* __SSE2__ */
+  lower = lowerScalar;
+  return Kernel::Scalar;
+}
+
+void QueryKey::ToLower(uint8_t *data, std::size_t size, uint8_t *bits) {
+  if (bits) {
+    std::memset(bits, 0, NAME_CASE_SIZE);
+  }
+  lower(data, size, bits);
+}
+
+static uint64_t rotl(uint64_t v, int n) { return v << n | v >> (64 - n); }
+
+// Finalizer of MurmurHash3, every input bit affects every output bit
+static uint64_t avalanche(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static uint64_t hashSeed() {
+  std::random_device seed;
+  return uint64_t(seed()) << 32 | seed();
+}
+
+uint64_t QueryKey::HashBytes(const void *data, std::size_t size) {
+  static const uint64_t seed = hashSeed();
+  const uint8_t *p = (const uint8_t *)data;
+  uint64_t h = seed ^ size;
+
+  // Eight bytes a round, the way MurmurHash3 mixes a block
+  for (; size >= 8; size -= 8, p += 8) {
+    uint64_t w;
+    std::memcpy(&w, p, 8);
+    h ^= rotl(w * 0x87c37b91114253d5ULL, 31) * 0x4cf5ad432745937fULL;
+    h = rotl(h, 27) * 5 + 0x52dce729;
+  }
+
+  if (size > 0) {
+    uint64_t w = 0;
+    std::memcpy(&w, p, size);
+    h ^= rotl(w * 0x87c37b91114253d5ULL, 31) * 0x4cf5ad432745937fULL;
+  }
+
+  return avalanche(h);
+}
+
+void QueryKey::SaveCase(std::span<const uint8_t> name, uint8_t *bits) {
+  std::memset(bits, 0, NAME_CASE_SIZE);
+  for (std::size_t i = 0; i < name.size() && i < NAME_CASE_SIZE * 8; i++) {
+    if (name[i] >= 'A' && name[i] <= 'Z') {
+      bits[i / 8] |= 1 << (i % 8);
+    }
+  }
+}
+
+void QueryKey::RestoreCase(std::span<uint8_t> name, const uint8_t *bits) {
+  // Length octets are below 64 and stay below 64 with the case bit set
+  for (std::size_t i = 0; i < name.size() && i < NAME_CASE_SIZE * 8; i++) {
+    uint8_t lower = name[i] | 0x20;
+    if (lower >= 'a' && lower <= 'z') {
+      name[i] = bits[i / 8] & (1 << (i % 8)) ? lower & ~0x20 : lower;
+    }
+  }
+}
+
+std::ostream &operator<<(std::ostream &stream, const QueryKey &key) {
+  std::span<const uint8_t> name = key.Name();
+  if (name.empty()) {
+    return stream << "(none)";
+  }
+
+  DnsQuestion::PrintName(stream, name);
+  const uint8_t *end = name.data() + name.size();
+  return stream << " type " << (end[0] << 8 | end[1]) << " class "
+                << (end[2] << 8 | end[3]);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "dns/responder.hpp"
+#include "dns/dnscommon.hpp"
+#include <cstring>
+
+#define HEADER_SZ 12
+
+int Responder::Redirect(const DnsPacketView &request,
+                        const union IpAddress &target, BytePacketBuffer *out) {
+  if (request.GetQuestionCount() != 1) {
+    return E_FORMERR;
+  }
+
+  // QTYPE and QCLASS end the question
+  const uint8_t *qtype = request.Data() + request.QuestionsEnd() - 4;
+  uint16_t type = uint16_t(qtype[0]) << 8 | qtype[1];
+  if (type != QT_A && type != QT_AAAA) {
+    return write(request, E_NOERROR, nullptr, out);
+  }
+
+  return write(request, E_NOERROR, &answer(target, type), out);
+}
+
+int Responder::Reject(const DnsPacketView &request, uint8_t responseCode,
+                      BytePacketBuffer *out) {
+  return write(request, responseCode, nullptr, out);
+}
+
+const Responder::Template &Responder::answer(const union IpAddress &target,
+                                             uint16_t type) {
+  std::size_t len = type == QT_A ? 4 : 4 * IPV6_SIZE;
+  for (auto &t : templates) {
+    if (t.type == type && std::memcmp(t.target.Ipv6v, target.Ipv6v, len) == 0) {
+      return t;
+    }
+  }
+
+  Template &t = templates[next];
+  next = (next + 1) % templates.size();
+
+  t.type = type;
+  t.target = target;
+  // Owner is a pointer to the question name, which always follows the header.
+  // Class is patched in from the question.
+  const uint8_t fixed[] = {0xc0,
+                           HEADER_SZ,
+                           uint8_t(type >> 8),
+                           uint8_t(type & 0xff),
+                           0,
+                           QTC_IN,
+                           uint8_t(RESPONDER_TTL >> 24),
+                           uint8_t(RESPONDER_TTL >> 16 & 0xff),
+                           uint8_t(RESPONDER_TTL >> 8 & 0xff),
+                           uint8_t(RESPONDER_TTL & 0xff),
+                           uint8_t(len >> 8),
+                           uint8_t(len & 0xff)};
+  std::memcpy(t.rr.data(), fixed, sizeof(fixed));
+  // Addresses are kept in network order
+  std::memcpy(t.rr.data() + sizeof(fixed), target.Ipv6v, len);
+  t.size = sizeof(fixed) + len;
+
+  return t;
+}
+
+int Responder::write(const DnsPacketView &request, uint8_t responseCode,
+                     const Template *answer, BytePacketBuffer *out) const {
+  if (request.GetQuestionCount() != 1) {
+    return E_FORMERR;
+  }
+
+  // Header and question as the client sent them
+  std::size_t size = request.QuestionsEnd();
+  const uint8_t *data = request.Data();
+  std::memcpy(out->buf.data(), data, size);
+
+  // QR and AA set, opcode and RD kept. RA set, CD kept.
+  out->buf[2] = 0x80 | (data[2] & 0x79) | 0x04;
+  out->buf[3] = 0x80 | (data[3] & 0x10) | (responseCode & 0x0f);
+  // One question, one answer at most, the rest is dropped
+  std::memset(&out->buf[6], 0, HEADER_SZ - 6);
+  out->buf[7] = answer != nullptr;
+
+  if (answer) {
+    std::memcpy(&out->buf[size], answer->rr.data(), answer->size);
+    // Same class as asked
+    out->buf[size + 4] = data[size - 2];
+    out->buf[size + 5] = data[size - 1];
+    size += answer->size;
+  }
+
+  out->pos = size;
+  return E_NOERROR;
+}
@@ -14,6 +14,7 @@
 #include <boost/asio/io_context.hpp>
 #include <boost/smart_ptr/make_unique.hpp>
 #include <memory>
+#include <sstream>
 #include <utility>
 #ifdef __linux
 #include <arpa/inet.h>
@@ -41,13 +42,14 @@
 #include "bookkeeping/server.hpp"
 #include "dns/dnscommon.hpp"
 #include "dns/dnspacket.hpp"
+#include "dns/dnspacketview.hpp"
 #include "dns/server.hpp"
 #include "log.hpp"
 #include "net/packet.hpp"
 #include "rule/input.hpp"
-#include "tp/sha256.hpp"
 
 #define THREAD_SLEEP_AFTER_FAIL 100
+#define MAX_BATCH_ROUNDS 8 /* recvmmsg calls per socket before yielding */
 #define UDP_RESIZE_PKG_SZ_AFTER                                                \
   60 /* How often to reset our idea of max packet size. */
 
@@ -56,21 +58,30 @@ using boost::asio::generic::raw_protocol;
 DnsServer::DnsServer(boost::asio::io_context &io_context, uint16_t port,
                      const ConfigReader *configReader,
                      ShmRuleEngine *ruleEngine)
-    : socket4(io_context), socket6(io_context), configReader(configReader),
-      ruleEngine(ruleEngine) {
-  initUpstreamServers();
+    : timers(io_context), peerRequests(timers, configReader->maxQueries),
+      ethmappings(timers),
+      cache(configReader->cacheSize, configReader->negativeCacheSize,
+            configReader->staleWindow),
+      listener4(io_context, true, false), listener6(io_context, false, false),
+      upstream4(io_context, true, true), upstream6(io_context, false, true),
+      acceptor4(io_context), acceptor6(io_context), lastTcpId(0),
+      tcpClient(nullptr), batching(false), statsTimer(io_context), stats{},
+      configReader(configReader),
+      ruleEngine(ruleEngine),
+      selector(configReader->upstreamStrategy, configReader->upstreamExplore) {
+  peerRequests.OnExpiry(
+      [this](PeerRequests::PeerRequestRecord *r) { dropQuery(r); });
+  initUpstreamServers(io_context);
   startRawSocketScan(io_context, port);
   startDnsListeners(port);
+  cache.SetPrefetch(configReader->prefetchHits, configReader->prefetchPercent);
+  scheduleStats();
 }
 
-void DnsServer::initUpstreamServers() {
+void DnsServer::initUpstreamServers(boost::asio::io_context &io_context) {
   using namespace boost::asio::ip;
 
   for (auto &server : configReader->servers) {
-    if (server.protocol == Protocol::Tcp) {
-      continue;
-    }
-
     boost::asio::ip::address targetIP;
     bool ipv4;
     std::unique_ptr<UpstreamServerInfo> usi =
@@ -92,10 +103,43 @@ void DnsServer::initUpstreamServers() {
 
     usi->endpoint = udp::endpoint(targetIP, server.port);
     usi->ipv4 = ipv4;
+    usi->tcp = server.protocol != Protocol::Udp;
+    if (server.protocol == Protocol::Tls && !tlsContext) {
+      tlsContext = newTlsContext();
+    }
+
+    UpstreamServerInfo *s = usi.get();
+    tcpUpstreams.emplace(
+        s, std::make_unique<TcpUpstream>(
+               io_context, timers, tcp::endpoint(targetIP, server.port),
+               configReader->upstreamTcpConnections,
+               std::chrono::milliseconds(configReader->tcpIdleTimeout),
+               std::chrono::milliseconds(configReader->upstreamConnectTimeout),
+               [this, s](std::span<const uint8_t> reply) {
+                 processTcpReply(s, reply);
+               },
+               server.protocol == Protocol::Tls ? tlsContext.get() : nullptr,
+               server.tlsName));
+    selector.Add(usi.get());
     servers.push_back(std::move(usi));
   }
 }
 
+std::unique_ptr<boost::asio::ssl::context> DnsServer::newTlsContext() {
+  namespace ssl = boost::asio::ssl;
+
+  auto context = std::make_unique<ssl::context>(ssl::context::tls_client);
+  // RFC 8310 section 9
+  SSL_CTX_set_min_proto_version(context->native_handle(), TLS1_2_VERSION);
+  context->set_verify_mode(ssl::verify_peer);
+  if (configReader->tlsCaFile.empty()) {
+    context->set_default_verify_paths();
+  } else {
+    context->load_verify_file(configReader->tlsCaFile);
+  }
+  return context;
+}
+
 void DnsServer::startRawSocketScan(
     [[maybe_unused]] boost::asio::io_context &io_context,
     [[maybe_unused]] const uint16_t &port) {
@@ -113,17 +157,123 @@ void DnsServer::startRawSocketScan(
 #endif /* __linux */
 }
 
+#ifdef __linux
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>
+    reuse_port;
+#endif /* __linux */
+
+void DnsServer::openListener(UdpSocketData &d, const uint16_t &port) {
+  d.socket.open(d.ipv4 ? udp::v4() : udp::v6());
+  if (!d.ipv4) {
+    d.socket.set_option(boost::asio::ip::v6_only(true));
+  }
+
+#ifdef __linux
+  // Every worker binds its own socket to the same port and the kernel
+  // spreads client flows across them.
+  if (configReader->workers > 1) {
+    d.socket.set_option(reuse_port(true));
+  }
+#endif /* __linux */
+
+  d.socket.bind({d.ipv4 ? udp::v4() : udp::v6(), port});
+}
+
+void DnsServer::openUpstream(UdpSocketData &d) {
+  // Upstream traffic uses a socket private to this worker, so replies come
+  // back to the worker which owns the matching PeerRequests record.
+  d.socket.open(d.ipv4 ? udp::v4() : udp::v6());
+  if (!d.ipv4) {
+    d.socket.set_option(boost::asio::ip::v6_only(true));
+  }
+  d.socket.bind({d.ipv4 ? udp::v4() : udp::v6(), 0});
+}
+
+void DnsServer::openTcpListener(tcp::acceptor &a, bool ipv4,
+                                const uint16_t &port) {
+  a.open(ipv4 ? tcp::v4() : tcp::v6());
+  if (!ipv4) {
+    a.set_option(boost::asio::ip::v6_only(true));
+  }
+  a.set_option(tcp::acceptor::reuse_address(true));
+
+#ifdef __linux
+  // Same as the UDP listeners, the kernel spreads connections across workers
+  if (configReader->workers > 1) {
+    a.set_option(reuse_port(true));
+  }
+#endif /* __linux */
+
+  a.bind({ipv4 ? tcp::v4() : tcp::v6(), port});
+  a.listen();
+  accept(a);
+}
+
+void DnsServer::accept(tcp::acceptor &a) {
+  a.async_accept([this, &a](boost::system::error_code ec, tcp::socket socket) {
+    if (ec == boost::asio::error::operation_aborted) {
+      return;
+    }
+
+    if (ec) {
+      LERROR << "Error accepting TCP connection: " << ec.message()
+             << std::endl;
+    } else {
+      addTcpConnection(std::move(socket));
+    }
+    accept(a);
+  });
+}
+
+void DnsServer::addTcpConnection(tcp::socket socket) {
+  boost::system::error_code ec;
+  if (tcpConnections.size() >= configReader->tcpConnections) {
+    // Refused right away rather than left waiting in the backlog
+    stats.tcpRefused++;
+    LDEBUG << "TCP connection limit reached, closing new connection"
+           << std::endl;
+    socket.close(ec);
+    return;
+  }
+
+  // Replies are written whole, nothing is gained by holding them back
+  socket.set_option(tcp::no_delay(true), ec);
+
+  auto c = std::make_shared<TcpConnection>(
+      std::move(socket), ++lastTcpId, timers,
+      std::chrono::milliseconds(configReader->tcpIdleTimeout),
+      [this](TcpConnection &c, std::span<const uint8_t> message) {
+        processTcpQuery(c, message);
+      },
+      [this](TcpConnection &c) { tcpConnections.erase(c.Id()); });
+  tcpConnections.emplace(c->Id(), c);
+  stats.tcpAccepted++;
+  c->Start();
+}
+
 void DnsServer::startDnsListeners(const uint16_t &port) {
-  socket4.open({udp::v4()});
-  socket4.bind({udp::v4(), port});
+  openListener(listener4, port);
+  openListener(listener6, port);
+  openUpstream(upstream4);
+  openUpstream(upstream6);
+  if (configReader->tcpPort != 0) {
+    openTcpListener(acceptor4, true, configReader->tcpPort);
+    openTcpListener(acceptor6, false, configReader->tcpPort);
+  }
 
-  socket6.open({udp::v6()});
-  boost::asio::ip::v6_only option(true);
-  socket6.set_option(option);
-  socket6.bind({udp::v6(), port});
+#ifdef __linux
+  if (configReader->batchSize > 1) {
+    for (UdpSocketData *d : {&listener4, &listener6, &upstream4, &upstream6}) {
+      d->in = std::make_unique<UdpBatch>(configReader->batchSize);
+      d->out = std::make_unique<UdpBatch>(configReader->batchSize);
+    }
+  }
+#endif /* __linux */
 
-  receive4();
-  receive6();
+  receive(&listener4);
+  receive(&listener6);
+  receive(&upstream4);
+  receive(&upstream6);
 }
 
 void DnsServer::receive(SocketData *d) {
@@ -144,50 +294,118 @@ void DnsServer::receive(SocketData *d) {
 }
 
 DnsServer::~DnsServer() {
-  socket4.close();
-  socket6.close();
+  logStats();
+  listener4.socket.close();
+  listener6.socket.close();
+  upstream4.socket.close();
+  upstream6.socket.close();
+
+  boost::system::error_code ec;
+  acceptor4.close(ec);
+  acceptor6.close(ec);
+  // Closing a connection removes it from the map
+  auto open = std::move(tcpConnections);
+  tcpConnections.clear();
+  for (auto &c : open) {
+    c.second->Close();
+  }
 }
 
 void DnsServer::receive(boost::system::error_code ec, std::size_t n,
-                        bool ipv4) {
+                        UdpSocketData *d) {
   if (ec) {
-    LERROR << "Error calling async_receive_from [" << ipv4
+    LERROR << "Error calling async_receive_from [" << d->ipv4
            << "]: " << ec.message() << std::endl;
     // boost::this_thread::sleep_for(
     //     boost::chrono::milliseconds(THREAD_SLEEP_AFTER_FAIL));
   } else {
-    if (n < sizeof(DnsHeader)) {
-      LERROR << "Invalid packet recieved with size: " << n << std::endl;
-      return;
-    }
+    processDatagram(d->recvBuffer, d->endpoint, n, d);
+  }
+}
 
-    udp::endpoint &endpoint = ipv4 ? endpoint4 : endpoint6;
-    BytePacketBuffer &bpb = ipv4 ? recvBuffer4 : recvBuffer6;
+void DnsServer::processDatagram(BytePacketBuffer &bpb, udp::endpoint &endpoint,
+                                std::size_t n, UdpSocketData *d) {
+  if (n < sizeof(DnsHeader)) {
+    LERROR << "Invalid packet recieved with size: " << n << std::endl;
+    return;
+  }
 
-    if (endpoint.port() == 0) {
-      LERROR << "Data received from port 0" << std::endl;
-      return;
-    }
+  if (endpoint.port() == 0) {
+    LERROR << "Data received from port 0" << std::endl;
+    return;
+  }
 
-    bpb.pos = 0;
-    bpb.size = n;
+  bpb.pos = 0;
+  bpb.size = n;
 
-    int res;
-    DnsPacket packet;
+  int res;
+  // Read in place, records are only located if something needs them
+  DnsPacketView packet(bpb);
 
-    // DumpHex(bpb.buf, bpb.size);
+  // DumpHex(bpb.buf, bpb.size);
 
-    res = packet.Read(&bpb);
-    if (res != E_NOERROR) {
-      updateErrorResponse(packet, E_FORMERR);
-      return;
-    }
+  res = packet.Read();
+  if (res != E_NOERROR) {
+    LDEBUG << "Malformed packet received from: " << endpoint << std::endl;
+    return;
+  }
 
-    if (packet.IsRequest()) { // Incoming request
-      processRequest(packet, res, endpoint, ipv4);
-    } else { // Response from upstream DNS Server
-      processUpstreamResponse(packet, res, endpoint);
-    }
+  if (packet.IsRequest() == d->upstream) {
+    LERROR << "Unexpected packet type received from: " << endpoint
+           << std::endl;
+    return;
+  }
+
+  if (packet.IsRequest()) { // Incoming request
+    processRequest(packet, res, endpoint, d->ipv4);
+  } else { // Response from upstream DNS Server
+    processUpstreamResponse(packet, res, endpoint);
+  }
+}
+
+void DnsServer::processTcpQuery(TcpConnection &c,
+                                std::span<const uint8_t> message) {
+  stats.tcpQueries++;
+  tcpClient = &c;
+
+  std::memcpy(tcpBuffer.buf.data(), message.data(), message.size());
+  tcpBuffer.pos = 0;
+  tcpBuffer.size = message.size();
+
+  int res;
+  DnsPacketView packet(tcpBuffer);
+  if (message.size() < sizeof(DnsHeader) || packet.Read() != E_NOERROR ||
+      !packet.IsRequest()) {
+    LDEBUG << "Malformed packet received over TCP from: " << c.Endpoint()
+           << std::endl;
+    noReply();
+  } else {
+    processRequest(packet, res, c.Endpoint(), c.Ipv4());
+  }
+
+  tcpClient = nullptr;
+}
+
+// Points replies at the connection the client asked on, false once that
+// has been closed
+bool DnsServer::replyTo(const PeerRequests::PeerRequestRecord::PeerSource *s) {
+  tcpClient = nullptr;
+  if (s->connection == 0) {
+    return true;
+  }
+
+  auto it = tcpConnections.find(s->connection);
+  if (it == tcpConnections.end()) {
+    return false;
+  }
+  tcpClient = it->second.get();
+  return true;
+}
+
+// Frees the pipeline slot of a TCP query nothing is sent back for
+void DnsServer::noReply() {
+  if (tcpClient) {
+    tcpClient->Unanswered();
   }
 }
 
@@ -242,7 +460,7 @@ void DnsServer::receiveRawData(boost::system::error_code ec, std::size_t n,
   }
 }
 
-bool DnsServer::processRequest(DnsPacket &packet, int &res,
+bool DnsServer::processRequest(DnsPacketView &packet, int &res,
                                const udp::endpoint &endpoint, bool ipv4) {
   bool sent = false;
   LDEBUG << "Incoming packet:: destination: " << endpoint
@@ -252,6 +470,7 @@ bool DnsServer::processRequest(DnsPacket &packet, int &res,
   res = packet.Validate(PacketType::IncomingRequest);
   if (res != E_NOERROR) {
     updateErrorResponse(packet, (uint8_t)res);
+    noReply();
     return sent;
   }
 
@@ -278,7 +497,7 @@ bool DnsServer::processRequest(DnsPacket &packet, int &res,
   return sent;
 }
 
-bool DnsServer::processUpstreamResponse(DnsPacket &packet, int &res,
+bool DnsServer::processUpstreamResponse(DnsPacketView &packet, int &res,
                                         udp::endpoint &endpoint) {
   bool sent = true;
   const std::time_t now = GetNow();
@@ -300,6 +519,7 @@ bool DnsServer::processUpstreamResponse(DnsPacket &packet, int &res,
     return sent;
   }
 
+  server->stats.replies++;
   res = packet.Validate(PacketType::IncomingResponse);
   if (res != E_NOERROR) {
     server->stats.invalids++;
@@ -308,15 +528,13 @@ bool DnsServer::processUpstreamResponse(DnsPacket &packet, int &res,
     return sent;
   }
 
-  uint8_t digest[SHA256_BLOCK_SIZE];
-  packet.Hash(digest);
-
   PeerRequests::PeerRequestRecord *r =
-      peerRequests.Lookup(packet.GetId(), digest);
+      peerRequests.Lookup(packet.GetId(), packet.GetKey());
   if (r == nullptr) {
     server->stats.nosources++;
-    // We send request to all configured servers for now. The record might
-    // have been removed as we got request from first server that replied.
+    selector.OnLateReply(server);
+    // The query may have gone to more than one server. The record is removed
+    // once the first of them replies.
     LINFO << "No source request found for reply:: destination: " << endpoint
           << " Id: " << packet.GetId() << " QC: " << packet.GetQuestionCount()
           << " AC: " << packet.GetAnswerCount() << std::endl;
@@ -329,203 +547,926 @@ bool DnsServer::processUpstreamResponse(DnsPacket &packet, int &res,
     server->stats.failed++;
   }
 
-  /* calculate modified moving average of server latency */
-  if (server->stats.Latency == 0) {
-    server->stats.MMA = (now - r->forwardTimestamp) * 128; /* init */
-  } else {
-    server->stats.MMA += now - r->forwardTimestamp - server->stats.Latency;
+  if (r->attempts == 1) {
+    selector.OnReply(server, r->forwardTime, std::chrono::steady_clock::now());
+  } else { // Can not tell which attempt this answers
+    selector.OnLateReply(server);
   }
-  /* denominator controls how many queries we average over. */
-  server->stats.Latency = server->stats.MMA / 128;
 
-  // Send reply
-  packet.SetRecursionAvailable(true);
+  // Asked again over TCP for the whole reply (RFC 7766 section 5)
+  if (packet.IsTrucated() && !r->overTcp && !server->tcp) {
+    r->overTcp = true;
+    stats.tcpRetries++;
+    sendQuery(r, server);
+    addRetransmit(r);
+    return sent;
+  }
 
-  for (auto source = &r->source; source; source = source->next.get()) {
-    LDEBUG << "Endpoint: " << endpoint << ", " << source->ipv4 << std::endl;
-    packet.SetId(source->originalId);
-    sendPacket(packet, source->endpoint, source->ipv4);
+  // The client asked without EDNS, the psuedo header is the one we added
+  if (!(r->flags & PEER_HAS_PSUEDO_HEADER)) {
+    packet.RemovePsuedoHeader();
   }
 
+  if (cache.Enabled()) {
+    cacheResponse(packet, r->flags, now);
+  }
+
+  if (r->staleServed) { // Only refreshed the cache
+    peerRequests.FreePeerRequestRecord(r);
+    return sent;
+  }
+
+  // RFC 8767 section 5: stale data beats passing on a failure
+  if ((responseCode == E_SERVFAIL || responseCode == E_REFUSED) &&
+      packet.GetQuestionCount() == 1) {
+    if (serveStale(r, ResponseCache::Key(r->key, r->flags), now)) {
+      peerRequests.FreePeerRequestRecord(r);
+      return sent;
+    }
+  }
+
+  // Send reply, patched in the receive buffer
+  packet.SetRecursionAvailable(true);
+  sendToClients(packet, r);
+
   peerRequests.FreePeerRequestRecord(r);
 
   return sent;
 }
 
-void DnsServer::updateRedirectResponse(DnsPacket &packet,
-                                       const union IpAddress &target) const {
-  packet.SetAsQueryResponse();
-  packet.SetAsAuthoritativeAnswer(true);
-  packet.SetRecursionAvailable(true);
+void DnsServer::processTcpReply(UpstreamServerInfo *server,
+                                std::span<const uint8_t> message) {
+  if (message.size() < sizeof(DnsHeader)) {
+    LERROR << "Invalid packet received over TCP from: " << server->endpoint
+           << std::endl;
+    return;
+  }
 
-  packet.SetAnswers([&target](DnsQuestion *question, DnsRecord *answer) {
-    answer->UpdateFromQuestion(question);
+  // May be larger than the packet buffers, UDP clients get it truncated
+  std::memcpy(tcpBuffer.buf.data(), message.data(), message.size());
+  tcpBuffer.pos = 0;
+  tcpBuffer.size = message.size();
 
-    answer->TTL = ONE_HOUR;
-    switch (question->Type) {
-    case QT_A:
-      answer->Len = 4;
-      answer->Address.Ipv4.n = target.Ipv4;
-      break;
-    case QT_AAAA:
-      answer->Len = 16;
-      answer->Address.Ipv6.n1 = target.Ipv6[0];
-      answer->Address.Ipv6.n2 = target.Ipv6[1];
-      answer->Address.Ipv6.n3 = target.Ipv6[2];
-      answer->Address.Ipv6.n4 = target.Ipv6[3];
-      break;
+  int res;
+  DnsPacketView packet(tcpBuffer);
+  if (packet.Read() != E_NOERROR || packet.IsRequest()) {
+    LDEBUG << "Malformed packet received over TCP from: " << server->endpoint
+           << std::endl;
+    return;
+  }
+
+  udp::endpoint endpoint = server->endpoint;
+  processUpstreamResponse(packet, res, endpoint);
+}
+
+void DnsServer::cacheResponse(DnsPacketView &packet, unsigned int flags,
+                              const std::time_t &now) {
+  if (packet.GetQuestionCount() != 1 || packet.IsTrucated()) {
+    return;
+  }
+
+  uint8_t responseCode = packet.GetResponseCode();
+  ResponseCache::Pool pool;
+  uint32_t ttl;
+  ttlOffsets.clear();
+
+  if (responseCode == E_NXDOMAIN ||
+      (responseCode == E_NOERROR && packet.GetAnswerCount() == 0)) {
+    // NXDOMAIN or NODATA
+    pool = ResponseCache::Negative;
+    ttl = std::min(packet.GetNegativeTtl(&ttlOffsets),
+                   configReader->negativeCacheMaxTtl);
+  } else if (responseCode == E_NOERROR) {
+    pool = ResponseCache::Positive;
+    ttl = std::min(packet.GetMinTtl(&ttlOffsets), configReader->cacheMaxTtl);
+  } else {
+    return;
+  }
+
+  cache.Insert(ResponseCache::Key(packet.GetKey(), flags), packet.Data(),
+               packet.Size(), ttlOffsets, ttl, now, pool,
+               packet.GetPsuedoHeaderLengthOffset());
+}
+
+bool DnsServer::sendStale(const std::string &key,
+                          std::span<const uint8_t> name, uint16_t id,
+                          const udp::endpoint &endpoint, bool ipv4,
+                          uint16_t udpSize, const std::time_t &now) {
+  UdpSocketData &d = ipv4 ? listener4 : listener6;
+  BytePacketBuffer *out = outBuffer(d);
+  if (!cache.LookupStale(key, name, id, true, now, out)) {
+    return false;
+  }
+
+  fitReply(out, udpSize);
+  LDEBUG << "Answered from stale cache: " << endpoint << std::endl;
+  send(d, out, endpoint);
+  return true;
+}
+
+bool DnsServer::serveStale(PeerRequests::PeerRequestRecord *r,
+                           const std::string &key, const std::time_t &now) {
+  // Each client gets the name back in the case it asked
+  uint8_t name[MAX_WIRE_NAME];
+  std::span<uint8_t> asked(name, r->key.Name().size());
+  std::ranges::copy(r->key.Name(), name);
+  TcpConnection *client = tcpClient;
+  for (auto source = r->Clients(); source; source = source->next) {
+    if (!replyTo(source)) {
+      continue;
     }
-  });
+    QueryKey::RestoreCase(asked, source->nameCase);
+    if (!sendStale(key, asked, source->originalId, source->endpoint,
+                   source->ipv4, source->udpSize, now)) {
+      tcpClient = client;
+      return false;
+    }
+  }
+
+  tcpClient = client;
+  r->staleServed = true;
+  return true;
 }
 
-void DnsServer::updateErrorResponse(DnsPacket &packet, const uint8_t &errCode) {
+void DnsServer::addStaleDeadline(PeerRequests::PeerRequestRecord *r,
+                                 const std::string &key) {
+  timers.Schedule(r->staleDeadline,
+                  std::chrono::milliseconds(configReader->staleDeadline),
+                  [this, r, key]() {
+                    if (!r->staleServed) {
+                      serveStale(r, key, GetNow());
+                    }
+                  });
+}
+
+void DnsServer::updateErrorResponse(DnsPacketView &packet,
+                                    const uint8_t &errCode) {
   packet.SetResponseCode(errCode);
   packet.SetAsQueryResponse();
   packet.SetAsAuthoritativeAnswer(true);
   packet.SetRecursionAvailable(true);
 }
 
-void DnsServer::sendPacket(const DnsPacket &packet,
-                           const udp::endpoint &endpoint, bool ipv4) {
-  BytePacketBuffer responseBuffer;
-  responseBuffer.pos = 0;
+void DnsServer::sendPacket(DnsPacketView &packet,
+                           const udp::endpoint &endpoint, bool ipv4,
+                           uint16_t udpSize) {
+  LDEBUG << "Outgoing packet:: destination: " << endpoint
+         << " Id: " << packet.GetId() << " QC: " << packet.GetQuestionCount()
+         << " AC: " << packet.GetAnswerCount() << std::endl;
+
+  if (tcpClient) { // Whole, it may not fit the packet buffers
+    tcpClient->Send(packet.Data(), packet.Size());
+    return;
+  }
+
+  UdpSocketData &d = ipv4 ? listener4 : listener6;
+  BytePacketBuffer *out = outBuffer(d);
+  if (packet.Size() > udpSize && packet.WriteTruncated(out) == E_NOERROR) {
+    stats.truncated++;
+  } else if (packet.Size() <= out->buf.size()) {
+    std::memcpy(out->buf.data(), packet.Data(), packet.Size());
+    out->pos = packet.Size();
+  } else {
+    LERROR << "Unable to truncate reply to: " << endpoint << std::endl;
+    return;
+  }
+
+  if (!send(d, out, endpoint)) {
+    LERROR << "The problematic packet: " << packet << std::endl;
+  }
+}
+
+// Replies are cut down rather than sent larger than the client asked for,
+// those would be fragmented and fragments often do not make it.
+void DnsServer::fitReply(BytePacketBuffer *out, uint16_t udpSize) {
+  if (out->pos <= udpSize) {
+    return;
+  }
+
+  BytePacketBuffer reply;
+  std::memcpy(reply.buf.data(), out->buf.data(), out->pos);
+  reply.size = out->pos;
+  reply.pos = 0;
+
+  DnsPacketView packet(reply);
+  if (packet.Read() == E_NOERROR && packet.WriteTruncated(out) == E_NOERROR) {
+    stats.truncated++;
+  }
+}
+
+void DnsServer::sendToClients(DnsPacketView &packet,
+                              PeerRequests::PeerRequestRecord *r) {
+  auto clients = r->Clients();
+  if (clients == nullptr) {
+    return;
+  }
+
+  bool shared = false;
+#ifdef __linux
+  // Coalesced clients share one copy of the reply, unless it is too large
+  // for some of them. Clients connected over TCP get their own.
+  bool fits = true;
+  for (auto source = clients; source; source = source->next) {
+    fits = fits && packet.Size() <= source->udpSize;
+  }
+  if (clients->next && packet.GetQuestionCount() == 1 && fits) {
+    sendFanout(packet, r, listener4);
+    sendFanout(packet, r, listener6);
+    shared = true;
+  }
+#endif /* __linux */
+
+  TcpConnection *client = tcpClient;
+  for (auto source = clients; source; source = source->next) {
+    if ((shared && source->connection == 0) || !replyTo(source)) {
+      continue;
+    }
+    packet.SetId(source->originalId);
+    // Clients may have asked in different case
+    QueryKey::RestoreCase(packet.GetQuestionName(), source->nameCase);
+    sendPacket(packet, source->endpoint, source->ipv4, source->udpSize);
+  }
+  tcpClient = client;
+}
+
+void DnsServer::forwardPacket(const DnsPacketView &packet,
+                              PeerRequests::PeerRequestRecord *r) {
+  // Sent as the client sent it, only the ID was changed
+  r->query.assign(packet.Data(), packet.Data() + packet.Size());
+  // Too large for the datagram buffers, it can only go over TCP
+  if (packet.Size() > MAX_PACKET_SZ) {
+    r->overTcp = true;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  r->forwardTime = now;
+  r->attempts = 1;
+
+  if (selector.FanOut()) {
+    for (auto &server : servers) {
+      r->sentTo = server.get();
+      sendQuery(r, server.get());
+    }
+  } else {
+    r->sentTo = selector.Select(now);
+    sendQuery(r, r->sentTo);
+    if (UpstreamServerInfo *other = selector.Explore(r->sentTo)) {
+      sendQuery(r, other);
+    }
+  }
+
+  addRetransmit(r);
+}
+
+void DnsServer::sendQuery(PeerRequests::PeerRequestRecord *r,
+                          UpstreamServerInfo *server) {
+  server->stats.queries++;
+  selector.OnForward(server, std::chrono::steady_clock::now());
+  LDEBUG << "Forwarding request to upstream server: " << server->displayAddress
+         << ":" << server->port << std::endl;
+
+  if (r->overTcp || server->tcp) {
+    if (!tcpUpstreams[server]->Send(r->query.data(), r->query.size())) {
+      LDEBUG << "No TCP connection to upstream server: "
+             << server->displayAddress << std::endl;
+    }
+    return;
+  }
+
+  UdpSocketData &d = server->ipv4 ? upstream4 : upstream6;
+  BytePacketBuffer *out = outBuffer(d);
+  std::memcpy(out->buf.data(), r->query.data(), r->query.size());
+  out->pos = r->query.size();
+  send(d, out, server->endpoint);
+}
+
+void DnsServer::addRetransmit(PeerRequests::PeerRequestRecord *r) {
+  timers.Schedule(r->retransmit,
+                  UpstreamSelector::Rto(r->sentTo, r->attempts - 1),
+                  [this, r]() { retransmit(r); });
+}
+
+void DnsServer::retransmit(PeerRequests::PeerRequestRecord *r) {
+  r->sentTo->stats.timedouts++;
+  if (r->attempts >= configReader->upstreamAttempts) {
+    failQuery(r, GetNow());
+    return;
+  }
+
+  // Same ID, so a late reply to an earlier attempt is still accepted
+  r->sentTo = selector.Failover(r->sentTo, std::chrono::steady_clock::now());
+  r->attempts++;
+  stats.retransmits++;
+  sendQuery(r, r->sentTo);
+  addRetransmit(r);
+}
+
+void DnsServer::failQuery(PeerRequests::PeerRequestRecord *r,
+                          const std::time_t &now) {
+  LDEBUG << "No upstream reply after " << r->attempts << " attempts"
+         << std::endl;
+
+  // Queries asked over TCP may not fit the packet buffers
+  std::memcpy(tcpBuffer.buf.data(), r->query.data(), r->query.size());
+  tcpBuffer.pos = 0;
+  tcpBuffer.size = r->query.size();
+
+  // The query itself becomes the reply
+  DnsPacketView packet(tcpBuffer);
+  if (r->staleServed) {
+    peerRequests.FreePeerRequestRecord(r);
+    return;
+  }
+  if (packet.Read() != E_NOERROR) {
+    dropQuery(r);
+    return;
+  }
+
+  if (cache.Enabled() && !r->key.Empty() &&
+      serveStale(r, ResponseCache::Key(r->key, r->flags), now)) {
+    peerRequests.FreePeerRequestRecord(r);
+    return;
+  }
+
+  if (!(r->flags & PEER_HAS_PSUEDO_HEADER)) {
+    packet.RemovePsuedoHeader();
+  }
+  updateErrorResponse(packet, E_SERVFAIL);
+  sendToClients(packet, r);
+  for (auto source = r->Clients(); source; source = source->next) {
+    stats.servfails++;
+  }
+
+  peerRequests.FreePeerRequestRecord(r);
+}
+
+// Frees a record nobody will get an answer for. Clients over TCP get their
+// pipeline slots back, UDP clients gave up on it long ago.
+void DnsServer::dropQuery(PeerRequests::PeerRequestRecord *r) {
+  TcpConnection *client = tcpClient;
+  for (auto source = r->Clients(); source; source = source->next) {
+    if (source->connection != 0 && replyTo(source)) {
+      noReply();
+    }
+  }
+  tcpClient = client;
+
+  peerRequests.FreePeerRequestRecord(r);
+}
 
-  int res = packet.Write(&responseBuffer);
+void DnsServer::sendResponse(const DnsPacketView &request,
+                             const udp::endpoint &endpoint, UdpSocketData &d,
+                             BytePacketBuffer *out, int res) {
   if (res != E_NOERROR) {
-    LERROR << "Unable to write data to response buffer: " << res << std::endl;
+    LERROR << "Unable to write response to: " << request << std::endl;
+    noReply();
     return;
   }
 
-  // DumpHex(responseBuffer.buf, responseBuffer.pos);
   LDEBUG << "Outgoing packet:: destination: " << endpoint
-         << " Id: " << packet.GetId() << " QC: " << packet.GetQuestionCount()
-         << " AC: " << packet.GetAnswerCount() << std::endl;
-  boost::system::error_code ec;
-  if (ipv4) {
-    socket4.send_to(boost::asio::buffer(responseBuffer.buf, responseBuffer.pos),
-                    endpoint, 0, ec);
-  } else {
-    socket6.send_to(boost::asio::buffer(responseBuffer.buf, responseBuffer.pos),
-                    endpoint, 0, ec);
+         << " Id: " << request.GetId() << " Size: " << out->pos << std::endl;
+
+  send(d, out, endpoint);
+}
+
+BytePacketBuffer *DnsServer::outBuffer(UdpSocketData &d) {
+#ifdef __linux
+  if (batching && d.out && !(tcpClient && !d.upstream)) {
+    if (d.out->count == d.out->Capacity()) {
+      flush(d);
+    }
+    return &d.out->buffers[d.out->count];
   }
+#endif /* __linux */
 
+  return &sendBuffer;
+}
+
+bool DnsServer::send(UdpSocketData &d, BytePacketBuffer *out,
+                     const udp::endpoint &endpoint) {
+  if (tcpClient && !d.upstream) { // Goes back the way the query came
+    tcpClient->Send(out->buf.data(), out->pos);
+    return true;
+  }
+
+#ifdef __linux
+  if (out != &sendBuffer) {
+    // Sent with the rest of the batch by flush()
+    d.out->endpoints[d.out->count++] = endpoint;
+    return true;
+  }
+#endif /* __linux */
+
+  boost::system::error_code ec;
+  d.socket.send_to(boost::asio::buffer(out->buf, out->pos), endpoint, 0, ec);
   if (ec) {
     LERROR << "Error sending packet data: " << ec.message() << std::endl;
-    LERROR << "The problematic packet: " << packet << std::endl;
+    return false;
   }
+
+  return true;
 }
-void DnsServer::receive4() {
-  socket4.async_receive_from(
-      boost::asio::buffer(recvBuffer4.buf), endpoint4,
-      [this](boost::system::error_code ec, std::size_t n) {
-        receive(ec, n, true);
-        receive4();
+
+void DnsServer::receive(UdpSocketData *d) {
+#ifdef __linux
+  if (d->in) {
+    receiveBatch(d);
+    return;
+  }
+#endif /* __linux */
+
+  d->socket.async_receive_from(
+      boost::asio::buffer(d->recvBuffer.buf), d->endpoint,
+      [this, d](boost::system::error_code ec, std::size_t n) {
+        if (ec == boost::asio::error::operation_aborted) {
+          return;
+        }
+
+        receive(ec, n, d);
+        receive(d);
       });
 }
 
-void DnsServer::receive6() {
-  socket6.async_receive_from(
-      boost::asio::buffer(recvBuffer6.buf), endpoint6,
-      [this](boost::system::error_code ec, std::size_t n) {
-        receive(ec, n, false);
-        receive6();
-      });
+#ifdef __linux
+void DnsServer::receiveBatch(UdpSocketData *d) {
+  UdpBatch &b = *d->in;
+
+  // Sockets are edge triggered in the reactor so keep reading until the
+  // kernel has nothing left before waiting again. Give other sockets a turn
+  // after a few full batches.
+  for (int round = 0; round < MAX_BATCH_ROUNDS; round++) {
+    for (std::size_t i = 0; i < b.Capacity(); i++) {
+      b.iovecs[i].iov_base = b.buffers[i].buf.data();
+      b.iovecs[i].iov_len = b.buffers[i].buf.size();
+      b.headers[i].msg_hdr = {};
+      b.headers[i].msg_hdr.msg_name = b.endpoints[i].data();
+      b.headers[i].msg_hdr.msg_namelen = b.endpoints[i].capacity();
+      b.headers[i].msg_hdr.msg_iov = &b.iovecs[i];
+      b.headers[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int n = recvmmsg(d->socket.native_handle(), b.headers.data(),
+                     b.Capacity(), MSG_DONTWAIT, nullptr);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        LERROR << "Error calling recvmmsg [" << d->ipv4
+               << "]: " << strerror(errno) << std::endl;
+      }
+
+      d->socket.async_wait(udp::socket::wait_read,
+                           [this, d](boost::system::error_code ec) {
+                             if (ec == boost::asio::error::operation_aborted) {
+                               return;
+                             }
+                             if (ec) {
+                               LERROR << "Error waiting for data ["
+                                      << d->ipv4 << "]: " << ec.message()
+                                      << std::endl;
+                             }
+                             receiveBatch(d);
+                           });
+      return;
+    }
+
+    stats.receiveBatches++;
+    stats.received += n;
+
+    batching = true;
+    for (int i = 0; i < n; i++) {
+      b.endpoints[i].resize(b.headers[i].msg_hdr.msg_namelen);
+      processDatagram(b.buffers[i], b.endpoints[i], b.headers[i].msg_len, d);
+    }
+    batching = false;
+    flushAll();
+  }
+
+  boost::asio::post(d->socket.get_executor(), [this, d]() {
+    if (d->socket.is_open()) {
+      receiveBatch(d);
+    }
+  });
+}
+
+void DnsServer::flush(UdpSocketData &d) {
+  UdpBatch &b = *d.out;
+  if (b.count == 0) {
+    return;
+  }
+
+  for (std::size_t i = 0; i < b.count; i++) {
+    b.iovecs[i].iov_base = b.buffers[i].buf.data();
+    b.iovecs[i].iov_len = b.buffers[i].pos;
+    b.headers[i].msg_hdr = {};
+    b.headers[i].msg_hdr.msg_name = b.endpoints[i].data();
+    b.headers[i].msg_hdr.msg_namelen = b.endpoints[i].size();
+    b.headers[i].msg_hdr.msg_iov = &b.iovecs[i];
+    b.headers[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  std::size_t done = 0;
+  while (done < b.count) {
+    int n = sendmmsg(d.socket.native_handle(), &b.headers[done],
+                     b.count - done, MSG_DONTWAIT);
+    if (n <= 0) {
+      break;
+    }
+    stats.sendBatches++;
+    done += n;
+  }
+
+  // Socket buffer is full or the batch was rejected, send the remaining
+  // datagrams one at a time.
+  for (; done < b.count; done++) {
+    boost::system::error_code ec;
+    d.socket.send_to(boost::asio::buffer(b.buffers[done].buf,
+                                         b.buffers[done].pos),
+                     b.endpoints[done], 0, ec);
+    if (ec) {
+      LERROR << "Error sending packet data: " << ec.message() << std::endl;
+    }
+  }
+
+  stats.sent += b.count;
+  b.count = 0;
+}
+
+void DnsServer::flushAll() {
+  for (UdpSocketData *d : {&listener4, &listener6, &upstream4, &upstream6}) {
+    flush(*d);
+  }
+}
+
+void DnsServer::sendFanout(const DnsPacketView &packet,
+                           PeerRequests::PeerRequestRecord *r,
+                           UdpSocketData &d) {
+  UdpFanout &f = fanout;
+  std::span<const uint8_t> name = packet.GetQuestionName();
+  uint8_t *data = const_cast<uint8_t *>(packet.Data());
+  std::size_t nameStart = name.data() - data;
+  std::size_t nameEnd = nameStart + name.size();
+
+  for (auto source = r->Clients(); source; source = source->next) {
+    if (source->ipv4 != d.ipv4 || source->connection != 0) {
+      continue;
+    }
+
+    std::size_t i = f.count;
+    f.ids[i] = {uint8_t(source->originalId >> 8),
+                uint8_t(source->originalId & 0xff)};
+    std::ranges::copy(name, f.names[i].begin());
+    // Clients may have asked in different case
+    QueryKey::RestoreCase(std::span<uint8_t>(f.names[i].data(), name.size()),
+                          source->nameCase);
+    f.endpoints[i] = source->endpoint;
+
+    iovec *v = &f.iovecs[i * FANOUT_IOVECS];
+    v[0] = {f.ids[i].data(), 2};
+    v[1] = {data + 2, nameStart - 2};
+    v[2] = {f.names[i].data(), name.size()};
+    v[3] = {data + nameEnd, packet.Size() - nameEnd};
+    f.headers[i].msg_hdr = {};
+    f.headers[i].msg_hdr.msg_name = f.endpoints[i].data();
+    f.headers[i].msg_hdr.msg_namelen = f.endpoints[i].size();
+    f.headers[i].msg_hdr.msg_iov = v;
+    f.headers[i].msg_hdr.msg_iovlen = FANOUT_IOVECS;
+
+    if (++f.count == FANOUT_SIZE) {
+      flushFanout(d);
+    }
+  }
+
+  flushFanout(d);
+}
+
+void DnsServer::flushFanout(UdpSocketData &d) {
+  UdpFanout &f = fanout;
+  if (f.count == 0) {
+    return;
+  }
+
+  LDEBUG << "Sending reply to " << f.count << " clients" << std::endl;
+
+  std::size_t done = 0;
+  while (done < f.count) {
+    int n = sendmmsg(d.socket.native_handle(), &f.headers[done],
+                     f.count - done, MSG_DONTWAIT);
+    if (n <= 0) {
+      break;
+    }
+    stats.sendBatches++;
+    done += n;
+  }
+
+  // Same as flush(), whatever the socket did not take goes one at a time
+  for (; done < f.count; done++) {
+    if (sendmsg(d.socket.native_handle(), &f.headers[done].msg_hdr, 0) < 0) {
+      LERROR << "Error sending packet data: " << strerror(errno)
+             << std::endl;
+    }
+  }
+
+  stats.fanouts++;
+  stats.fanoutClients += f.count;
+  stats.sent += f.count;
+  f.count = 0;
+}
+#endif /* __linux */
+
+void DnsServer::scheduleStats() {
+  if (configReader->statsInterval == 0) {
+    return;
+  }
+
+  statsTimer.expires_after(std::chrono::seconds(configReader->statsInterval));
+  statsTimer.async_wait([this](boost::system::error_code ec) {
+    if (ec) {
+      return;
+    }
+
+    logStats();
+    scheduleStats();
+  });
+}
+
+void DnsServer::logStats() const {
+  if (stats.receiveBatches > 0) {
+    LINFO << "Receive batches: " << stats.receiveBatches
+          << ", datagrams: " << stats.received << ", average fill: "
+          << (double)stats.received / stats.receiveBatches << std::endl;
+  }
+
+  if (stats.sendBatches > 0) {
+    LINFO << "Send batches: " << stats.sendBatches
+          << ", datagrams: " << stats.sent << ", average fill: "
+          << (double)stats.sent / stats.sendBatches << std::endl;
+  }
+
+  if (cache.Enabled()) {
+    LINFO << "Cache entries: " << cache.Count(ResponseCache::Positive)
+          << ", bytes: " << cache.Used(ResponseCache::Positive)
+          << ", negative entries: " << cache.Count(ResponseCache::Negative)
+          << ", negative bytes: " << cache.Used(ResponseCache::Negative)
+          << ", hits: " << cache.stats.hits
+          << ", negative hits: " << cache.stats.negativeHits
+          << ", stale hits: " << cache.stats.staleHits
+          << ", misses: " << cache.stats.misses
+          << ", evictions: " << cache.stats.evictions << std::endl;
+  }
+
+  if (stats.fanouts > 0) {
+    LINFO << "Replies shared by coalesced clients: " << stats.fanouts
+          << ", clients: " << stats.fanoutClients << std::endl;
+  }
+
+  if (stats.truncated > 0) {
+    LINFO << "Replies truncated to the client's UDP payload size: "
+          << stats.truncated << std::endl;
+  }
+
+  if (stats.tcpAccepted > 0 || stats.tcpRefused > 0) {
+    LINFO << "TCP connections accepted: " << stats.tcpAccepted
+          << ", refused at limit: " << stats.tcpRefused
+          << ", open: " << tcpConnections.size()
+          << ", queries: " << stats.tcpQueries << std::endl;
+  }
+
+  if (stats.tcpRetries > 0) {
+    LINFO << "Truncated upstream replies asked again over TCP: "
+          << stats.tcpRetries << std::endl;
+  }
+
+  if (stats.retransmits > 0 || stats.servfails > 0) {
+    LINFO << "Upstream retransmits: " << stats.retransmits
+          << ", queries failed with SERVFAIL: " << stats.servfails
+          << std::endl;
+  }
+
+  if (stats.redirected > 0 || stats.rejected > 0 || stats.dropped > 0) {
+    LINFO << "Rule actions:: redirected: " << stats.redirected
+          << ", rejected: " << stats.rejected << ", dropped: " << stats.dropped
+          << std::endl;
+  }
+
+  if (stats.prefetches > 0 || stats.prefetchesSkipped > 0) {
+    LINFO << "Prefetches: " << stats.prefetches
+          << ", skipped at concurrency limit: " << stats.prefetchesSkipped
+          << std::endl;
+  }
+
+  for (auto &server : servers) {
+    LINFO << "Upstream server " << server->displayAddress
+          << ":: queries: " << server->stats.queries
+          << ", replies: " << server->stats.replies
+          << ", invalids: " << server->stats.invalids
+          << ", nosources: " << server->stats.nosources
+          << ", timeouts: " << server->stats.timedouts
+          << ", failed: " << server->stats.failed
+          << ", rtt: " << server->stats.rtt << "us" << std::endl;
+
+    const TcpUpstream &t = *tcpUpstreams.at(server.get());
+    if (t.stats.queries > 0) {
+      std::ostringstream details;
+      details << "in flight:";
+      for (unsigned int n : t.InFlight()) {
+        details << " " << n;
+      }
+      details << " (max " << t.stats.maxInFlight << ")";
+      if (t.Tls()) {
+        details << ", handshakes: " << t.stats.handshakes
+                << ", resumed: " << t.stats.resumed;
+      }
+
+      LINFO << "Upstream server " << server->displayAddress
+            << (t.Tls() ? " over TLS" : " over TCP")
+            << ":: queries: " << t.stats.queries
+            << ", replies: " << t.stats.replies
+            << ", connects: " << t.stats.connects
+            << ", failed connects: " << t.stats.failures
+            << ", open: " << t.Open() << ", " << details.str() << std::endl;
+    }
+  }
+}
+
+// Largest reply a client takes over UDP (RFC 6891 section 6.2.5), over TCP
+// any reply fits
+uint16_t DnsServer::clientUdpSize(DnsPacketView &packet) const {
+  if (tcpClient) {
+    return PACKET_SZ_MAX;
+  }
+  // Replies over TCP may be larger than the datagram buffers
+  return std::clamp<uint16_t>(packet.GetUdpPayloadSize(), PACKETSZ,
+                              MAX_PACKET_SZ);
 }
 
 static void addSource(PeerRequests::PeerRequestRecord::PeerSource *s,
-                      const DnsPacket &packet, const udp::endpoint &endpoint,
-                      const bool &ipv4) {
+                      DnsPacketView &packet, const udp::endpoint &endpoint,
+                      const bool &ipv4, uint16_t udpSize,
+                      uint64_t connection) {
   s->originalId = packet.GetId();
   s->endpoint = endpoint;
   s->ipv4 = ipv4;
+  s->udpSize = udpSize;
+  s->connection = connection;
+  std::memcpy(s->nameCase, packet.GetNameCase(), NAME_CASE_SIZE);
 }
 
-void DnsServer::resolve(DnsPacket &packet, const udp::endpoint &endpoint,
+void DnsServer::resolve(DnsPacketView &packet, const udp::endpoint &endpoint,
                         bool ipv4) {
   if (servers.empty()) {
     LWARNING << "No upstream server found: " << packet << std::endl;
+    noReply();
     return;
   }
 
   using namespace boost::asio::ip;
   const std::time_t now = GetNow();
 
-  unsigned int fwdFlags = 0;
-
-  uint8_t digest[SHA256_BLOCK_SIZE];
-  packet.Hash(digest);
+  unsigned int fwdFlags =
+      (packet.HasCheckingDisabled() ? PEER_CHECKING_DISABLED : 0) |
+      (packet.HasPsuedoHeader() ? PEER_HAS_PSUEDO_HEADER : 0) |
+      (packet.HasDoBit() ? PEER_DNSSEC_OK : 0);
+
+  std::string key;
+  bool prefetch = false;
+  uint64_t connection = tcpClient ? tcpClient->Id() : 0;
+  if (cache.Enabled() && packet.GetQuestionCount() == 1) {
+    key = ResponseCache::Key(packet.GetKey(), fwdFlags);
+    UdpSocketData &d = ipv4 ? listener4 : listener6;
+    BytePacketBuffer *out = outBuffer(d);
+    if (cache.Lookup(key, packet.GetQuestionName(), packet.GetId(),
+                     packet.IsRecursionDesired(), now, out, &prefetch)) {
+      LDEBUG << "Answered from cache: " << packet.GetKey() << std::endl;
+      fitReply(out, clientUdpSize(packet));
+      send(d, out, endpoint);
+
+      if (!prefetch) {
+        return;
+      }
+      if (peerRequests.Prefetches() >= configReader->prefetchConcurrency) {
+        stats.prefetchesSkipped++;
+        return;
+      }
+      // Carry on without a client to refresh the entry before it expires
+    }
+  }
 
   auto r = peerRequests.LookupByQuery(
-      digest, fwdFlags,
-      PEER_CHECKING_DISABLED | PEER_AD_QUESTION | PEER_HAS_PSUEDO_HEADER);
+      packet.GetKey(), fwdFlags,
+      PEER_CHECKING_DISABLED | PEER_AD_QUESTION | PEER_HAS_PSUEDO_HEADER |
+          PEER_DNSSEC_OK);
+
+  if (r && prefetch) { // Already on its way
+    return;
+  }
+
+  if (r && r->staleServed && !key.empty() &&
+      sendStale(key, packet.GetQuestionName(), packet.GetId(), endpoint, ipv4,
+                clientUdpSize(packet), now)) {
+    // Upstream already missed the deadline for this query
+    return;
+  }
+
+  if (r && r->HasTimedOut(now)) {
+    // Nobody is waiting for this one anymore
+    dropQuery(r);
+    r = nullptr;
+  }
 
   if (r) { // A upstream query for this already exists
-    if (!r->HasTimedOut()) {
-      auto s = &r->source;
-      for (; s; s = s->next.get()) {
-        if (s->ipv4 == ipv4 && s->originalId == packet.GetId() &&
-            s->endpoint == endpoint) {
-          break;
-        }
+    auto s = &r->source;
+    for (; s; s = s->next) {
+      if (s->ipv4 == ipv4 && s->originalId == packet.GetId() &&
+          s->endpoint == endpoint && s->connection == connection) {
+        break;
       }
+    }
 
-      if (s) { // This is repeat from client while another is in progress
-        LDEBUG << "Repeat query from client: " << endpoint << std::endl;
-        if (difftime(now, r->time) < 2) {
-          LWARNING << "Repeate query within 2 seconds. Skipping" << std::endl;
-          packet.SetResponseCode(E_REFUSED);
-          sendPacket(packet, endpoint, ipv4);
-        }
-
-        return;
+    if (s) { // This is repeat from client while another is in progress
+      LDEBUG << "Repeat query from client: " << endpoint << std::endl;
+      if (difftime(now, r->time) < 2) {
+        LWARNING << "Repeate query within 2 seconds. Skipping" << std::endl;
+        packet.SetResponseCode(E_REFUSED);
+        sendPacket(packet, endpoint, ipv4, clientUdpSize(packet));
       } else {
-        s = peerRequests.GetNewPeerSource(now);
+        noReply();
+      }
 
-        if (!s) { // Refuse the packet since we are maxed out
-          packet.SetResponseCode(E_REFUSED);
-          sendPacket(packet, endpoint, ipv4);
-        } else {
-          s->next = std::move(r->source.next);
-          r->source.next =
-              std::unique_ptr<PeerRequests::PeerRequestRecord::PeerSource>(s);
-          addSource(s, packet, endpoint, ipv4);
-        }
+      return;
+    } else {
+      s = peerRequests.GetNewPeerSource(now);
 
-        return;
+      if (!s) { // Refuse the packet since we are maxed out
+        packet.SetResponseCode(E_REFUSED);
+        sendPacket(packet, endpoint, ipv4, clientUdpSize(packet));
+      } else {
+        s->next = r->source.next;
+        r->source.next = s;
+        addSource(s, packet, endpoint, ipv4, clientUdpSize(packet),
+                  connection);
       }
-    } else {
-      peerRequests.FreePeerRequestRecord(r);
+
+      return;
     }
-  } else {
-    r = peerRequests.GetNewRecord(now, false);
-    if (!r) {
-      packet.SetResponseCode(E_REFUSED);
-      sendPacket(packet, endpoint, ipv4);
+  }
+
+  r = peerRequests.GetNewRecord(now, packet.GetKey(), fwdFlags);
+  if (!r) {
+    if (prefetch) {
+      return;
+    }
+    if (!key.empty() &&
+        sendStale(key, packet.GetQuestionName(), packet.GetId(), endpoint,
+                  ipv4, clientUdpSize(packet), now)) {
       return;
     }
+    packet.SetResponseCode(E_REFUSED);
+    sendPacket(packet, endpoint, ipv4, clientUdpSize(packet));
+    return;
+  }
 
-    addSource(&r->source, packet, endpoint, ipv4);
-    r->newId = peerRequests.GetNewId();
-    std::memcpy(r->hash, digest, HASH_SIZE);
-    packet.SetId(r->newId);
-    r->flags = fwdFlags;
+  addSource(&r->source, packet, endpoint, ipv4, clientUdpSize(packet),
+            connection);
+  packet.SetId(r->newId);
+  // Upstream replies are sized for the link to the upstream, clients get
+  // them cut down to their own size. Queries without EDNS get a psuedo
+  // header of ours, it is taken off the reply again.
+  packet.SetUdpPayloadSize(configReader->upstreamEdnsSize);
+  packet.AddPsuedoHeader(configReader->upstreamEdnsSize);
+  if (prefetch) {
+    peerRequests.StartPrefetch(r);
+    stats.prefetches++;
   }
 
-  for (auto &server : servers) {
-    r->sentTo = server.get();
-    server->stats.queries++;
-    LINFO << "Forwarding request to upstream server: " << server->displayAddress
-          << ":" << server->port << std::endl;
-    sendPacket(packet, server->endpoint, server->ipv4);
+  forwardPacket(packet, r);
+
+  if (!key.empty() && cache.HasStale(key, now)) {
+    addStaleDeadline(r, key);
   }
 }
 
-void DnsServer::Resolve(DnsPacket *p, const udp::endpoint *e, const bool i) {
+void DnsServer::Resolve(DnsPacketView *p, const udp::endpoint *e,
+                        const bool i) {
   resolve(*p, *e, i);
 }
 
-void DnsServer::Redirect(DnsPacket *p, const udp::endpoint *e, const bool i,
-                         const union IpAddress &target) {
-  updateRedirectResponse(*p, target);
-  sendPacket(*p, *e, i);
+void DnsServer::Redirect(DnsPacketView *p, const udp::endpoint *e,
+                         const bool i, const union IpAddress &target) {
+  stats.redirected++;
+  UdpSocketData &d = i ? listener4 : listener6;
+  BytePacketBuffer *out = outBuffer(d);
+  sendResponse(*p, *e, d, out, responder.Redirect(*p, target, out));
+}
+
+void DnsServer::Reject(DnsPacketView *p, const udp::endpoint *e, const bool i,
+                       const uint8_t responseCode) {
+  stats.rejected++;
+  UdpSocketData &d = i ? listener4 : listener6;
+  BytePacketBuffer *out = outBuffer(d);
+  sendResponse(*p, *e, d, out, responder.Reject(*p, responseCode, out));
+}
+
+void DnsServer::Drop(DnsPacketView *p, const udp::endpoint *e) {
+  stats.dropped++;
+  noReply();
+  LDEBUG << "Dropping query " << p->GetId() << " from: " << *e << std::endl;
 }
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "dns/tcpconnection.hpp"
+#include "log.hpp"
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+std::span<uint8_t> TcpFramer::Free() {
+  if (start > 0) {
+    std::memmove(buf.data(), buf.data() + start, end - start);
+    end -= start;
+    start = 0;
+  }
+
+  std::size_t needed = TCP_BUFFER_SIZE;
+  if (end >= 2) {
+    needed = std::max(needed, 2 + (std::size_t(buf[0]) << 8 | buf[1]));
+  }
+  // Back to the usual size once the large message is gone
+  if (needed > buf.size() || (end == 0 && buf.size() > TCP_BUFFER_SIZE)) {
+    buf.resize(needed);
+    buf.shrink_to_fit();
+  }
+
+  return std::span<uint8_t>(buf.data() + end, buf.size() - end);
+}
+
+void TcpFramer::Commit(std::size_t n) { end += n; }
+
+bool TcpFramer::Next(std::span<const uint8_t> &message) {
+  if (end - start < 2) {
+    return false;
+  }
+
+  std::size_t len = std::size_t(buf[start]) << 8 | buf[start + 1];
+  if (end - start < 2 + len) {
+    return false;
+  }
+
+  message = std::span<const uint8_t>(buf.data() + start + 2, len);
+  start += 2 + len;
+  return true;
+}
+
+TcpConnection::TcpConnection(tcp::socket socket, uint64_t id,
+                             TimerWheel &timers,
+                             std::chrono::milliseconds idleTimeout,
+                             QueryHandler onQuery, CloseHandler onClose)
+    : socket(std::move(socket)), id(id), endpoint{}, ipv4(true),
+      timers(timers), idleTimeout(idleTimeout), onQuery(std::move(onQuery)),
+      onClose(std::move(onClose)), inFlight(0), reading(false),
+      paused(false), closed(false) {
+  boost::system::error_code ec;
+  tcp::endpoint remote = this->socket.remote_endpoint(ec);
+  if (!ec) {
+    endpoint = udp::endpoint(remote.address(), remote.port());
+    ipv4 = remote.address().is_v4();
+  }
+}
+
+void TcpConnection::Start() {
+  touch();
+  receive();
+}
+
+void TcpConnection::receive() {
+  // Queries read along with earlier ones go first
+  std::span<const uint8_t> message;
+  while (inFlight < TCP_PIPELINE && framer.Next(message)) {
+    inFlight++;
+    onQuery(*this, message);
+    if (closed) {
+      return;
+    }
+  }
+
+  if (inFlight >= TCP_PIPELINE) { // Until replies went out
+    paused = true;
+    return;
+  }
+
+  if (reading) {
+    return;
+  }
+
+  reading = true;
+  std::span<uint8_t> free = framer.Free();
+  socket.async_read_some(
+      boost::asio::buffer(free.data(), free.size()),
+      [self = shared_from_this()](boost::system::error_code ec,
+                                  std::size_t n) {
+        self->reading = false;
+        if (self->closed) {
+          return;
+        }
+
+        if (ec) { // Closed by the client, or reset
+          self->Close();
+          return;
+        }
+
+        self->framer.Commit(n);
+        self->touch();
+        self->receive();
+      });
+}
+
+void TcpConnection::resume() {
+  if (!paused || inFlight >= TCP_PIPELINE) {
+    return;
+  }
+
+  // Not from within Send(), the server is still busy with the reply
+  paused = false;
+  boost::asio::post(socket.get_executor(), [self = shared_from_this()]() {
+    if (!self->closed) {
+      self->receive();
+    }
+  });
+}
+
+void TcpConnection::Send(const uint8_t *data, std::size_t size) {
+  if (closed) {
+    return;
+  }
+
+  if (queued.size() + 2 + size > TCP_MAX_QUEUED) {
+    LDEBUG << "Client does not read its replies over TCP: " << endpoint
+           << std::endl;
+    Close();
+    return;
+  }
+
+  queued.push_back(uint8_t(size >> 8));
+  queued.push_back(uint8_t(size & 0xff));
+  queued.insert(queued.end(), data, data + size);
+
+  if (writing.empty()) {
+    write();
+  }
+  Unanswered();
+}
+
+void TcpConnection::Unanswered() {
+  if (inFlight > 0) {
+    inFlight--;
+  }
+  resume();
+}
+
+void TcpConnection::write() {
+  // Everything queued meanwhile goes out with one write
+  std::swap(writing, queued);
+  boost::asio::async_write(
+      socket, boost::asio::buffer(writing),
+      [self = shared_from_this()](boost::system::error_code ec, std::size_t) {
+        self->writing.clear();
+        if (self->closed) {
+          return;
+        }
+
+        if (ec) {
+          LDEBUG << "Error writing to TCP client " << self->endpoint << ": "
+                 << ec.message() << std::endl;
+          self->Close();
+          return;
+        }
+
+        self->touch();
+        if (!self->queued.empty()) {
+          self->write();
+        }
+      });
+}
+
+// Connections are closed once they go without traffic for the idle timeout
+// (RFC 7766 section 6.2.3), including those whose queries all went
+// unanswered.
+void TcpConnection::touch() {
+  timers.Schedule(idle, idleTimeout, [this]() {
+    LDEBUG << "Closing idle TCP connection: " << endpoint << std::endl;
+    auto self = shared_from_this();
+    Close();
+  });
+}
+
+void TcpConnection::Close() {
+  if (closed) {
+    return;
+  }
+
+  closed = true;
+  idle.Cancel();
+  boost::system::error_code ec;
+  socket.shutdown(tcp::socket::shutdown_both, ec);
+  socket.close(ec);
+  onClose(*this);
+}
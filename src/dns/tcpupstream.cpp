@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "dns/tcpupstream.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <boost/asio/ssl/host_name_verification.hpp>
+#include <boost/asio/ssl/stream.hpp>
+#include <boost/asio/write.hpp>
+#include <utility>
+
+// Slot of the pool in the SSL objects of its connections, the session
+// callback only gets those
+static int poolIndex() {
+  static const int index =
+      SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+  return index;
+}
+
+// One connection of the pool. Queries sent while it is being opened are
+// written once it is up. Handlers only touch the pool while it is open,
+// the pool closes every connection when it goes.
+class TcpUpstream::Connection
+    : public std::enable_shared_from_this<Connection> {
+public:
+  Connection(TcpUpstream &pool)
+      : pool(pool), socket(pool.ioContext), inFlight(0), connected(false),
+        closed(false) {
+    if (pool.tls) {
+      tls = std::make_unique<boost::asio::ssl::stream<tcp::socket &>>(
+          socket, *pool.tls);
+    }
+  }
+
+  void Connect();
+  void Send(const uint8_t *data, std::size_t size);
+  void Close();
+
+  bool Closed() const { return closed; }
+  unsigned int InFlight() const { return inFlight; }
+
+private:
+  void handshake();
+  void ready();
+  void receive();
+  void write();
+  void touch();
+
+  // Same calls with and without TLS
+  template <typename Handler> void readSome(std::span<uint8_t> b, Handler h) {
+    if (tls) {
+      tls->async_read_some(boost::asio::buffer(b.data(), b.size()), h);
+    } else {
+      socket.async_read_some(boost::asio::buffer(b.data(), b.size()), h);
+    }
+  }
+  template <typename Handler> void writeAll(Handler h) {
+    if (tls) {
+      boost::asio::async_write(*tls, boost::asio::buffer(writing), h);
+    } else {
+      boost::asio::async_write(socket, boost::asio::buffer(writing), h);
+    }
+  }
+
+  TcpUpstream &pool;
+  tcp::socket socket;
+  std::unique_ptr<boost::asio::ssl::stream<tcp::socket &>> tls;
+  TimerWheel::Timer idle;
+  TcpFramer framer;
+  // Queries being written and those queued behind them, length prefixed
+  std::vector<uint8_t> writing;
+  std::vector<uint8_t> queued;
+  // Queries written and not answered yet
+  unsigned int inFlight;
+  bool connected;
+  bool closed;
+};
+
+void TcpUpstream::Connection::Connect() {
+  // Bounds the time the connection and handshake may take
+  touch();
+  socket.async_connect(
+      pool.endpoint,
+      [self = shared_from_this()](boost::system::error_code ec) {
+        if (self->closed) {
+          return;
+        }
+
+        if (ec) {
+          LDEBUG << "Unable to connect to upstream server "
+                 << self->pool.endpoint << ": " << ec.message() << std::endl;
+          self->pool.failed();
+          self->Close();
+          return;
+        }
+
+        boost::system::error_code ignored;
+        self->socket.set_option(tcp::no_delay(true), ignored);
+        if (self->tls) {
+          self->handshake();
+        } else {
+          self->ready();
+        }
+      });
+}
+
+void TcpUpstream::Connection::handshake() {
+  SSL *ssl = tls->native_handle();
+  SSL_set_ex_data(ssl, poolIndex(), &pool);
+  // Skips the key exchange and certificate when the server still knows it
+  if (pool.session) {
+    SSL_set_session(ssl, pool.session);
+  }
+
+  // Strict privacy profile (RFC 8310 section 8.1), the name or address of
+  // the server has to be in its certificate
+  std::string name =
+      pool.tlsName.empty() ? pool.endpoint.address().to_string() : pool.tlsName;
+  if (!pool.tlsName.empty()) {
+    SSL_set_tlsext_host_name(ssl, pool.tlsName.c_str());
+  }
+  tls->set_verify_mode(boost::asio::ssl::verify_peer);
+  tls->set_verify_callback(boost::asio::ssl::host_name_verification(name));
+
+  tls->async_handshake(
+      boost::asio::ssl::stream_base::client,
+      [self = shared_from_this()](boost::system::error_code ec) {
+        if (self->closed) {
+          return;
+        }
+
+        if (ec) {
+          LDEBUG << "TLS handshake with upstream server "
+                 << self->pool.endpoint << " failed: " << ec.message()
+                 << std::endl;
+          self->pool.failed();
+          self->Close();
+          return;
+        }
+
+        if (SSL_session_reused(self->tls->native_handle())) {
+          self->pool.stats.resumed++;
+        } else {
+          self->pool.stats.handshakes++;
+        }
+        self->ready();
+      });
+}
+
+void TcpUpstream::Connection::ready() {
+  connected = true;
+  pool.connected();
+  touch();
+  receive();
+  if (!queued.empty()) {
+    write();
+  }
+}
+
+void TcpUpstream::Connection::Send(const uint8_t *data, std::size_t size) {
+  queued.push_back(uint8_t(size >> 8));
+  queued.push_back(uint8_t(size & 0xff));
+  queued.insert(queued.end(), data, data + size);
+  pool.stats.maxInFlight = std::max(pool.stats.maxInFlight, ++inFlight);
+
+  if (connected && writing.empty()) {
+    write();
+  }
+}
+
+void TcpUpstream::Connection::receive() {
+  readSome(framer.Free(), [self = shared_from_this()](
+                              boost::system::error_code ec, std::size_t n) {
+    if (self->closed) {
+      return;
+    }
+
+    if (ec) { // Servers close connections they consider idle
+      if (self->inFlight > 0) {
+        LDEBUG << "Upstream server " << self->pool.endpoint
+               << " closed the connection with " << self->inFlight
+               << " queries unanswered" << std::endl;
+      }
+      self->Close();
+      return;
+    }
+
+    self->framer.Commit(n);
+    std::span<const uint8_t> reply;
+    while (self->framer.Next(reply)) {
+      self->pool.stats.replies++;
+      self->pool.onReply(reply);
+      if (self->inFlight > 0) {
+        self->inFlight--;
+      }
+      if (self->closed) {
+        return;
+      }
+    }
+
+    self->touch();
+    self->receive();
+  });
+}
+
+void TcpUpstream::Connection::write() {
+  // Everything queued meanwhile goes out with one write
+  std::swap(writing, queued);
+  writeAll([self = shared_from_this()](boost::system::error_code ec,
+                                       std::size_t) {
+    self->writing.clear();
+    if (self->closed) {
+      return;
+    }
+
+    if (ec) {
+      LDEBUG << "Error writing to upstream server " << self->pool.endpoint
+             << ": " << ec.message() << std::endl;
+      self->Close();
+      return;
+    }
+
+    self->touch();
+    if (!self->queued.empty()) {
+      self->write();
+    }
+  });
+}
+
+void TcpUpstream::Connection::touch() {
+  auto timeout = connected ? pool.idleTimeout : pool.connectTimeout;
+  pool.timers.Schedule(idle, timeout, [this]() {
+    auto self = shared_from_this();
+    if (!connected) {
+      LDEBUG << "Timed out connecting to upstream server " << pool.endpoint
+             << std::endl;
+      pool.failed();
+    }
+    Close();
+  });
+}
+
+void TcpUpstream::Connection::Close() {
+  if (closed) {
+    return;
+  }
+
+  closed = true;
+  idle.Cancel();
+  if (tls) { // Sessions arriving from now on are of no use
+    SSL_set_ex_data(tls->native_handle(), poolIndex(), nullptr);
+    // Without close_notify OpenSSL takes the session of the connection,
+    // the one the pool holds, as no longer resumable
+    if (connected) {
+      SSL_set_shutdown(tls->native_handle(),
+                       SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    }
+  }
+  boost::system::error_code ec;
+  socket.shutdown(tcp::socket::shutdown_both, ec);
+  socket.close(ec);
+}
+
+TcpUpstream::TcpUpstream(boost::asio::io_context &ioContext,
+                         TimerWheel &timers, const tcp::endpoint &endpoint,
+                         unsigned int size,
+                         std::chrono::milliseconds idleTimeout,
+                         std::chrono::milliseconds connectTimeout,
+                         ReplyHandler onReply, boost::asio::ssl::context *tls,
+                         const std::string &tlsName)
+    : stats{}, ioContext(ioContext), timers(timers), endpoint(endpoint),
+      idleTimeout(idleTimeout), connectTimeout(connectTimeout),
+      onReply(std::move(onReply)),
+      connections(std::max(size, 1u)), backoff(0), retryAfter{}, tls(tls),
+      tlsName(tlsName), session(nullptr) {
+  if (tls) {
+    // Sessions are kept by the pools, one per server
+    SSL_CTX *ctx = tls->native_handle();
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+                                            SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, newSession);
+  }
+}
+
+TcpUpstream::~TcpUpstream() {
+  for (auto &c : connections) {
+    if (c) {
+      c->Close();
+    }
+  }
+
+  if (session) {
+    SSL_SESSION_free(session);
+  }
+}
+
+// TLS 1.3 servers send sessions after the handshake, so they are taken as
+// they come instead of from the connection once it is up
+int TcpUpstream::newSession(SSL *ssl, SSL_SESSION *session) {
+  auto *pool = static_cast<TcpUpstream *>(SSL_get_ex_data(ssl, poolIndex()));
+  if (pool == nullptr) {
+    return 0;
+  }
+
+  if (pool->session) {
+    SSL_SESSION_free(pool->session);
+  }
+  pool->session = session;
+  return 1; // Ours to free
+}
+
+bool TcpUpstream::Send(const uint8_t *data, std::size_t size) {
+  Connection *best = nullptr;
+  std::shared_ptr<Connection> *unused = nullptr;
+  for (auto &c : connections) {
+    if (!c || c->Closed()) {
+      unused = unused ? unused : &c;
+    } else if (!best || c->InFlight() < best->InFlight()) {
+      best = c.get();
+    }
+  }
+
+  // Another connection once the open ones are busy, unless connecting
+  // failed a moment ago
+  if ((!best || best->InFlight() >= UPSTREAM_PIPELINE) && unused &&
+      TimerWheel::Clock::now() >= retryAfter) {
+    *unused = std::make_shared<Connection>(*this);
+    (*unused)->Connect();
+    best = unused->get();
+  }
+
+  if (!best) {
+    return false;
+  }
+
+  stats.queries++;
+  best->Send(data, size);
+  return true;
+}
+
+std::size_t TcpUpstream::Open() const {
+  return std::count_if(connections.begin(), connections.end(),
+                       [](const auto &c) { return c && !c->Closed(); });
+}
+
+std::vector<unsigned int> TcpUpstream::InFlight() const {
+  std::vector<unsigned int> depths;
+  for (auto &c : connections) {
+    if (c && !c->Closed()) {
+      depths.push_back(c->InFlight());
+    }
+  }
+  return depths;
+}
+
+void TcpUpstream::connected() {
+  stats.connects++;
+  backoff = std::chrono::milliseconds(0);
+}
+
+void TcpUpstream::failed() {
+  stats.failures++;
+  backoff = std::clamp(backoff * 2,
+                       std::chrono::milliseconds(UPSTREAM_BACKOFF_MIN),
+                       std::chrono::milliseconds(UPSTREAM_BACKOFF_MAX));
+  retryAfter = TimerWheel::Clock::now() + backoff;
+}
@@ -73,19 +73,28 @@ static bool parseIpAddress(const std::string &ipa, const std::string &optName,
 
 static ActionType getActionType(const std::string &action,
                                 bool hasTarget = false) {
+  ActionType actionType;
   if (action == OPTION_DNS) {
-    if (hasTarget) {
-      LWARNING << "Ignoring target value as action is defined as dns."
-               << std::endl;
-    }
-    return ActionType::Dns;
+    actionType = ActionType::Dns;
   } else if (action == OPTION_REDIRECT) {
     return ActionType::Redirect;
+  } else if (action == OPTION_DROP) {
+    actionType = ActionType::Drop;
+  } else if (action == OPTION_REFUSE) {
+    actionType = ActionType::Refuse;
+  } else if (action == OPTION_NXDOMAIN) {
+    actionType = ActionType::NxDomain;
   } else {
     throw po::validation_error(
         po::validation_error::kind_t::invalid_option_value, OPTION_ACTION,
         action);
   }
+
+  if (hasTarget) {
+    LWARNING << "Ignoring target value as action is defined as " << action
+             << "." << std::endl;
+  }
+  return actionType;
 }
 
 Args::ExitCode RuleParser::Parse(const po::parsed_options &parsed,
@@ -125,7 +134,8 @@ Args::ExitCode RuleParser::Parse(const po::parsed_options &parsed,
           OPTION_IP ",i", po::value<std::string>(), "ip address to match")(
           OPTION_MAC ",m", po::value<std::string>(), "mac address to match")(
           OPTION_ACTION ",a", po::value<std::string>(),
-          "action to be taken. should be either dns/redirect")(
+          "action to be taken. should be one of "
+          "dns/redirect/drop/refuse/nxdomain")(
           OPTION_TARGET ",t", po::value<std::string>(),
           "target IP address for redirect");
 
@@ -259,7 +269,8 @@ Args::ExitCode RuleParser::Parse(const po::parsed_options &parsed,
       po::options_description desc("rules add options");
       desc.add_options()(OPTION_HELP ",h", "produce help message")(
           OPTION_ACTION ",a", po::value<std::string>(),
-          "policy action to be taken. should be either dns/redirect")(
+          "policy action to be taken. should be one of "
+          "dns/redirect/drop/refuse/nxdomain")(
           OPTION_TARGET_4 ",4", po::value<std::string>(),
           "target IPv4 address for redirect")(
           OPTION_TARGET_6 ",6", po::value<std::string>(),
@@ -62,6 +62,22 @@ ShmRuleEngine::~ShmRuleEngine() {
 }
 
 bool ShmRuleEngine::Evaluate(Input &input) const {
+  union IpAddress target{};
+  ActionType action = match(input, target);
+
+  // Acted on without the lock, workers only wait for each other while the
+  // rules are read
+  if (action == ActionType::Redirect) {
+    input.server->Redirect(input.packet, input.endpoint, input.ipv4, target);
+  } else {
+    apply(action, input);
+  }
+
+  return true;
+}
+
+ActionType ShmRuleEngine::match(const Input &input,
+                                union IpAddress &target) const {
   scoped_lock<interprocess_mutex> lock(ruleData->mutex);
 
   uint8_t *t = ruleData->data;
@@ -95,30 +111,40 @@ bool ShmRuleEngine::Evaluate(Input &input) const {
 
     // At this point we have matched rules. So we need to take action.
 
-    if (r.header.actionType == ActionType::Dns) {
-      input.server->Resolve(input.packet, input.endpoint, input.ipv4);
-    } else {
-      input.server->Redirect(input.packet, input.endpoint, input.ipv4,
-                             r.target->ipaddr);
+    if (r.header.actionType == ActionType::Redirect) {
+      target = r.target->ipaddr;
     }
-    return true;
+    return r.header.actionType;
   }
 
   // No match with any so we will next apply policy
 
-  if (ruleData->policy.action == ActionType::Dns) {
-    input.server->Resolve(input.packet, input.endpoint, input.ipv4);
-  } else {
-    if (input.ipv4) {
-      input.server->Redirect(input.packet, input.endpoint, input.ipv4,
-                             ruleData->policy.targetIpv4);
-    } else {
-      input.server->Redirect(input.packet, input.endpoint, input.ipv4,
-                             ruleData->policy.targetIpv6);
-    }
+  if (ruleData->policy.action == ActionType::Redirect) {
+    target = input.ipv4 ? ruleData->policy.targetIpv4
+                        : ruleData->policy.targetIpv6;
   }
 
-  return true;
+  return ruleData->policy.action;
+}
+
+void ShmRuleEngine::apply(const ActionType &actionType, Input &input) const {
+  switch (actionType) {
+  case ActionType::Dns:
+    input.server->Resolve(input.packet, input.endpoint, input.ipv4);
+    break;
+  case ActionType::Drop:
+    input.server->Drop(input.packet, input.endpoint);
+    break;
+  case ActionType::Refuse:
+    input.server->Reject(input.packet, input.endpoint, input.ipv4, E_REFUSED);
+    break;
+  case ActionType::NxDomain:
+    input.server->Reject(input.packet, input.endpoint, input.ipv4,
+                         E_NXDOMAIN);
+    break;
+  case ActionType::Redirect: // Needs a target, handled by the caller
+    break;
+  }
 }
 
 bool ShmRuleEngine::AppendRule(const RuleType &ruleType,
@@ -338,6 +364,23 @@ static inline std::ostream &showParam(std::ostream &ostream, const char *what,
   return ostream;
 }
 
+const char *ActionName(const ActionType &actionType) {
+  switch (actionType) {
+  case ActionType::Dns:
+    return OPTION_DNS;
+  case ActionType::Redirect:
+    return OPTION_REDIRECT;
+  case ActionType::Drop:
+    return OPTION_DROP;
+  case ActionType::Refuse:
+    return OPTION_REFUSE;
+  case ActionType::NxDomain:
+    return OPTION_NXDOMAIN;
+  }
+
+  return "unknown";
+}
+
 std::ostream &operator<<(std::ostream &ostream, const ShmRuleEngine &engine) {
   ostream << "# start" << std::endl;
 
@@ -362,8 +405,7 @@ std::ostream &operator<<(std::ostream &ostream, const ShmRuleEngine &engine) {
       showParam(ostream, OPTION_MAC, space) << EthAddressToString(*r.eth);
     }
 
-    showParam(ostream, OPTION_ACTION, true)
-        << (r.header.actionType == ActionType::Dns ? "dns" : "redirect");
+    showParam(ostream, OPTION_ACTION, true) << ActionName(r.header.actionType);
 
     if (r.header.actionType == ActionType::Redirect) {
       std::string address;
@@ -376,9 +418,7 @@ std::ostream &operator<<(std::ostream &ostream, const ShmRuleEngine &engine) {
 
   ostream << OPTION_POLICY << " ";
   showParam(ostream, OPTION_ACTION, true)
-      << " "
-      << (engine.ruleData->policy.action == ActionType::Dns ? "dns"
-                                                            : "redirect");
+      << " " << ActionName(engine.ruleData->policy.action);
 
   if (engine.ruleData->policy.action == ActionType::Redirect) {
     std::string address;
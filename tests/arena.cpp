@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#include "bookkeeping/arena.hpp"
+#include <cstring>
+
+struct Pair {
+  uint64_t a = 1;
+  uint16_t b = 2;
+};
+
+TEST_CASE("arena allocations are aligned and initialised") {
+  Arena arena(256);
+
+  uint8_t *byte = arena.Copy("x", 1);
+  CHECK(*byte == 'x');
+
+  Pair *pairs = arena.New<Pair>(3);
+  CHECK(reinterpret_cast<uintptr_t>(pairs) % alignof(Pair) == 0);
+  for (int i = 0; i < 3; i++) {
+    CHECK(pairs[i].a == 1);
+    CHECK(pairs[i].b == 2);
+  }
+  CHECK(arena.Used() == 1 + 3 * sizeof(Pair));
+}
+
+TEST_CASE("arena grows and reuses its blocks after a reset") {
+  Arena arena(256);
+
+  void *first = arena.Allocate(200);
+  arena.Allocate(200); // Does not fit the first block
+  void *large = arena.Allocate(1000);
+  CHECK(large != nullptr);
+  std::size_t capacity = arena.Capacity();
+  CHECK(capacity >= 256 + 256 + 1000);
+
+  arena.Reset();
+  CHECK(arena.Used() == 0);
+  CHECK(arena.Allocate(200) == first);
+  arena.Allocate(200);
+  arena.Allocate(1000);
+  CHECK(arena.Capacity() == capacity);
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+// Cost of reading, validating and writing typical replies with the full
+// object model, with locating the records in place as the baseline.
+//
+// Usage: bench_codec [packets]
+
+#include "dns/dnspacket.hpp"
+#include "dns/dnspacketview.hpp"
+
+#include <boost/log/core.hpp>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Reply {
+  const char *name;
+  std::vector<uint8_t> bytes;
+};
+
+#define EXAMPLE_COM 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0
+#define TO_QNAME 0xc0, 0x0c
+#define ONE_HOUR 0, 0, 0x0e, 0x10
+
+static std::vector<Reply> replies() {
+  return {
+      {"A",
+       {0x12, 0x34, 0x81, 0x80, 0, 1, 0, 1, 0, 0, 0, 0, EXAMPLE_COM, 0, 1, 0,
+        1, TO_QNAME, 0, 1, 0, 1, ONE_HOUR, 0, 4, 93, 184, 216, 34}},
+      {"CNAME+A+AAAA",
+       {0x12, 0x34, 0x81, 0x80, 0, 1, 0, 3, 0, 0, 0, 1, 3, 'w', 'w', 'w',
+        EXAMPLE_COM, 0, 1, 0, 1,
+        TO_QNAME, 0, 5, 0, 1, ONE_HOUR, 0, 7, 4, 'e', 'd', 'g', 'e', 0xc0,
+        0x10,
+        0xc0, 0x2d, 0, 1, 0, 1, ONE_HOUR, 0, 4, 93, 184, 216, 34,
+        0xc0, 0x2d, 0, 28, 0, 1, ONE_HOUR, 0, 16, 0x26, 0x06, 0x28, 0, 0x02,
+        0x20, 0, 1, 0x02, 0x48, 0x18, 0x93, 0x25, 0xc8, 0x19, 0x46,
+        0, 0, 41, 0x04, 0xd0, 0, 0, 0, 0, 0, 0}},
+      {"NXDOMAIN+SOA",
+       {0x12, 0x34, 0x81, 0x83, 0, 1, 0, 0, 0, 1, 0, 0, 2, 'n', 'x',
+        EXAMPLE_COM, 0, 1, 0, 1, 0xc0, 0x0f, 0, 6, 0, 1, ONE_HOUR, 0, 32, 2,
+        'n', 's', 0xc0, 0x0f,
+        4, 'h', 'o', 's', 't', 0xc0, 0x0f, 0x78, 0x49, 0x3a, 0x2e, 0, 0,
+        0x1c, 0x20, 0, 0, 0x0e, 0x10, 0, 0x12, 0x75, 0, 0, 0, 0x0e, 0x10}},
+      {"MX*3",
+       {0x12, 0x34, 0x81, 0x80, 0, 1, 0, 3, 0, 0, 0, 0, EXAMPLE_COM, 0, 15, 0,
+        1,
+        TO_QNAME, 0, 15, 0, 1, ONE_HOUR, 0, 9, 0, 10, 4, 'm', 'x', '0', '1',
+        0xc0, 0x0c,
+        TO_QNAME, 0, 15, 0, 1, ONE_HOUR, 0, 9, 0, 20, 4, 'm', 'x', '0', '2',
+        0xc0, 0x0c,
+        TO_QNAME, 0, 15, 0, 1, ONE_HOUR, 0, 9, 0, 30, 4, 'm', 'x', '0', '3',
+        0xc0, 0x0c}},
+  };
+}
+
+static double nsPer(Clock::duration d, std::size_t n) {
+  return double(std::chrono::duration_cast<std::chrono::nanoseconds>(d)
+                    .count()) /
+         double(n);
+}
+
+static void load(BytePacketBuffer &bpb, const std::vector<uint8_t> &bytes) {
+  std::memcpy(bpb.buf.data(), bytes.data(), bytes.size());
+  bpb.size = bytes.size();
+  bpb.pos = 0;
+}
+
+static void run(const Reply &reply, std::size_t packets) {
+  BytePacketBuffer bpb, out;
+  Arena arena;
+  std::size_t failed = 0;
+  std::size_t written = 0;
+
+  auto t0 = Clock::now();
+  for (std::size_t i = 0; i < packets; i++) {
+    load(bpb, reply.bytes);
+    arena.Reset();
+    DnsPacket packet(arena);
+    failed += packet.Read(&bpb) != E_NOERROR;
+    failed += packet.Validate(PacketType::IncomingResponse) != E_NOERROR;
+  }
+  auto t1 = Clock::now();
+
+  load(bpb, reply.bytes);
+  arena.Reset();
+  DnsPacket packet(arena);
+  failed += packet.Read(&bpb) != E_NOERROR;
+  for (std::size_t i = 0; i < packets; i++) {
+    out.pos = 0;
+    packet.Write(&out);
+    written += out.pos;
+  }
+  auto t2 = Clock::now();
+
+  for (std::size_t i = 0; i < packets; i++) {
+    load(bpb, reply.bytes);
+    DnsPacketView view(bpb);
+    failed += view.Read() != E_NOERROR;
+    failed += view.Validate(PacketType::IncomingResponse) != E_NOERROR;
+  }
+  auto t3 = Clock::now();
+
+  std::cout << reply.name << ", bytes: " << reply.bytes.size()
+            << ", ns/read+validate: " << nsPer(t1 - t0, packets)
+            << ", ns/write: " << nsPer(t2 - t1, packets)
+            << ", ns/view: " << nsPer(t3 - t2, packets)
+            << ", written: " << written / packets << ", failed: " << failed
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  std::size_t packets = argc > 1 ? std::stoul(argv[1]) : 2000000;
+
+  // Warnings about the packets would otherwise dominate
+  boost::log::core::get()->set_logging_enabled(false);
+
+  for (const Reply &reply : replies()) {
+    run(reply, packets);
+  }
+
+  return 0;
+}
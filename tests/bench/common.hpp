@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#pragma once
+
+// Helpers shared by the benchmarks in tests/bench. These are standalone
+// executables and are not run as part of ctest, the server tests use the
+// same helpers to run a DnsServer on loopback.
+
+#include "args.hpp"
+#include "config.hpp"
+
+#include <atomic>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+namespace bench {
+
+// Configuration held in memory instead of an ini file or registry.
+class MapConfigReader : public ConfigReader {
+public:
+  std::map<std::string, std::string> values;
+
+protected:
+  std::string getStringValue(const std::string &key,
+                             const std::string &defValue) {
+    auto it = values.find(key);
+    return it == values.end() ? defValue : it->second;
+  }
+
+  long getLongValue(const std::string &key, const long &defValue) {
+    auto it = values.find(key);
+    return it == values.end() ? defValue : std::stol(it->second);
+  }
+
+  bool getBoolValue(const std::string &key, const bool &defValue) {
+    auto it = values.find(key);
+    return it == values.end() ? defValue : it->second == "true";
+  }
+};
+
+inline void InitArgs() {
+  static const char *argv[] = {"bench", "start", "--use-raw-sockets", "false"};
+  Args::Init(4, const_cast<char **>(argv));
+}
+
+inline void QuietLogs() {
+  boost::log::core::get()->set_filter(boost::log::trivial::severity >=
+                                      boost::log::trivial::fatal);
+}
+
+inline uint16_t FreeUdpPort() {
+  boost::asio::io_context ioContext;
+  udp::socket s(ioContext, udp::endpoint(udp::v4(), 0));
+  return s.local_endpoint().port();
+}
+
+inline uint16_t FreeTcpPort() {
+  boost::asio::io_context ioContext;
+  tcp::acceptor a(ioContext, tcp::endpoint(tcp::v4(), 0));
+  return a.local_endpoint().port();
+}
+
+// Writes a standard A query for name into buf, returns the size.
+inline std::size_t MakeQuery(uint8_t *buf, uint16_t id,
+                             const std::string &name) {
+  std::size_t n = 0;
+  buf[n++] = id >> 8;
+  buf[n++] = id & 0xff;
+  buf[n++] = 0x01; // RD
+  buf[n++] = 0x00;
+  const uint8_t counts[] = {0, 1, 0, 0, 0, 0, 0, 0};
+  std::memcpy(buf + n, counts, sizeof(counts));
+  n += sizeof(counts);
+
+  std::size_t start = 0;
+  while (start <= name.size()) {
+    std::size_t end = name.find('.', start);
+    if (end == std::string::npos) {
+      end = name.size();
+    }
+    buf[n++] = uint8_t(end - start);
+    std::memcpy(buf + n, name.data() + start, end - start);
+    n += end - start;
+    start = end + 1;
+  }
+  buf[n++] = 0;
+
+  buf[n++] = 0; // QTYPE A
+  buf[n++] = 1;
+  buf[n++] = 0; // QCLASS IN
+  buf[n++] = 1;
+  return n;
+}
+
+// Upstream stand-in which answers every A query with 127.0.0.1.
+class FakeUpstream {
+public:
+  FakeUpstream()
+      : socket(ioContext, udp::endpoint(udp::v4(), 0)), running(true) {
+    port = socket.local_endpoint().port();
+    thread = std::thread([this]() { run(); });
+  }
+
+  ~FakeUpstream() {
+    running = false;
+    boost::system::error_code ec;
+    socket.send_to(boost::asio::buffer("", 1),
+                   udp::endpoint(boost::asio::ip::address_v4::loopback(), port),
+                   0, ec);
+    thread.join();
+  }
+
+  uint16_t port;
+
+private:
+  void run() {
+    uint8_t buf[2048];
+    udp::endpoint from;
+    while (running) {
+      boost::system::error_code ec;
+      std::size_t n = socket.receive_from(boost::asio::buffer(buf, 512), from,
+                                          0, ec);
+      if (ec || n < 12 || !running) {
+        continue;
+      }
+
+      static const uint8_t answer[] = {0xc0, 0x0c, 0, 1, 0,   1,   0, 0,
+                                       0x0e, 0x10, 0, 4, 127, 0,   0, 1};
+      buf[2] |= 0x80;          // QR
+      buf[3] = 0x80;           // RA
+      buf[7] = 1;              // ANCOUNT
+      buf[10] = buf[11] = 0;   // ARCOUNT
+      std::memcpy(buf + n, answer, sizeof(answer));
+      socket.send_to(boost::asio::buffer(buf, n + sizeof(answer)), from, 0,
+                     ec);
+    }
+  }
+
+  boost::asio::io_context ioContext;
+  udp::socket socket;
+  std::atomic<bool> running;
+  std::thread thread;
+};
+
+// Closed loop load generator: every client keeps `window` queries in flight
+// over its own socket (so flows hash to different workers) and returns the
+// number of answers received within duration.
+inline uint64_t RunUdpLoad(uint16_t port, unsigned int clients,
+                           unsigned int window,
+                           std::chrono::milliseconds duration,
+                           bool uniqueNames = true) {
+  std::atomic<uint64_t> answered{0};
+  std::vector<std::thread> threads;
+  auto deadline = std::chrono::steady_clock::now() + duration;
+
+  for (unsigned int c = 0; c < clients; c++) {
+    threads.emplace_back([&, c]() {
+      boost::asio::io_context ioContext;
+      udp::socket s(ioContext, udp::endpoint(udp::v4(), 0));
+      udp::endpoint server(boost::asio::ip::address_v4::loopback(), port);
+      struct timeval tv = {0, 100000};
+      setsockopt(s.native_handle(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+      uint8_t buf[2048];
+      uint64_t seq = 0;
+      uint64_t local = 0;
+      while (std::chrono::steady_clock::now() < deadline) {
+        for (unsigned int w = 0; w < window; w++, seq++) {
+          std::string name =
+              uniqueNames ? "q" + std::to_string(seq) + ".c" +
+                                std::to_string(c) + ".bench.test"
+                          : "www.bench.test";
+          std::size_t n = MakeQuery(buf, uint16_t(seq), name);
+          boost::system::error_code ec;
+          s.send_to(boost::asio::buffer(buf, n), server, 0, ec);
+        }
+
+        // asio retries timed out blocking reads so use recv directly
+        for (unsigned int w = 0; w < window; w++) {
+          if (recv(s.native_handle(), buf, sizeof(buf), 0) <= 0) {
+            break;
+          }
+          local++;
+        }
+      }
+      answered += local;
+    });
+  }
+
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  return answered;
+}
+
+} // namespace bench
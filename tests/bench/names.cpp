@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+// Cost of turning the question of a query into its key and the case bitmap
+// of its name, with each of the lowercasing kernels. "separate" saves the
+// case in its own pass over the name, the way it was done before.
+//
+// Usage: bench_names [rounds]
+
+#include "dns/querykey.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+// Names seen in resolver traffic: short popular ones, CDN and tracker names
+// which run long, reverse lookups and some with the case randomised
+// (draft-vixie-dnsext-0x20).
+static const char *corpus[] = {
+    "google.com",
+    "www.google.com",
+    "clients4.google.com",
+    "www.youtube.com",
+    "i.ytimg.com",
+    "graph.facebook.com",
+    "scontent.xx.fbcdn.net",
+    "api.twitter.com",
+    "www.wikipedia.org",
+    "en.m.wikipedia.org",
+    "www.amazon.com",
+    "fls-na.amazon.com",
+    "d3ag4hukkh62yn.cloudfront.net",
+    "s3.us-east-1.amazonaws.com",
+    "login.microsoftonline.com",
+    "settings-win.data.microsoft.com",
+    "v10.events.data.microsoft.com",
+    "officeclient.microsoft.com",
+    "ocsp.digicert.com",
+    "ocsp.pki.goog",
+    "time.apple.com",
+    "gateway.icloud.com",
+    "mesu.apple.com",
+    "app-measurement.com",
+    "www.googletagmanager.com",
+    "securepubads.g.doubleclick.net",
+    "pagead2.googlesyndication.com",
+    "e6858.dsce9.akamaiedge.net",
+    "www.netflix.com",
+    "ichnaea-web.netflix.com",
+    "github.com",
+    "objects.githubusercontent.com",
+    "registry.npmjs.org",
+    "pypi.org",
+    "connectivitycheck.gstatic.com",
+    "fonts.gstatic.com",
+    "1.0.0.127.in-addr.arpa",
+    "34.216.184.93.in-addr.arpa",
+    "b.9.2.4.8.c.5.a.0.0.2.0.8.a.9.2.0.0.0.0.0.0.0.0.0.0.0.0.8.e.f.ip6.arpa",
+    "_ldap._tcp.dc._msdcs.corp.example.com",
+    "wpad.corp.example.com",
+    "WwW.GoOgLe.CoM",
+    "sTaTiC.xX.fBcDn.NeT",
+    "ApI.GiThUb.CoM",
+    "a1089.dscd.akamai.net.0.1.cn.akamaitech.net",
+    "1234567890abcdef.prod.telemetry.ingest.us-west-2.vendor-analytics.io",
+};
+
+// The question as a query carries it
+static std::string question(const std::string &name) {
+  std::string wire;
+  std::size_t start = 0;
+  while (start <= name.size()) {
+    std::size_t end = name.find('.', start);
+    if (end == std::string::npos) {
+      end = name.size();
+    }
+    wire += char(end - start);
+    wire += name.substr(start, end - start);
+    start = end + 1;
+  }
+  return wire + std::string("\0\0\1\0\1", 5);
+}
+
+static double nsPer(Clock::duration d, std::size_t n) {
+  return double(std::chrono::duration_cast<std::chrono::nanoseconds>(d)
+                    .count()) /
+         double(n);
+}
+
+static void run(const char *name, QueryKey::Kernel kernel,
+                const std::vector<BytePacketBuffer> &questions,
+                std::size_t rounds) {
+  if (QueryKey::UseKernel(kernel) != kernel) {
+    std::cout << name << ": not supported here" << std::endl;
+    return;
+  }
+
+  QueryKey key;
+  uint8_t bits[NAME_CASE_SIZE];
+  uint64_t sum = 0;
+
+  auto t0 = Clock::now();
+  for (std::size_t r = 0; r < rounds; r++) {
+    for (const BytePacketBuffer &bpb : questions) {
+      key.Read(bpb, 0, bits);
+      sum += key.Hash() + bits[0];
+    }
+  }
+  auto t1 = Clock::now();
+  for (std::size_t r = 0; r < rounds; r++) {
+    for (const BytePacketBuffer &bpb : questions) {
+      key.Read(bpb, 0);
+      QueryKey::SaveCase(key.Name(), bits);
+      sum += key.Hash() + bits[0];
+    }
+  }
+  auto t2 = Clock::now();
+
+  std::size_t n = rounds * questions.size();
+  std::cout << name << ", ns/key+case: " << nsPer(t1 - t0, n)
+            << ", ns/separate: " << nsPer(t2 - t1, n) << ", sum: " << sum % 10
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  std::size_t rounds = argc > 1 ? std::stoul(argv[1]) : 200000;
+
+  std::vector<BytePacketBuffer> questions;
+  std::size_t bytes = 0;
+  for (const char *name : corpus) {
+    std::string wire = question(name);
+    BytePacketBuffer &bpb = questions.emplace_back();
+    std::memcpy(bpb.buf.data(), wire.data(), wire.size());
+    bpb.size = wire.size();
+    bytes += wire.size() - 4;
+  }
+  std::cout << "names: " << questions.size()
+            << ", average bytes: " << bytes / questions.size() << std::endl;
+
+  run("scalar", QueryKey::Kernel::Scalar, questions, rounds);
+  run("sse2", QueryKey::Kernel::Sse2, questions, rounds);
+  run("avx2", QueryKey::Kernel::Avx2, questions, rounds);
+
+  return 0;
+}
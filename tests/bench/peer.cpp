@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+// Cost of matching upstream replies and client queries against the in-flight
+// table as the number of queries in flight grows.
+//
+// Usage: bench_peer [lookups]
+
+#include "bookkeeping/peer.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+struct Query {
+  QueryKey key;
+  uint16_t id;
+};
+
+// Question for a random host name in wire format
+static void makeQuestion(std::mt19937_64 &rng, BytePacketBuffer &bpb) {
+  static const char letters[] = "abcdefghijklmnopqrstuvwxyz"
+                                "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  bpb.size = 0;
+  bpb.buf[bpb.size++] = 12;
+  for (int i = 0; i < 12; i++) {
+    bpb.buf[bpb.size++] = letters[rng() % (sizeof(letters) - 1)];
+  }
+  for (const char *label : {"\x07example", "\x03com"}) {
+    std::size_t n = std::strlen(label);
+    std::memcpy(&bpb.buf[bpb.size], label, n);
+    bpb.size += n;
+  }
+  bpb.buf[bpb.size++] = 0;
+  for (uint8_t b : {0, 1, 0, 1}) { // A, IN
+    bpb.buf[bpb.size++] = b;
+  }
+}
+
+static void run(std::size_t inFlight, std::size_t lookups) {
+  boost::asio::io_context io_context;
+  TimerWheel timers(io_context);
+  PeerRequests requests(timers, inFlight);
+  std::mt19937_64 rng(inFlight);
+  std::time_t now = std::time(nullptr);
+
+  BytePacketBuffer bpb;
+  std::vector<Query> queries(inFlight);
+  for (auto &q : queries) {
+    makeQuestion(rng, bpb);
+    q.key.Read(bpb, 0);
+    q.id = requests.GetNewRecord(now, q.key, 0)->newId;
+  }
+
+  std::size_t found = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < lookups; i++) {
+    const Query &q = queries[i % inFlight];
+    found += requests.Lookup(q.id, q.key) != nullptr;
+  }
+  auto middle = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < lookups; i++) {
+    const Query &q = queries[i % inFlight];
+    found += requests.LookupByQuery(q.key, 0, 0) != nullptr;
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  auto ns = [lookups](auto d) {
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(d)
+                      .count()) /
+           double(lookups);
+  };
+  std::cout << "in flight: " << inFlight
+            << ", ns/Lookup: " << ns(middle - start)
+            << ", ns/LookupByQuery: " << ns(end - middle)
+            << ", found: " << found << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  std::size_t lookups = argc > 1 ? std::stoul(argv[1]) : 10000000;
+
+  for (std::size_t inFlight : {16, 128, 1024, 8192, 32768}) {
+    run(inFlight, lookups);
+  }
+
+  return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+// Load on the TCP listener from many persistent connections, each keeping
+// `window` queries pipelined. Counts replies which overtook an earlier
+// query of the same connection and connections the server dropped.
+//
+// Usage: bench_tcp [connections] [seconds] [window]
+
+#include "common.hpp"
+#include "dns/server.hpp"
+#include "dns/tcpconnection.hpp"
+#include "rule/shm.hpp"
+
+#include <algorithm>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+#include <iostream>
+#include <memory>
+
+using namespace std::chrono_literals;
+
+struct Client {
+  Client(boost::asio::io_context &ioContext, unsigned int index)
+      : socket(ioContext), index(index), seq(0), pending(0) {}
+
+  tcp::socket socket;
+  unsigned int index;
+  uint64_t seq;
+  std::vector<uint8_t> out;
+  TcpFramer in;
+  // IDs of the queries in flight, oldest first
+  std::vector<uint16_t> ids;
+  unsigned int pending;
+};
+
+struct Load {
+  std::chrono::steady_clock::time_point deadline;
+  unsigned int window;
+  uint64_t connected = 0;
+  uint64_t lost = 0;
+  uint64_t answered = 0;
+  uint64_t overtaken = 0;
+  // Connections still querying, the last one to finish stops the clock
+  unsigned int active = 0;
+  boost::asio::steady_timer *giveUp = nullptr;
+
+  void Done() {
+    if (--active == 0) {
+      giveUp->cancel();
+    }
+  }
+};
+
+static void query(Client &c, Load &load);
+
+static void read(Client &c, Load &load) {
+  std::span<uint8_t> free = c.in.Free();
+  c.socket.async_read_some(
+      boost::asio::buffer(free.data(), free.size()),
+      [&c, &load](boost::system::error_code ec, std::size_t n) {
+        if (ec) {
+          load.lost++;
+          load.Done();
+          return;
+        }
+
+        c.in.Commit(n);
+        std::span<const uint8_t> reply;
+        while (c.in.Next(reply)) {
+          uint16_t id = uint16_t(reply[0] << 8 | reply[1]);
+          auto it = std::find(c.ids.begin(), c.ids.end(), id);
+          if (it != c.ids.begin()) {
+            load.overtaken++;
+          }
+          if (it != c.ids.end()) {
+            c.ids.erase(it);
+          }
+          load.answered++;
+          c.pending--;
+        }
+
+        if (c.pending == 0) {
+          query(c, load);
+        } else {
+          read(c, load);
+        }
+      });
+}
+
+static void query(Client &c, Load &load) {
+  if (std::chrono::steady_clock::now() >= load.deadline) {
+    boost::system::error_code ec;
+    c.socket.close(ec);
+    load.Done();
+    return;
+  }
+
+  // The whole window goes out with one write
+  c.out.resize(load.window * 512);
+  std::size_t size = 0;
+  for (unsigned int w = 0; w < load.window; w++, c.seq++) {
+    std::string name = "q" + std::to_string(c.seq) + ".c" +
+                       std::to_string(c.index) + ".bench.test";
+    std::size_t n = bench::MakeQuery(&c.out[size + 2], uint16_t(c.seq), name);
+    c.out[size] = uint8_t(n >> 8);
+    c.out[size + 1] = uint8_t(n & 0xff);
+    size += 2 + n;
+    c.ids.push_back(uint16_t(c.seq));
+  }
+  c.pending = load.window;
+
+  boost::asio::async_write(
+      c.socket, boost::asio::buffer(c.out.data(), size),
+      [&c, &load](boost::system::error_code ec, std::size_t) {
+        if (ec) {
+          load.lost++;
+          load.Done();
+          return;
+        }
+        read(c, load);
+      });
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int connections = argc > 1 ? std::stoul(argv[1]) : 5000;
+  std::chrono::seconds duration(argc > 2 ? std::stoul(argv[2]) : 5);
+  unsigned int window = argc > 3 ? std::stoul(argv[3]) : 4;
+
+  bench::InitArgs();
+  bench::QuietLogs();
+
+  ShmRuleEngine ruleEngine(true);
+  union IpAddress none {};
+  ruleEngine.SetPolicy(ActionType::Dns, none, none);
+
+  bench::FakeUpstream upstream;
+  uint16_t port = bench::FreeTcpPort();
+
+  bench::MapConfigReader config;
+  config.values["dnsPort"] = std::to_string(bench::FreeUdpPort());
+  config.values["tcpPort"] = std::to_string(port);
+  config.values["tcpConnections"] = std::to_string(connections);
+  config.values["tcpIdleTimeout"] = "60000";
+  config.values["serverIp1"] = "127.0.0.1";
+  config.values["serverPort1"] = std::to_string(upstream.port);
+  config.values["maxQueries"] = "65535";
+  config.values["statsInterval"] = "0";
+  config.LoadConfiguration();
+
+  boost::asio::io_context serverContext(1);
+  DnsServer server(serverContext, config.dnsPort, &config, &ruleEngine);
+  std::thread serverThread([&serverContext]() { serverContext.run(); });
+
+  // All connections are open before any query is sent
+  boost::asio::io_context ioContext(1);
+  std::vector<std::unique_ptr<Client>> clients;
+  Load load;
+  load.window = window;
+  tcp::endpoint target(boost::asio::ip::address_v4::loopback(), port);
+  auto t0 = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i < connections; i++) {
+    clients.push_back(std::make_unique<Client>(ioContext, i));
+    clients.back()->socket.async_connect(
+        target, [&load](boost::system::error_code ec) {
+          if (ec) {
+            load.lost++;
+          } else {
+            load.connected++;
+          }
+        });
+  }
+  ioContext.run();
+  ioContext.restart();
+  auto t1 = std::chrono::steady_clock::now();
+
+  // Replies still missing by then are not coming
+  load.deadline = t1 + duration;
+  boost::asio::steady_timer giveUp(ioContext, load.deadline + 5s);
+  load.giveUp = &giveUp;
+  load.active = load.connected;
+  giveUp.async_wait([&clients](boost::system::error_code ec) {
+    if (ec) {
+      return;
+    }
+    for (auto &c : clients) {
+      boost::system::error_code ec;
+      c->socket.close(ec);
+    }
+  });
+  for (auto &c : clients) {
+    if (c->socket.is_open()) {
+      query(*c, load);
+    }
+  }
+  ioContext.run();
+  auto t2 = std::chrono::steady_clock::now();
+
+  serverContext.stop();
+  serverThread.join();
+
+  double seconds = std::chrono::duration<double>(t2 - t1).count();
+  std::cout << "connections: " << load.connected << ", connect ms: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0)
+                   .count()
+            << ", window: " << window
+            << ", queries/s: " << double(load.answered) / seconds
+            << ", overtaken: " << load.overtaken << ", lost: " << load.lost
+            << std::endl;
+
+  return 0;
+}
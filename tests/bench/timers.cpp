@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+// Cost of arming, moving, cancelling and expiring timers on the timer wheel
+// with many armed at once, next to a binary heap with lazy cancellation which
+// is what a single steady_timer per worker needs.
+//
+// Usage: bench_timers [timers]
+
+#include "bookkeeping/timerwheel.hpp"
+
+#include <iostream>
+#include <queue>
+#include <random>
+#include <vector>
+
+using namespace std::chrono_literals;
+typedef TimerWheel::Clock Clock;
+
+static double nsPer(Clock::duration d, std::size_t n) {
+  return double(std::chrono::duration_cast<std::chrono::nanoseconds>(d)
+                    .count()) /
+         double(n);
+}
+
+static void wheel(const std::vector<Clock::duration> &after) {
+  boost::asio::io_context io_context;
+  TimerWheel wheel(io_context);
+  std::vector<TimerWheel::Timer> timers(after.size());
+  std::size_t fired = 0;
+  Clock::time_point start = Clock::now();
+
+  auto t0 = Clock::now();
+  for (std::size_t i = 0; i < timers.size(); i++) {
+    wheel.Schedule(timers[i], start + after[i], [&fired]() { fired++; });
+  }
+  auto t1 = Clock::now();
+  // A reply came, the query gets its next deadline
+  for (std::size_t i = 0; i < timers.size(); i++) {
+    wheel.Schedule(timers[i], start + after[timers.size() - 1 - i],
+                   [&fired]() { fired++; });
+  }
+  auto t2 = Clock::now();
+  for (std::size_t i = 0; i < timers.size(); i += 2) {
+    timers[i].Cancel();
+  }
+  auto t3 = Clock::now();
+  for (Clock::time_point now = start; wheel.Armed() > 0; now += 10ms) {
+    wheel.Advance(now);
+  }
+  auto t4 = Clock::now();
+
+  std::cout << "wheel, timers: " << timers.size()
+            << ", ns/arm: " << nsPer(t1 - t0, timers.size())
+            << ", ns/move: " << nsPer(t2 - t1, timers.size())
+            << ", ns/cancel: " << nsPer(t3 - t2, timers.size() / 2)
+            << ", ns/expire: " << nsPer(t4 - t3, fired)
+            << ", fired: " << fired << std::endl;
+}
+
+struct Entry {
+  Clock::time_point expiry;
+  std::size_t timer;
+  unsigned int generation;
+
+  bool operator>(const Entry &other) const { return expiry > other.expiry; }
+};
+
+static void heap(const std::vector<Clock::duration> &after) {
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+  // Entries of older generations are skipped when they come up
+  std::vector<unsigned int> generations(after.size(), 0);
+  std::size_t fired = 0;
+  Clock::time_point start = Clock::now();
+
+  auto t0 = Clock::now();
+  for (std::size_t i = 0; i < after.size(); i++) {
+    heap.push({start + after[i], i, generations[i]});
+  }
+  auto t1 = Clock::now();
+  for (std::size_t i = 0; i < after.size(); i++) {
+    heap.push({start + after[after.size() - 1 - i], i, ++generations[i]});
+  }
+  auto t2 = Clock::now();
+  for (std::size_t i = 0; i < after.size(); i += 2) {
+    generations[i]++;
+  }
+  auto t3 = Clock::now();
+  for (Clock::time_point now = start; !heap.empty(); now += 10ms) {
+    while (!heap.empty() && heap.top().expiry <= now) {
+      fired += heap.top().generation == generations[heap.top().timer];
+      heap.pop();
+    }
+  }
+  auto t4 = Clock::now();
+
+  std::cout << "heap, timers: " << after.size()
+            << ", ns/arm: " << nsPer(t1 - t0, after.size())
+            << ", ns/move: " << nsPer(t2 - t1, after.size())
+            << ", ns/cancel: " << nsPer(t3 - t2, after.size() / 2)
+            << ", ns/expire: " << nsPer(t4 - t3, fired)
+            << ", fired: " << fired << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  std::size_t count = argc > 1 ? std::stoul(argv[1]) : 100000;
+
+  // Retransmit and stale deadlines are up to seconds away, mappings and
+  // record expiry up to a minute.
+  std::mt19937 rng(count);
+  std::uniform_int_distribution<int64_t> ms(1, 60000);
+  std::vector<Clock::duration> after(count);
+  for (auto &d : after) {
+    d = std::chrono::milliseconds(ms(rng));
+  }
+
+  wheel(after);
+  heap(after);
+
+  return 0;
+}
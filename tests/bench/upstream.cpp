@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+// Throughput of queries whose UDP reply comes back truncated, so that each
+// is asked again over the pooled TCP connections. Counts the connections
+// the upstream stand-in had to accept.
+//
+// Usage: bench_upstream [seconds] [clients] [window]
+
+#include "common.hpp"
+#include "dns/server.hpp"
+#include "rule/shm.hpp"
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <iostream>
+#include <memory>
+
+// Answers every query over UDP with TC set and over TCP with 127.0.0.1
+class TruncatingUpstream {
+public:
+  TruncatingUpstream()
+      : accepted(0), udpSocket(ioContext, udp::endpoint(udp::v4(), 0)),
+        acceptor(ioContext, tcp::endpoint(tcp::v4(),
+                                          udpSocket.local_endpoint().port())),
+        running(true) {
+    port = udpSocket.local_endpoint().port();
+    threads.emplace_back([this]() { runUdp(); });
+    threads.emplace_back([this]() { runTcp(); });
+  }
+
+  ~TruncatingUpstream() {
+    running = false;
+    boost::system::error_code ec;
+    udpSocket.send_to(
+        boost::asio::buffer("", 1),
+        udp::endpoint(boost::asio::ip::address_v4::loopback(), port), 0, ec);
+    tcp::socket wake(ioContext);
+    wake.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port),
+                 ec);
+    for (auto &t : threads) {
+      t.join();
+    }
+  }
+
+  uint16_t port;
+  std::atomic<uint64_t> accepted;
+
+private:
+  static std::size_t answer(uint8_t *buf, std::size_t n) {
+    static const uint8_t a[] = {0xc0, 0x0c, 0, 1, 0,   1, 0, 0,
+                                0x0e, 0x10, 0, 4, 127, 0, 0, 1};
+    buf[2] |= 0x80; // QR
+    buf[3] = 0x80;  // RA
+    buf[7] = 1;     // ANCOUNT
+    buf[10] = buf[11] = 0;
+    std::memcpy(buf + n, a, sizeof(a));
+    return n + sizeof(a);
+  }
+
+  void runUdp() {
+    uint8_t buf[2048];
+    udp::endpoint from;
+    while (running) {
+      boost::system::error_code ec;
+      std::size_t n =
+          udpSocket.receive_from(boost::asio::buffer(buf, 512), from, 0, ec);
+      if (ec || n < 12 || !running) {
+        continue;
+      }
+      buf[2] |= 0x82; // QR, TC
+      buf[3] = 0x80;
+      udpSocket.send_to(boost::asio::buffer(buf, n), from, 0, ec);
+    }
+  }
+
+  void runTcp() {
+    while (running) {
+      auto socket = std::make_shared<tcp::socket>(ioContext);
+      boost::system::error_code ec;
+      acceptor.accept(*socket, ec);
+      if (ec || !running) {
+        continue;
+      }
+      accepted++;
+      std::thread([socket]() {
+        uint8_t buf[2048];
+        while (true) {
+          boost::system::error_code ec;
+          boost::asio::read(*socket, boost::asio::buffer(buf, 2), ec);
+          std::size_t n = std::size_t(buf[0]) << 8 | buf[1];
+          if (ec || n < 12 || n > 512) {
+            return;
+          }
+          boost::asio::read(*socket, boost::asio::buffer(buf + 2, n), ec);
+          if (ec) {
+            return;
+          }
+          n = answer(buf + 2, n);
+          buf[0] = uint8_t(n >> 8);
+          buf[1] = uint8_t(n & 0xff);
+          boost::asio::write(*socket, boost::asio::buffer(buf, n + 2), ec);
+        }
+      }).detach();
+    }
+  }
+
+  boost::asio::io_context ioContext;
+  udp::socket udpSocket;
+  tcp::acceptor acceptor;
+  std::atomic<bool> running;
+  std::vector<std::thread> threads;
+};
+
+int main(int argc, char *argv[]) {
+  std::chrono::seconds duration(argc > 1 ? std::stoul(argv[1]) : 5);
+  unsigned int clients = argc > 2 ? std::stoul(argv[2]) : 4;
+  unsigned int window = argc > 3 ? std::stoul(argv[3]) : 16;
+
+  bench::InitArgs();
+  bench::QuietLogs();
+
+  ShmRuleEngine ruleEngine(true);
+  union IpAddress none {};
+  ruleEngine.SetPolicy(ActionType::Dns, none, none);
+
+  TruncatingUpstream upstream;
+  uint16_t port = bench::FreeUdpPort();
+
+  bench::MapConfigReader config;
+  config.values["dnsPort"] = std::to_string(port);
+  config.values["tcpPort"] = "0";
+  config.values["serverIp1"] = "127.0.0.1";
+  config.values["serverPort1"] = std::to_string(upstream.port);
+  config.values["maxQueries"] = "65535";
+  config.values["statsInterval"] = "0";
+  config.LoadConfiguration();
+
+  boost::asio::io_context ioContext(1);
+  DnsServer server(ioContext, port, &config, &ruleEngine);
+  std::thread thread([&ioContext]() { ioContext.run(); });
+
+  uint64_t answered = bench::RunUdpLoad(port, clients, window, duration);
+
+  ioContext.stop();
+  thread.join();
+
+  std::cout << "queries/s: " << double(answered) / double(duration.count())
+            << ", upstream TCP connections: " << upstream.accepted
+            << std::endl;
+
+  return 0;
+}
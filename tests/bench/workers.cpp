@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+// Throughput of the forwarding path with one worker compared with N workers
+// sharing the DNS port through SO_REUSEPORT.
+//
+// Usage: bench_workers [workers] [seconds] [batchSize]
+
+#include "common.hpp"
+#include "dns/server.hpp"
+#include "rule/shm.hpp"
+
+#include <iostream>
+#include <memory>
+
+static double run(unsigned int workers, unsigned int batchSize,
+                  std::chrono::seconds duration, uint16_t upstreamPort,
+                  ShmRuleEngine &ruleEngine) {
+  uint16_t port = bench::FreeUdpPort();
+
+  bench::MapConfigReader config;
+  config.values["dnsPort"] = std::to_string(port);
+  config.values["serverIp1"] = "127.0.0.1";
+  config.values["serverPort1"] = std::to_string(upstreamPort);
+  config.values["workers"] = std::to_string(workers);
+  config.values["batchSize"] = std::to_string(batchSize);
+  config.values["statsInterval"] = "0";
+  config.LoadConfiguration();
+
+  std::vector<std::unique_ptr<boost::asio::io_context>> contexts;
+  std::vector<std::unique_ptr<DnsServer>> servers;
+  std::vector<std::thread> threads;
+  for (unsigned int i = 0; i < config.workers; i++) {
+    contexts.push_back(std::make_unique<boost::asio::io_context>(1));
+    servers.push_back(std::make_unique<DnsServer>(*contexts.back(), port,
+                                                  &config, &ruleEngine));
+  }
+  for (auto &context : contexts) {
+    threads.emplace_back([&context]() { context->run(); });
+  }
+
+  uint64_t answered =
+      bench::RunUdpLoad(port, 4 * config.workers, 16, duration);
+
+  for (auto &context : contexts) {
+    context->stop();
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  return double(answered) / double(duration.count());
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int workers =
+      argc > 1 ? std::stoul(argv[1])
+               : std::max(2u, std::thread::hardware_concurrency());
+  std::chrono::seconds duration(argc > 2 ? std::stoul(argv[2]) : 5);
+  unsigned int batchSize = argc > 3 ? std::stoul(argv[3]) : 1;
+
+  bench::InitArgs();
+  bench::QuietLogs();
+
+  ShmRuleEngine ruleEngine(true);
+  union IpAddress none {};
+  ruleEngine.SetPolicy(ActionType::Dns, none, none);
+
+  bench::FakeUpstream upstream;
+
+  double one = run(1, batchSize, duration, upstream.port, ruleEngine);
+  std::cout << "workers: 1, queries/s: " << one << std::endl;
+
+  double many = run(workers, batchSize, duration, upstream.port, ruleEngine);
+  std::cout << "workers: " << workers << ", queries/s: " << many
+            << " (x" << many / one << ")" << std::endl;
+
+  return 0;
+}
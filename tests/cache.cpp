@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#include "bookkeeping/cache.hpp"
+#include "bookkeeping/peer.hpp"
+#include "dns/dnspacket.hpp"
+#include "dns/dnsquestion.hpp"
+
+#include <cstring>
+#include <vector>
+
+// Reply for "example.com IN A" with one answer of TTL 300
+static const uint8_t reply[] = {
+    0x12, 0x34, 0x81, 0x80, 0, 1, 0, 1, 0, 0, 0, 0,          // header
+    7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0, // qname
+    0, 1, 0, 1,                                              // A IN
+    0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0x01, 0x2c, 0, 4, 1, 2, 3, 4};
+static const uint16_t ttlOffset = 12 + 13 + 4 + 6;
+
+// NXDOMAIN for "nx.example.com IN A" with the SOA of example.com (TTL 3600,
+// minimum 60) in the authority section
+static const uint8_t nxdomain[] = {
+    0x12, 0x34, 0x81, 0x83, 0, 1, 0, 0, 0, 1, 0, 0,                // header
+    2, 'n', 'x', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0,
+    0, 1, 0, 1,                                                  // A IN
+    0xc0, 0x0f, 0, 6, 0, 1, 0, 0, 0x0e, 0x10, 0, 32,              // SOA
+    2, 'n', 's', 0xc0, 0x0f, 4, 'r', 'o', 'o', 't', 0xc0, 0x0f,  // names
+    0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 3, 0, 0, 0, 4, 0, 0, 0, 60}; // times
+
+static Arena arena;
+
+static DnsQuestion makeQuestion(const char *name) {
+  DnsQuestion q;
+  q.SetName(name, arena);
+  q.Type = 1;
+  q.Class = 1;
+  return q;
+}
+
+// Question name in wire format the way a client would send it
+static std::vector<uint8_t> wireName(const DnsQuestion &q) {
+  BytePacketBuffer bpb;
+  q.Write(&bpb);
+  return std::vector<uint8_t>(bpb.buf.begin(), bpb.buf.begin() + bpb.pos - 4);
+}
+
+TEST_CASE("cache key ignores case and includes flags") {
+  DnsQuestion lower = makeQuestion("example.com");
+  DnsQuestion upper = makeQuestion("ExAmPlE.CoM");
+
+  CHECK(ResponseCache::Key(lower, 0) == ResponseCache::Key(upper, 0));
+  CHECK(ResponseCache::Key(lower, 0) != ResponseCache::Key(lower, 1));
+}
+
+TEST_CASE("cache serves reply with new id, client case and aged ttl") {
+  ResponseCache cache(64 * 1024);
+  DnsQuestion q = makeQuestion("ExAmPlE.com");
+  std::string key = ResponseCache::Key(q, 0);
+
+  REQUIRE(cache.Insert(key, reply, sizeof(reply), {ttlOffset}, 300, 1000));
+
+  BytePacketBuffer bpb;
+  REQUIRE(cache.Lookup(key, wireName(q), 0xabcd, true, 1100, &bpb));
+  CHECK(bpb.pos == sizeof(reply));
+  CHECK(bpb.buf[0] == 0xab);
+  CHECK(bpb.buf[1] == 0xcd);
+  CHECK(std::memcmp(&bpb.buf[13], "ExAmPlE", 7) == 0);
+  uint32_t ttl = uint32_t(bpb.buf[ttlOffset + 2]) << 8 | bpb.buf[ttlOffset + 3];
+  CHECK(ttl == 200);
+
+  CHECK_FALSE(cache.Lookup(key, wireName(q), 1, true, 1300, &bpb));
+  CHECK(cache.stats.hits == 1);
+  CHECK(cache.stats.misses == 1);
+}
+
+TEST_CASE("cache evicts least recently used entries beyond budget") {
+  DnsQuestion a = makeQuestion("a.example.com");
+  DnsQuestion b = makeQuestion("b.example.com");
+  DnsQuestion c = makeQuestion("c.example.com");
+
+  ResponseCache probe(64 * 1024);
+  probe.Insert(ResponseCache::Key(a, 0), reply, sizeof(reply), {}, 300, 0);
+  ResponseCache cache(probe.Used() * 2 + probe.Used() / 2);
+
+  BytePacketBuffer bpb;
+  cache.Insert(ResponseCache::Key(a, 0), reply, sizeof(reply), {}, 300, 0);
+  cache.Insert(ResponseCache::Key(b, 0), reply, sizeof(reply), {}, 300, 0);
+  REQUIRE(
+      cache.Lookup(ResponseCache::Key(a, 0), wireName(a), 1, true, 1, &bpb));
+  cache.Insert(ResponseCache::Key(c, 0), reply, sizeof(reply), {}, 300, 0);
+
+  CHECK(cache.Count() == 2);
+  CHECK(cache.stats.evictions == 1);
+  CHECK(
+      cache.Lookup(ResponseCache::Key(a, 0), wireName(a), 1, true, 1, &bpb));
+  CHECK_FALSE(
+      cache.Lookup(ResponseCache::Key(b, 0), wireName(b), 1, true, 1, &bpb));
+}
+
+TEST_CASE("negative ttl comes from the soa minimum") {
+  BytePacketBuffer bpb;
+  std::memcpy(bpb.buf.data(), nxdomain, sizeof(nxdomain));
+  bpb.pos = 0;
+  bpb.size = sizeof(nxdomain);
+
+  Arena packetArena;
+  DnsPacket packet(packetArena);
+  REQUIRE(packet.Read(&bpb) == E_NOERROR);
+  CHECK(packet.GetResponseCode() == E_NXDOMAIN);
+
+  std::vector<uint16_t> ttlOffsets;
+  CHECK(packet.GetNegativeTtl(&ttlOffsets) == 60);
+  REQUIRE(ttlOffsets.size() == 1);
+  CHECK(ttlOffsets[0] == 12 + 16 + 4 + 6);
+
+  // Names of the SOA are compressed the same way again when written back
+  BytePacketBuffer out;
+  out.pos = 0;
+  REQUIRE(packet.Write(&out) == E_NOERROR);
+  CHECK(out.pos == sizeof(nxdomain));
+  CHECK(std::memcmp(out.buf.data(), nxdomain, sizeof(nxdomain)) == 0);
+
+  out.size = out.pos;
+  out.pos = 0;
+  DnsPacket copy(packetArena);
+  REQUIRE(copy.Read(&out) == E_NOERROR);
+  CHECK(copy.GetNegativeTtl(nullptr) == 60);
+}
+
+TEST_CASE("negative entries do not evict positive entries") {
+  DnsQuestion a = makeQuestion("a.example.com");
+  DnsQuestion nx1 = makeQuestion("nx1.example.com");
+  DnsQuestion nx2 = makeQuestion("nx2.example.com");
+
+  ResponseCache probe(64 * 1024);
+  probe.Insert(ResponseCache::Key(nx1, 0), nxdomain, sizeof(nxdomain), {}, 60,
+               0);
+  ResponseCache cache(64 * 1024, probe.Used() + probe.Used() / 2);
+
+  BytePacketBuffer bpb;
+  cache.Insert(ResponseCache::Key(a, 0), reply, sizeof(reply), {}, 300, 0);
+  for (auto q : {nx1, nx2}) {
+    CHECK(cache.Insert(ResponseCache::Key(q, 0), nxdomain, sizeof(nxdomain),
+                       {}, 60, 0, ResponseCache::Negative));
+  }
+
+  CHECK(cache.Count(ResponseCache::Positive) == 1);
+  CHECK(cache.Count(ResponseCache::Negative) == 1);
+  CHECK(
+      cache.Lookup(ResponseCache::Key(a, 0), wireName(a), 1, true, 1, &bpb));
+  CHECK(cache.Lookup(ResponseCache::Key(nx2, 0), wireName(nx2), 1, true, 1,
+                     &bpb));
+  CHECK(bpb.buf[3] == 0x83);
+  CHECK(cache.stats.negativeHits == 1);
+}
+
+TEST_CASE("expired entries are served stale within the window") {
+  // reply with a psuedo header appended as the only additional record
+  std::vector<uint8_t> withOpt(reply, reply + sizeof(reply));
+  withOpt[11] = 1;
+  const uint8_t opt[] = {0, 0, 41, 0x04, 0xd0, 0, 0, 0, 0, 0, 0};
+  withOpt.insert(withOpt.end(), opt, opt + sizeof(opt));
+  uint16_t optOffset = sizeof(reply) + sizeof(opt) - 2;
+
+  ResponseCache cache(64 * 1024, 0, 3600);
+  DnsQuestion q = makeQuestion("example.com");
+  std::string key = ResponseCache::Key(q, PEER_HAS_PSUEDO_HEADER);
+  REQUIRE(cache.Insert(key, withOpt.data(), withOpt.size(), {ttlOffset}, 300,
+                       0, ResponseCache::Positive, optOffset));
+
+  BytePacketBuffer bpb;
+  CHECK_FALSE(cache.HasStale(key, 100));
+  CHECK_FALSE(cache.Lookup(key, wireName(q), 1, true, 400, &bpb));
+  REQUIRE(cache.HasStale(key, 400));
+  REQUIRE(cache.LookupStale(key, wireName(q), 1, true, 400, &bpb));
+
+  uint32_t ttl = uint32_t(bpb.buf[ttlOffset + 2]) << 8 | bpb.buf[ttlOffset + 3];
+  CHECK(ttl == 30);
+  REQUIRE(bpb.pos == withOpt.size() + 6);
+  CHECK(bpb.buf[optOffset + 1] == 6);
+  const uint8_t ede[] = {0, EDNS_OPTION_EDE, 0, 2, 0, EDE_STALE};
+  CHECK(std::memcmp(&bpb.buf[withOpt.size()], ede, sizeof(ede)) == 0);
+  CHECK(cache.stats.staleHits == 1);
+
+  CHECK_FALSE(
+      cache.LookupStale(key, wireName(q), 1, true, 300 + 3600, &bpb));
+  CHECK(cache.Count() == 0);
+}
+
+TEST_CASE("hot entries are reported for prefetch near expiry") {
+  ResponseCache cache(64 * 1024);
+  cache.SetPrefetch(2, 10);
+  DnsQuestion q = makeQuestion("example.com");
+  std::string key = ResponseCache::Key(q, 0);
+  REQUIRE(cache.Insert(key, reply, sizeof(reply), {ttlOffset}, 300, 0));
+
+  BytePacketBuffer bpb;
+  bool prefetch = true;
+  REQUIRE(cache.Lookup(key, wireName(q), 1, true, 280, &bpb, &prefetch));
+  CHECK_FALSE(prefetch); // Not hot yet
+  REQUIRE(cache.Lookup(key, wireName(q), 1, true, 100, &bpb, &prefetch));
+  CHECK_FALSE(prefetch); // Too early
+  REQUIRE(cache.Lookup(key, wireName(q), 1, true, 280, &bpb, &prefetch));
+  CHECK(prefetch);
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#include "dns/dnspacket.hpp"
+
+#include <cstring>
+
+// Request for "example.com IN A"
+static const uint8_t request[] = {
+    0x12, 0x34, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0,          // header
+    7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0, // qname
+    0, 1, 0, 1};                                             // A IN
+
+// Reply for "www.example.com IN A" with a CNAME to example.com and the
+// address of that, as an upstream compresses it
+static const uint8_t reply[] = {
+    0x12, 0x34, 0x81, 0x80, 0, 1, 0, 2, 0, 0, 0, 0, // header
+    3, 'w', 'w', 'w', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm',
+    0, 0, 1, 0, 1,                                  // A IN
+    0xc0, 0x0c, 0, 5, 0, 1, 0, 0, 0x01, 0x2c, 0, 2, // CNAME
+    0xc0, 0x10,                                     // example.com
+    0xc0, 0x10, 0, 1, 0, 1, 0, 0, 0x01, 0x2c, 0, 4, 1, 2, 3, 4};
+
+// Reply for "example.com IN TXT" with a TXT, a SRV and a PTR record. Only
+// the name in the PTR record may be compressed.
+static const uint8_t mixed[] = {
+    0x12, 0x34, 0x81, 0x80, 0, 1, 0, 3, 0, 0, 0, 0,          // header
+    7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0, // qname
+    0, 16, 0, 1,                                             // TXT IN
+    0xc0, 0x0c, 0, 16, 0, 1, 0, 0, 0x01, 0x2c, 0, 6,         // TXT
+    5, 'h', 'e', 'l', 'l', 'o',
+    0xc0, 0x0c, 0, 33, 0, 1, 0, 0, 0x01, 0x2c, 0, 19,        // SRV
+    0, 1, 0, 2, 0, 53,
+    7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0,
+    0xc0, 0x0c, 0, 12, 0, 1, 0, 0, 0x01, 0x2c, 0, 2,         // PTR
+    0xc0, 0x0c};
+
+static void setBuffer(BytePacketBuffer &bpb, const uint8_t *data,
+                      std::size_t size) {
+  std::memcpy(bpb.buf.data(), data, size);
+  bpb.size = size;
+  bpb.pos = 0;
+}
+
+TEST_CASE("names are compressed against the longest suffix written") {
+  Arena arena;
+  DnsQuestion www, mail, other;
+  REQUIRE(www.SetName("www.example.com", arena) == E_NOERROR);
+  REQUIRE(mail.SetName("mail.example.com", arena) == E_NOERROR);
+  REQUIRE(other.SetName("example.org", arena) == E_NOERROR);
+
+  BytePacketBuffer bpb;
+  CompressionTable names;
+  names.WriteName(www.Name, &bpb);
+  CHECK(bpb.pos == www.Name.size());
+
+  names.WriteName(mail.Name, &bpb);
+  const uint8_t compressed[] = {4, 'm', 'a', 'i', 'l', 0xc0, 4};
+  CHECK(std::memcmp(&bpb.buf[www.Name.size()], compressed, 7) == 0);
+
+  // Nothing but the root in common
+  std::size_t pos = bpb.pos;
+  names.WriteName(other.Name, &bpb);
+  CHECK(bpb.pos - pos == other.Name.size());
+}
+
+TEST_CASE("reply is written back as small as the upstream sent it") {
+  BytePacketBuffer bpb;
+  setBuffer(bpb, reply, sizeof(reply));
+
+  Arena arena;
+  DnsPacket packet(arena);
+  REQUIRE(packet.Read(&bpb) == E_NOERROR);
+
+  BytePacketBuffer out;
+  REQUIRE(packet.Write(&out) == E_NOERROR);
+  CHECK(out.pos == sizeof(reply));
+  CHECK(std::memcmp(out.buf.data(), reply, sizeof(reply)) == 0);
+}
+
+TEST_CASE("redirect answer points at the question name") {
+  BytePacketBuffer bpb;
+  setBuffer(bpb, request, sizeof(request));
+
+  Arena arena;
+  DnsPacket packet(arena);
+  REQUIRE(packet.Read(&bpb) == E_NOERROR);
+  packet.SetAnswers(
+      [](const DnsQuestion *question, DnsRecord *answer, Arena &arena) {
+        answer->UpdateFromQuestion(question);
+        answer->TTL = 60;
+        const uint8_t *address = arena.Copy("\x0a\0\0\x01", 4);
+        answer->Data = std::span<const uint8_t>(address, 4);
+      });
+
+  BytePacketBuffer out;
+  REQUIRE(packet.Write(&out) == E_NOERROR);
+  CHECK(out.pos == sizeof(request) + 2 + RRFIXEDSZ + 4);
+  CHECK(out.buf[sizeof(request)] == 0xc0);
+  CHECK(out.buf[sizeof(request) + 1] == 0x0c);
+}
+
+TEST_CASE("records of other types are passed on unchanged") {
+  BytePacketBuffer bpb;
+  setBuffer(bpb, mixed, sizeof(mixed));
+
+  Arena arena;
+  DnsPacket packet(arena);
+  REQUIRE(packet.Read(&bpb) == E_NOERROR);
+  CHECK(packet.Validate(PacketType::IncomingResponse) == E_NOERROR);
+  CHECK(packet.GetMinTtl(nullptr) == 300);
+
+  BytePacketBuffer out;
+  REQUIRE(packet.Write(&out) == E_NOERROR);
+  CHECK(out.pos == sizeof(mixed));
+  CHECK(std::memcmp(out.buf.data(), mixed, sizeof(mixed)) == 0);
+}
+
+TEST_CASE("record data is checked against the layout of its type") {
+  const uint8_t a[] = {0x12, 0x34, 0x81, 0x80, 0, 0, 0, 1, 0, 0, 0, 0,
+                       0,    0,    1,    0,    1, 0, 0, 0, 0, 0, 5, // A
+                       127,  0,    0,    1,    0};
+  const uint8_t soa[] = {0x12, 0x34, 0x81, 0x83, 0, 0, 0, 0, 0, 1, 0, 0,
+                         0,    0,    6,    0,    1, 0, 0, 0, 0, 0, 6, // SOA
+                         0,    0,    0,    0,    0, 1};
+  const uint8_t opt[] = {0x12, 0x34, 0x81, 0x80, 0, 0, 0, 1, 0, 0, 0, 0,
+                         0,    0,    41,   0x04, 0xd0, 0, 0, 0, 0, 0, 0};
+
+  for (auto [data, size] : {std::pair(a, sizeof(a)),
+                            std::pair(soa, sizeof(soa)),
+                            std::pair(opt, sizeof(opt))}) {
+    BytePacketBuffer bpb;
+    setBuffer(bpb, data, size);
+    Arena arena;
+    DnsPacket packet(arena);
+    CHECK(packet.Read(&bpb) == E_FORMERR);
+  }
+}
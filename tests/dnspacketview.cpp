@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#include "dns/dnspacket.hpp"
+#include "dns/dnspacketview.hpp"
+
+#include <cstring>
+#include <vector>
+
+// Reply for "ExAmple.com IN A" with one answer of TTL 300 and a psuedo
+// header with the DO bit set
+static const uint8_t reply[] = {
+    0x12, 0x34, 0x81, 0x80, 0, 1, 0, 1, 0, 0, 0, 1,          // header
+    7, 'E', 'x', 'A', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0, // qname
+    0, 1, 0, 1,                                              // A IN
+    0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0x01, 0x2c, 0, 4, 1, 2, 3, 4,
+    0, 0, 41, 0x04, 0xd0, 0, 0, 0x80, 0, 0, 0};
+
+// NXDOMAIN for "nx.example.com IN A" with the SOA of example.com (TTL 3600,
+// minimum 60) in the authority section
+static const uint8_t nxdomain[] = {
+    0x12, 0x34, 0x81, 0x83, 0, 1, 0, 0, 0, 1, 0, 0,                // header
+    2, 'n', 'x', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0,
+    0, 1, 0, 1,                                                  // A IN
+    0xc0, 0x0f, 0, 6, 0, 1, 0, 0, 0x0e, 0x10, 0, 32,              // SOA
+    2, 'n', 's', 0xc0, 0x0f, 4, 'r', 'o', 'o', 't', 0xc0, 0x0f,  // names
+    0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 3, 0, 0, 0, 4, 0, 0, 0, 60}; // times
+
+static void setBuffer(BytePacketBuffer &bpb, const uint8_t *data,
+                      std::size_t size) {
+  std::memcpy(bpb.buf.data(), data, size);
+  bpb.size = size;
+  bpb.pos = 0;
+}
+
+TEST_CASE("view reads header and question in place") {
+  BytePacketBuffer bpb;
+  setBuffer(bpb, reply, sizeof(reply));
+
+  DnsPacketView view(bpb);
+  REQUIRE(view.Read() == E_NOERROR);
+  CHECK(view.IsResponse());
+  CHECK(view.GetId() == 0x1234);
+  CHECK(view.GetQuestionCount() == 1);
+  CHECK(view.GetAnswerCount() == 1);
+  CHECK(view.GetQuestionName().data() == bpb.buf.data() + 12);
+  CHECK(view.GetQuestionName().size() == 13);
+
+  QueryKey key;
+  REQUIRE(key.Read(bpb, 12) == E_NOERROR);
+  CHECK(view.GetKey() == key);
+}
+
+TEST_CASE("view finds ttls and the psuedo header like the packet does") {
+  BytePacketBuffer bpb;
+  setBuffer(bpb, reply, sizeof(reply));
+  Arena arena;
+  DnsPacket packet(arena);
+  REQUIRE(packet.Read(&bpb) == E_NOERROR);
+
+  DnsPacketView view(bpb);
+  REQUIRE(view.Read() == E_NOERROR);
+  REQUIRE(view.Validate(PacketType::IncomingResponse) == E_NOERROR);
+
+  std::vector<uint16_t> expected, offsets;
+  CHECK(view.GetMinTtl(&offsets) == packet.GetMinTtl(&expected));
+  CHECK(offsets == expected);
+  CHECK(view.HasPsuedoHeader());
+  CHECK(view.GetPsuedoHeaderLengthOffset() ==
+        packet.GetPsuedoHeaderLengthOffset());
+  CHECK(view.HasDoBit());
+}
+
+TEST_CASE("view takes the negative ttl from the soa") {
+  BytePacketBuffer bpb;
+  setBuffer(bpb, nxdomain, sizeof(nxdomain));
+
+  DnsPacketView view(bpb);
+  REQUIRE(view.Read() == E_NOERROR);
+  CHECK(view.GetResponseCode() == E_NXDOMAIN);
+  CHECK_FALSE(view.HasPsuedoHeader());
+
+  std::vector<uint16_t> ttlOffsets;
+  CHECK(view.GetNegativeTtl(&ttlOffsets) == 60);
+  REQUIRE(ttlOffsets.size() == 1);
+  CHECK(ttlOffsets[0] == 12 + 16 + 4 + 6);
+}
+
+TEST_CASE("view rejects truncated records") {
+  BytePacketBuffer bpb;
+  setBuffer(bpb, reply, sizeof(reply) - 1);
+
+  DnsPacketView view(bpb);
+  REQUIRE(view.Read() == E_NOERROR); // The question is complete
+  CHECK(view.Validate(PacketType::IncomingResponse) == E_FORMERR);
+
+  setBuffer(bpb, reply, 20);
+  CHECK(view.Read() == E_FORMERR);
+}
+
+TEST_CASE("view checks record data like the packet does") {
+  // SOA a byte short of its five numbers
+  uint8_t soa[sizeof(nxdomain) - 1];
+  std::memcpy(soa, nxdomain, sizeof(soa));
+  soa[43] = 31;
+  BytePacketBuffer bpb;
+  setBuffer(bpb, soa, sizeof(soa));
+
+  Arena arena;
+  DnsPacket packet(arena);
+  CHECK(packet.Read(&bpb) == E_FORMERR);
+
+  DnsPacketView view(bpb);
+  REQUIRE(view.Read() == E_NOERROR);
+  CHECK(view.Validate(PacketType::IncomingResponse) == E_FORMERR);
+
+  // A record of three bytes, without the psuedo header after it
+  uint8_t a[44];
+  std::memcpy(a, reply, sizeof(a));
+  a[11] = 0;
+  a[40] = 3;
+  setBuffer(bpb, a, sizeof(a));
+  DnsPacketView shortA(bpb);
+  REQUIRE(shortA.Read() == E_NOERROR);
+  CHECK(shortA.Validate(PacketType::IncomingResponse) == E_FORMERR);
+}
+
+TEST_CASE("view patches the buffer in place") {
+  BytePacketBuffer bpb;
+  setBuffer(bpb, reply, sizeof(reply));
+
+  DnsPacketView view(bpb);
+  REQUIRE(view.Read() == E_NOERROR);
+  view.SetId(0xabcd);
+  view.SetResponseCode(E_SERVFAIL);
+  CHECK(bpb.buf[0] == 0xab);
+  CHECK(bpb.buf[1] == 0xcd);
+  CHECK(bpb.buf[3] == 0x82);
+  CHECK(std::memcmp(bpb.buf.data() + 4, reply + 4, sizeof(reply) - 4) == 0);
+}
+
+TEST_CASE("view reads and rewrites the udp payload size") {
+  BytePacketBuffer bpb;
+  setBuffer(bpb, reply, sizeof(reply));
+
+  DnsPacketView view(bpb);
+  REQUIRE(view.Read() == E_NOERROR);
+  CHECK(view.GetUdpPayloadSize() == 1232);
+  view.SetUdpPayloadSize(4096);
+  CHECK(view.GetUdpPayloadSize() == 4096);
+  CHECK(view.HasDoBit());
+
+  setBuffer(bpb, nxdomain, sizeof(nxdomain));
+  DnsPacketView plain(bpb);
+  REQUIRE(plain.Read() == E_NOERROR);
+  CHECK(plain.GetUdpPayloadSize() == 0);
+  plain.SetUdpPayloadSize(4096);
+  CHECK(std::memcmp(bpb.buf.data(), nxdomain, sizeof(nxdomain)) == 0);
+}
+
+TEST_CASE("view adds and removes a psuedo header") {
+  BytePacketBuffer bpb;
+  setBuffer(bpb, nxdomain, sizeof(nxdomain));
+
+  DnsPacketView view(bpb);
+  REQUIRE(view.Read() == E_NOERROR);
+  REQUIRE(view.AddPsuedoHeader(4096) == E_NOERROR);
+  CHECK(bpb.size == sizeof(nxdomain) + 11);
+  CHECK(bpb.buf[11] == 1);
+  CHECK(view.HasPsuedoHeader());
+  CHECK(view.GetUdpPayloadSize() == 4096);
+  CHECK(view.GetNegativeTtl(nullptr) == 60);
+
+  REQUIRE(view.RemovePsuedoHeader() == E_NOERROR);
+  CHECK_FALSE(view.HasPsuedoHeader());
+  REQUIRE(bpb.size == sizeof(nxdomain));
+  CHECK(std::memcmp(bpb.buf.data(), nxdomain, sizeof(nxdomain)) == 0);
+
+  // One already there is kept as it is
+  setBuffer(bpb, reply, sizeof(reply));
+  DnsPacketView edns(bpb);
+  REQUIRE(edns.Read() == E_NOERROR);
+  REQUIRE(edns.AddPsuedoHeader(4096) == E_NOERROR);
+  CHECK(bpb.size == sizeof(reply));
+  CHECK(edns.GetUdpPayloadSize() == 1232);
+}
+
+TEST_CASE("view reads tcp messages larger than the packet buffers") {
+  // The reply with its answer repeated until there are more records than
+  // the view keeps in place, the last one with the lowest TTL
+  const std::size_t answers = MAX_VIEW_RECORDS + 100;
+  const std::size_t question = 12 + 13 + 4;
+  const std::size_t answer = 16;
+  TcpPacketBuffer tpb;
+  std::memcpy(tpb.buf.data(), reply, question);
+  for (std::size_t i = 0; i < answers; i++) {
+    std::memcpy(&tpb.buf[question + i * answer], reply + question, answer);
+  }
+  tpb.size = question + answers * answer;
+  std::memcpy(&tpb.buf[tpb.size], reply + question + answer, 11);
+  tpb.size += 11;
+  tpb.buf[6] = answers >> 8;
+  tpb.buf[7] = answers & 0xff;
+  tpb.buf[tpb.size - 11 - answer + 8] = 0;
+  tpb.buf[tpb.size - 11 - answer + 9] = 30;
+  REQUIRE(tpb.size > MAX_PACKET_SZ);
+
+  DnsPacketView view(tpb);
+  REQUIRE(view.Read() == E_NOERROR);
+  REQUIRE(view.Validate(PacketType::IncomingResponse) == E_NOERROR);
+  CHECK(view.GetAnswerCount() == answers);
+  CHECK(view.GetMinTtl(nullptr) == 30);
+  CHECK(view.HasDoBit());
+  CHECK(view.GetUdpPayloadSize() == 1232);
+
+  // What a UDP client gets of it still fits
+  BytePacketBuffer out;
+  REQUIRE(view.WriteTruncated(&out) == E_NOERROR);
+  CHECK(out.pos == question + 11);
+}
+
+TEST_CASE("truncated reply keeps the question and the psuedo header") {
+  BytePacketBuffer bpb, out;
+  setBuffer(bpb, reply, sizeof(reply));
+
+  DnsPacketView view(bpb);
+  REQUIRE(view.Read() == E_NOERROR);
+  REQUIRE(view.WriteTruncated(&out) == E_NOERROR);
+
+  const uint8_t expected[] = {
+      0x12, 0x34, 0x83, 0x80, 0, 1, 0, 0, 0, 0, 0, 1,          // TC
+      7, 'E', 'x', 'A', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0, // qname
+      0, 1, 0, 1,                                              // A IN
+      0, 0, 41, 0x04, 0xd0, 0, 0, 0x80, 0, 0, 0};
+  REQUIRE(out.pos == sizeof(expected));
+  CHECK(std::memcmp(out.buf.data(), expected, sizeof(expected)) == 0);
+
+  // Without a psuedo header only the question is left
+  setBuffer(bpb, nxdomain, sizeof(nxdomain));
+  DnsPacketView plain(bpb);
+  REQUIRE(plain.Read() == E_NOERROR);
+  REQUIRE(plain.WriteTruncated(&out) == E_NOERROR);
+  CHECK(out.pos == 12 + 16 + 4);
+  CHECK(out.buf[2] == 0x83);
+  CHECK(out.buf[9] == 0);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#include "bookkeeping/idallocator.hpp"
+#include <bitset>
+
+TEST_CASE("every id is handed out once") {
+  IdAllocator ids;
+  std::bitset<0x10000> seen;
+  std::size_t inOrder = 0;
+
+  for (unsigned int i = 1; i <= 0xffff; i++) {
+    uint16_t id = ids.Allocate();
+    REQUIRE(id != 0);
+    REQUIRE(!seen[id]);
+    seen.set(id);
+    inOrder += id == i;
+  }
+  CHECK(inOrder < 100);
+  CHECK(ids.Available() == 0);
+  CHECK(ids.Allocate() == 0);
+
+  ids.Free(1234);
+  ids.Free(1234);
+  CHECK(!ids.InUse(1234));
+  CHECK(ids.Available() == 1);
+  CHECK(ids.Allocate() == 1234);
+  CHECK(ids.InUse(1234));
+}
+
+TEST_CASE("freed ids are not handed out right away") {
+  IdAllocator ids;
+  uint16_t first = ids.Allocate();
+  ids.Free(first);
+
+  // The freed one is one of 65535 candidates for each allocation
+  unsigned int again = 0;
+  for (int i = 0; i < 100; i++) {
+    again += ids.Allocate() == first;
+  }
+  CHECK(again <= 1);
+}
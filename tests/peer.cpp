@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#include "bookkeeping/peer.hpp"
+#include "dns/dnsquestion.hpp"
+#include <cstring>
+#include <string>
+#include <vector>
+
+static QueryKey makeKey(const std::string &name) {
+  Arena arena;
+  DnsQuestion question;
+  question.SetName(name.c_str(), arena);
+  question.Type = QT_A;
+  question.Class = QTC_IN;
+
+  QueryKey key;
+  key.Set(question);
+  return key;
+}
+
+TEST_CASE("records are found by upstream id and by query") {
+  boost::asio::io_context io_context;
+  TimerWheel timers(io_context);
+  PeerRequests requests(timers, 8);
+  std::time_t now = std::time(nullptr);
+  QueryKey key = makeKey("example.com"), upper = makeKey("Example.COM"),
+           other = makeKey("example.org");
+
+  auto r = requests.GetNewRecord(now, key, PEER_DNSSEC_OK);
+  REQUIRE(r != nullptr);
+  CHECK(requests.InFlight() == 1);
+  CHECK(requests.Lookup(r->newId, key) == r);
+  CHECK(requests.Lookup(r->newId, other) == nullptr);
+  CHECK(requests.LookupByQuery(key, PEER_DNSSEC_OK, PEER_DNSSEC_OK) == r);
+  CHECK(requests.LookupByQuery(upper, PEER_DNSSEC_OK, PEER_DNSSEC_OK) == r);
+  CHECK(requests.LookupByQuery(key, 0, PEER_DNSSEC_OK) == nullptr);
+  CHECK(requests.LookupByQuery(other, PEER_DNSSEC_OK, PEER_DNSSEC_OK) ==
+        nullptr);
+  CHECK(requests.LookupByQuery(QueryKey(), 0, 0) == nullptr);
+
+  requests.FreePeerRequestRecord(r);
+  CHECK(requests.InFlight() == 0);
+  CHECK(requests.LookupByQuery(key, PEER_DNSSEC_OK, PEER_DNSSEC_OK) ==
+        nullptr);
+}
+
+TEST_CASE("freeing records keeps the others reachable") {
+  boost::asio::io_context io_context;
+  TimerWheel timers(io_context);
+  PeerRequests requests(timers, 64);
+  std::time_t now = std::time(nullptr);
+
+  // A full table is half full, so probe runs are long enough to matter
+  std::vector<QueryKey> keys;
+  std::vector<PeerRequests::PeerRequestRecord *> records;
+  for (int i = 0; i < 64; i++) {
+    keys.push_back(makeKey("host" + std::to_string(i) + ".example"));
+    records.push_back(requests.GetNewRecord(now, keys.back(), 0));
+    REQUIRE(records.back() != nullptr);
+  }
+
+  for (std::size_t i = 0; i < records.size(); i += 3) {
+    requests.FreePeerRequestRecord(records[i]);
+    records[i] = nullptr;
+  }
+
+  for (std::size_t i = 0; i < records.size(); i++) {
+    CHECK(requests.LookupByQuery(keys[i], 0, 0) == records[i]);
+    if (records[i]) {
+      CHECK(requests.Lookup(records[i]->newId, keys[i]) == records[i]);
+    }
+  }
+}
+
+TEST_CASE("a full table frees records on time") {
+  boost::asio::io_context io_context;
+  TimerWheel timers(io_context);
+  PeerRequests requests(timers, 2);
+  std::time_t now = std::time(nullptr);
+  QueryKey a = makeKey("a.example"), b = makeKey("b.example"),
+           c = makeKey("c.example");
+  auto start = TimerWheel::Clock::now();
+
+  auto first = requests.GetNewRecord(now, a, 0);
+  auto second = requests.GetNewRecord(now, b, 0);
+  REQUIRE(first != nullptr);
+  REQUIRE(second != nullptr);
+  CHECK(first->newId != second->newId);
+  CHECK(requests.GetNewRecord(now, c, 0) == nullptr);
+
+  // Freeing disarms the timers of the record
+  int fired = 0;
+  timers.Schedule(first->retransmit, start, [&fired]() { fired++; });
+  requests.FreePeerRequestRecord(first);
+  timers.Advance(start + std::chrono::seconds(1));
+  CHECK(fired == 0);
+
+  auto third = requests.GetNewRecord(now, c, 0);
+  CHECK(third == first);
+  CHECK(requests.LookupByQuery(a, 0, 0) == nullptr);
+  CHECK(requests.LookupByQuery(c, 0, 0) == third);
+
+  // Records nobody freed go after a while
+  timers.Advance(start + std::chrono::minutes(1));
+  CHECK(requests.InFlight() == 0);
+  CHECK(requests.LookupByQuery(b, 0, 0) == nullptr);
+  CHECK(timers.Armed() == 0);
+}
+
+TEST_CASE("expired records go to the expiry handler") {
+  boost::asio::io_context io_context;
+  TimerWheel timers(io_context);
+  PeerRequests requests(timers, 2);
+  std::time_t now = std::time(nullptr);
+  auto start = TimerWheel::Clock::now();
+
+  std::vector<PeerRequests::PeerRequestRecord *> expired;
+  requests.OnExpiry([&](PeerRequests::PeerRequestRecord *r) {
+    expired.push_back(r);
+    requests.FreePeerRequestRecord(r);
+  });
+
+  auto r = requests.GetNewRecord(now, makeKey("a.example"), 0);
+  REQUIRE(r != nullptr);
+  timers.Advance(start + std::chrono::minutes(1));
+  CHECK(expired == std::vector<PeerRequests::PeerRequestRecord *>{r});
+  CHECK(requests.InFlight() == 0);
+}
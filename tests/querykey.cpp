@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#include "dns/dnsquestion.hpp"
+#include "dns/querykey.hpp"
+#include <cstring>
+#include <sstream>
+#include <string>
+
+static void setBuffer(BytePacketBuffer &bpb, const std::string &bytes) {
+  std::memcpy(bpb.buf.data(), bytes.data(), bytes.size());
+  bpb.size = bytes.size();
+  bpb.pos = 0;
+}
+
+// example.com, A, IN
+static const std::string
+    exampleA("\x07" "example\x03" "com\x00\x00\x01\x00\x01", 17);
+
+TEST_CASE("query key ignores case and follows compression") {
+  BytePacketBuffer bpb;
+  QueryKey lower, upper, compressed, other;
+
+  setBuffer(bpb, exampleA);
+  REQUIRE(lower.Read(bpb, 0) == E_NOERROR);
+  setBuffer(bpb,
+            std::string("\x07" "ExAmPle\x03" "COM\x00\x00\x01\x00\x01", 17));
+  REQUIRE(upper.Read(bpb, 0) == E_NOERROR);
+  CHECK(lower == upper);
+  CHECK(lower.Hash() == upper.Hash());
+  CHECK(lower.Bytes() == exampleA);
+
+  // "example" then a pointer to "com" at offset 0
+  setBuffer(bpb, std::string("\x03" "com\x00" "\x07" "example\xc0\x00"
+                             "\x00\x01\x00\x01",
+                             19));
+  REQUIRE(compressed.Read(bpb, 5) == E_NOERROR);
+  CHECK(compressed == lower);
+
+  // Same name, AAAA
+  std::string exampleAaaa = exampleA;
+  exampleAaaa[14] = 0x1c;
+  setBuffer(bpb, exampleAaaa);
+  REQUIRE(other.Read(bpb, 0) == E_NOERROR);
+  CHECK_FALSE(other == lower);
+
+  Arena arena;
+  DnsQuestion question;
+  REQUIRE(question.SetName("Example.Com", arena) == E_NOERROR);
+  question.Type = QT_A;
+  question.Class = QTC_IN;
+  QueryKey decoded;
+  REQUIRE(decoded.Set(question) == E_NOERROR);
+  CHECK(decoded == lower);
+}
+
+TEST_CASE("query key rejects broken names") {
+  BytePacketBuffer bpb;
+  QueryKey key;
+
+  // Label runs past the end
+  setBuffer(bpb, std::string("\x09" "example", 8));
+  CHECK(key.Read(bpb, 0) == E_FORMERR);
+  // Pointer loop
+  setBuffer(bpb, std::string("\xc0\x00\x00\x01\x00\x01", 6));
+  CHECK(key.Read(bpb, 0) == E_FORMERR);
+  // No room for QTYPE and QCLASS
+  setBuffer(bpb, std::string("\x03" "com\x00\x00\x01", 7));
+  CHECK(key.Read(bpb, 0) == E_FORMERR);
+  CHECK(key.Empty());
+}
+
+TEST_CASE("lowercasing leaves everything but ASCII letters alone") {
+  uint8_t data[256], expected[256];
+  for (int i = 0; i < 256; i++) {
+    data[i] = i;
+    expected[i] = i >= 'A' && i <= 'Z' ? i + 32 : i;
+  }
+
+  // Every length, so both the wide and the byte loop run
+  for (std::size_t size = 0; size <= 256; size += 7) {
+    uint8_t copy[256];
+    std::memcpy(copy, data, sizeof(copy));
+    QueryKey::ToLower(copy, size);
+    CHECK(std::memcmp(copy, expected, size) == 0);
+    CHECK(std::memcmp(copy + size, data + size, 256 - size) == 0);
+  }
+}
+
+TEST_CASE("every kernel lowercases and finds the case the same way") {
+  uint8_t name[MAX_WIRE_NAME], expected[MAX_WIRE_NAME];
+  uint8_t saved[NAME_CASE_SIZE], bits[NAME_CASE_SIZE];
+  for (std::size_t i = 0; i < sizeof(name); i++) {
+    name[i] = (i * 37) & 0xff;
+    expected[i] = name[i] >= 'A' && name[i] <= 'Z' ? name[i] + 32 : name[i];
+  }
+
+  for (auto kernel : {QueryKey::Kernel::Scalar, QueryKey::Kernel::Sse2,
+                      QueryKey::Kernel::Avx2}) {
+    QueryKey::UseKernel(kernel);
+    for (std::size_t size : {0, 1, 15, 16, 17, 31, 32, 33, 100, 255}) {
+      uint8_t copy[MAX_WIRE_NAME];
+      std::memcpy(copy, name, sizeof(copy));
+      QueryKey::ToLower(copy, size, bits);
+      CHECK(std::memcmp(copy, expected, size) == 0);
+      CHECK(std::memcmp(copy + size, name + size, sizeof(name) - size) == 0);
+
+      uint8_t prefix[NAME_CASE_SIZE];
+      QueryKey::SaveCase(std::span<const uint8_t>(name, size), prefix);
+      CHECK(std::memcmp(bits, prefix, NAME_CASE_SIZE) == 0);
+    }
+  }
+  QueryKey::UseKernel(QueryKey::Kernel::Avx2);
+
+  // Read hands out the same bitmap
+  BytePacketBuffer bpb;
+  QueryKey key;
+  setBuffer(bpb,
+            std::string("\x07" "ExAmPle\x03" "COM\x00\x00\x01\x00\x01", 17));
+  REQUIRE(key.Read(bpb, 0, bits) == E_NOERROR);
+  QueryKey::SaveCase(std::span<const uint8_t>(bpb.buf.data(), 13), saved);
+  CHECK(std::memcmp(bits, saved, NAME_CASE_SIZE) == 0);
+}
+
+TEST_CASE("name case survives the round trip") {
+  uint8_t bits[NAME_CASE_SIZE];
+  std::string name("\x03" "wWw\x09" "ExAmple-1\x03" "COM", 19);
+  QueryKey::SaveCase(
+      std::span<const uint8_t>((const uint8_t *)name.data(), name.size()),
+      bits);
+
+  std::string lowered("\x03" "www\x09" "example-1\x03" "com", 19);
+  QueryKey::RestoreCase(
+      std::span<uint8_t>((uint8_t *)lowered.data(), lowered.size()), bits);
+  CHECK(lowered == name);
+}
+
+TEST_CASE("query key prints as a dotted name") {
+  BytePacketBuffer bpb;
+  QueryKey key;
+
+  setBuffer(bpb, exampleA);
+  REQUIRE(key.Read(bpb, 0) == E_NOERROR);
+  std::ostringstream out;
+  out << key;
+  CHECK(out.str() == "example.com. type 1 class 1");
+}
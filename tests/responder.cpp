@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#include "dns/dnspacket.hpp"
+#include "dns/responder.hpp"
+
+#include <cstring>
+
+// Request for "Example.com IN A" with a psuedo header
+static const uint8_t request[] = {
+    0x12, 0x34, 0x01, 0x10, 0, 1, 0, 0, 0, 0, 0, 1,          // header
+    7, 'E', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0, // qname
+    0, 1, 0, 1,                                              // A IN
+    0, 0, 41, 0x04, 0xd0, 0, 0, 0, 0, 0, 0};
+static const std::size_t questionEnd = 12 + 13 + 4;
+
+static void setBuffer(BytePacketBuffer &bpb, const uint8_t *data,
+                      std::size_t size) {
+  std::memcpy(bpb.buf.data(), data, size);
+  bpb.size = size;
+  bpb.pos = 0;
+}
+
+// Reads what the responder wrote back with the full parser
+static void readReply(BytePacketBuffer &out, DnsPacket &reply) {
+  out.size = out.pos;
+  out.pos = 0;
+  REQUIRE(reply.Read(&out) == E_NOERROR);
+}
+
+TEST_CASE("redirect echoes the question and appends one answer") {
+  BytePacketBuffer bpb, out;
+  setBuffer(bpb, request, sizeof(request));
+  DnsPacketView view(bpb);
+  REQUIRE(view.Read() == E_NOERROR);
+
+  Responder responder;
+  union IpAddress target{};
+  target.Ipv4v[0] = 10;
+  target.Ipv4v[3] = 1;
+  REQUIRE(responder.Redirect(view, target, &out) == E_NOERROR);
+  CHECK(out.pos == questionEnd + 2 + RRFIXEDSZ + 4);
+  CHECK(std::memcmp(&out.buf[12], &request[12], questionEnd - 12) == 0);
+  // Address in network order, right after the RR header
+  const uint8_t address[] = {10, 0, 0, 1};
+  CHECK(std::memcmp(&out.buf[out.pos - 4], address, 4) == 0);
+
+  Arena arena;
+  DnsPacket reply(arena);
+  readReply(out, reply);
+  CHECK(reply.IsResponse());
+  CHECK(reply.GetId() == 0x1234);
+  CHECK(reply.IsRecursionDesired());
+  CHECK(reply.HasCheckingDisabled());
+  CHECK(reply.GetResponseCode() == E_NOERROR);
+  CHECK(reply.GetAnswerCount() == 1);
+  CHECK_FALSE(reply.HasPsuedoHeader());
+  CHECK(reply.GetMinTtl(nullptr) == RESPONDER_TTL);
+}
+
+TEST_CASE("redirect answers no data for other types") {
+  uint8_t mx[sizeof(request)];
+  std::memcpy(mx, request, sizeof(request));
+  mx[questionEnd - 3] = QT_MX;
+
+  BytePacketBuffer bpb, out;
+  setBuffer(bpb, mx, sizeof(mx));
+  DnsPacketView view(bpb);
+  REQUIRE(view.Read() == E_NOERROR);
+
+  Responder responder;
+  union IpAddress target{};
+  REQUIRE(responder.Redirect(view, target, &out) == E_NOERROR);
+  CHECK(out.pos == questionEnd);
+
+  Arena arena;
+  DnsPacket reply(arena);
+  readReply(out, reply);
+  CHECK(reply.GetResponseCode() == E_NOERROR);
+  CHECK(reply.GetAnswerCount() == 0);
+}
+
+TEST_CASE("templates are kept per target and type") {
+  uint8_t aaaa[sizeof(request)];
+  std::memcpy(aaaa, request, sizeof(request));
+  aaaa[questionEnd - 3] = QT_AAAA;
+
+  BytePacketBuffer a, b, out;
+  setBuffer(a, request, sizeof(request));
+  setBuffer(b, aaaa, sizeof(aaaa));
+  DnsPacketView viewA(a), viewAaaa(b);
+  REQUIRE(viewA.Read() == E_NOERROR);
+  REQUIRE(viewAaaa.Read() == E_NOERROR);
+
+  Responder responder;
+  union IpAddress first{}, second{};
+  for (int i = 0; i < 16; i++) {
+    first.Ipv6v[i] = i;
+    second.Ipv6v[i] = 100 + i;
+  }
+
+  REQUIRE(responder.Redirect(viewAaaa, first, &out) == E_NOERROR);
+  CHECK(std::memcmp(&out.buf[out.pos - 16], first.Ipv6v, 16) == 0);
+  REQUIRE(responder.Redirect(viewA, first, &out) == E_NOERROR);
+  CHECK(std::memcmp(&out.buf[out.pos - 4], first.Ipv6v, 4) == 0);
+  REQUIRE(responder.Redirect(viewAaaa, second, &out) == E_NOERROR);
+  CHECK(std::memcmp(&out.buf[out.pos - 16], second.Ipv6v, 16) == 0);
+  REQUIRE(responder.Redirect(viewAaaa, first, &out) == E_NOERROR);
+  CHECK(std::memcmp(&out.buf[out.pos - 16], first.Ipv6v, 16) == 0);
+}
+
+TEST_CASE("rejected queries get the response code and no records") {
+  BytePacketBuffer bpb, out;
+  setBuffer(bpb, request, sizeof(request));
+  DnsPacketView view(bpb);
+  REQUIRE(view.Read() == E_NOERROR);
+
+  Responder responder;
+  REQUIRE(responder.Reject(view, E_NXDOMAIN, &out) == E_NOERROR);
+  CHECK(out.pos == questionEnd);
+
+  Arena arena;
+  DnsPacket reply(arena);
+  readReply(out, reply);
+  CHECK(reply.IsResponse());
+  CHECK(reply.GetResponseCode() == E_NXDOMAIN);
+  CHECK(reply.GetQuestionCount() == 1);
+  CHECK(reply.GetAnswerCount() == 0);
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#include "bookkeeping/selector.hpp"
+
+using namespace std::chrono_literals;
+typedef UpstreamSelector::Clock Clock;
+
+TEST_CASE("fastest picks the lowest round trip time") {
+  UpstreamServerInfo a{}, b{};
+  UpstreamSelector selector(UpstreamStrategy::Fastest, 0);
+  selector.Add(&a);
+  selector.Add(&b);
+
+  Clock::time_point now = Clock::now();
+  selector.OnReply(&a, now - 20ms, now);
+  selector.OnReply(&b, now - 5ms, now);
+  CHECK(selector.Select(now) == &b);
+  CHECK(selector.Explore(&b) == nullptr);
+}
+
+TEST_CASE("a silent server loses its place") {
+  UpstreamServerInfo a{}, b{};
+  UpstreamSelector selector(UpstreamStrategy::Fastest, 0);
+  selector.Add(&a);
+  selector.Add(&b);
+
+  Clock::time_point now = Clock::now();
+  selector.OnReply(&a, now - 20ms, now);
+  selector.OnReply(&b, now - 5ms, now);
+  selector.OnForward(&b, now);
+  CHECK(selector.Select(now + 10ms) == &b);
+  CHECK(selector.Select(now + 30ms) == &a);
+
+  selector.OnLateReply(&b);
+  CHECK(selector.Select(now + 30ms) == &b);
+}
+
+TEST_CASE("round robin skips servers which are down") {
+  UpstreamServerInfo a{}, b{}, c{};
+  UpstreamSelector selector(UpstreamStrategy::RoundRobin, 0);
+  selector.Add(&a);
+  selector.Add(&b);
+  selector.Add(&c);
+
+  Clock::time_point now = Clock::now();
+  selector.OnForward(&b, now);
+  now += 2s;
+  CHECK(selector.Select(now) == &a);
+  CHECK(selector.Select(now) == &c);
+  CHECK(selector.Select(now) == &a);
+}
+
+TEST_CASE("exploration copies to another server") {
+  UpstreamServerInfo a{}, b{};
+  UpstreamSelector selector(UpstreamStrategy::Fastest, 100);
+  selector.Add(&a);
+  selector.Add(&b);
+
+  for (int i = 0; i < 10; i++) {
+    CHECK(selector.Explore(&a) == &b);
+    CHECK(selector.Explore(&b) == &a);
+  }
+}
+
+TEST_CASE("retransmission timeout follows the round trip time") {
+  UpstreamServerInfo a{};
+  CHECK(UpstreamSelector::Rto(&a, 0) == 1s);
+  CHECK(UpstreamSelector::Rto(&a, 1) == 2s);
+
+  UpstreamSelector selector(UpstreamStrategy::Fastest, 0);
+  Clock::time_point now = Clock::now();
+  selector.OnReply(&a, now - 100ms, now);
+  CHECK(UpstreamSelector::Rto(&a, 0) == 300ms);
+  CHECK(UpstreamSelector::Rto(&a, 1) == 600ms);
+  CHECK(UpstreamSelector::Rto(&a, 8) == 4s);
+}
+
+TEST_CASE("failover picks another server") {
+  UpstreamServerInfo a{}, b{};
+  UpstreamSelector selector(UpstreamStrategy::Fastest, 0);
+  selector.Add(&a);
+  CHECK(selector.Failover(&a, Clock::now()) == &a);
+  selector.Add(&b);
+  CHECK(selector.Failover(&a, Clock::now()) == &b);
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#ifdef __linux
+
+#include "bench/common.hpp"
+#include "dns/server.hpp"
+#include "rule/shm.hpp"
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <map>
+#include <memory>
+
+using namespace std::chrono_literals;
+
+// A server on loopback forwarding to an upstream socket owned by the test.
+// Everything runs on the test thread, the server only while run() waits.
+struct ForwardingServer {
+  explicit ForwardingServer(unsigned int batchSize)
+      : ruleEngine(true),
+        upstream(ioContext,
+                 udp::endpoint(boost::asio::ip::address_v4::loopback(), 0)) {
+    bench::InitArgs();
+    bench::QuietLogs();
+
+    union IpAddress none {};
+    ruleEngine.SetPolicy(ActionType::Dns, none, none);
+
+    udpPort = bench::FreeUdpPort();
+    tcpPort = bench::FreeTcpPort();
+    config.values["dnsPort"] = std::to_string(udpPort);
+    config.values["tcpPort"] = std::to_string(tcpPort);
+    config.values["serverIp1"] = "127.0.0.1";
+    config.values["serverPort1"] =
+        std::to_string(upstream.local_endpoint().port());
+    config.values["batchSize"] = std::to_string(batchSize);
+    config.values["statsInterval"] = "0";
+    config.LoadConfiguration();
+
+    server = std::make_unique<DnsServer>(ioContext, config.dnsPort, &config,
+                                         &ruleEngine);
+  }
+
+  // Runs the server until done() holds, or gives up after a few seconds
+  template <typename Done> bool run(Done done) {
+    for (int i = 0; i < 300 && !done(); i++) {
+      ioContext.restart();
+      ioContext.run_for(10ms);
+    }
+    return done();
+  }
+
+  // Answers one forwarded query with 127.0.0.1, returns the reply as sent
+  std::vector<uint8_t> answer() {
+    uint8_t query[MAX_PACKET_SZ];
+    udp::endpoint from;
+    std::size_t size = upstream.receive_from(boost::asio::buffer(query), from);
+    REQUIRE(size > 12);
+
+    // Header and question only, the psuedo header is not echoed
+    std::size_t end = 12;
+    while (query[end] != 0) {
+      end += query[end] + 1;
+    }
+    end += 5;
+    std::vector<uint8_t> reply(query, query + end);
+    reply[2] |= 0x80; // QR
+    reply[3] = 0x80;  // RA
+    reply[7] = 1;     // ANCOUNT
+    reply[11] = 0;    // ARCOUNT
+    const uint8_t a[] = {0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0x0e, 0x10, 0, 4,
+                         127,  0,    0, 1};
+    reply.insert(reply.end(), a, a + sizeof(a));
+    upstream.send_to(boost::asio::buffer(reply), from);
+    return reply;
+  }
+
+  udp::endpoint Udp(bool ipv4 = true) const {
+    if (!ipv4) {
+      return {boost::asio::ip::address_v6::loopback(), udpPort};
+    }
+    return {boost::asio::ip::address_v4::loopback(), udpPort};
+  }
+
+  tcp::endpoint Tcp() const {
+    return {boost::asio::ip::address_v4::loopback(), tcpPort};
+  }
+
+  boost::asio::io_context ioContext;
+  ShmRuleEngine ruleEngine;
+  bench::MapConfigReader config;
+  udp::socket upstream;
+  uint16_t udpPort;
+  uint16_t tcpPort;
+  std::unique_ptr<DnsServer> server;
+};
+
+// The reply as the client with this query should see it
+static std::vector<uint8_t> replyFor(std::vector<uint8_t> reply,
+                                     const uint8_t *query,
+                                     std::size_t nameSize) {
+  reply[0] = query[0];
+  reply[1] = query[1];
+  std::memcpy(reply.data() + 12, query + 12, nameSize);
+  return reply;
+}
+
+TEST_CASE("coalesced clients get the reply with their own ID and case") {
+  ForwardingServer server(1);
+  const std::string names[] = {"www.example.test", "WWW.Example.TEST",
+                               "wWw.eXaMpLe.tEsT", "Www.Example.Test"};
+  const std::size_t nameSize = 18;
+  uint8_t queries[4][64];
+  std::size_t sizes[4];
+  for (int i = 0; i < 4; i++) {
+    sizes[i] = bench::MakeQuery(queries[i], 0x1111 * (i + 1), names[i]);
+  }
+
+  // Three over UDP from their own sockets, the last one over TCP
+  std::vector<std::unique_ptr<udp::socket>> clients;
+  for (int i = 0; i < 3; i++) {
+    clients.push_back(
+        std::make_unique<udp::socket>(server.ioContext, udp::v4()));
+    clients[i]->send_to(boost::asio::buffer(queries[i], sizes[i]),
+                        server.Udp());
+  }
+  tcp::socket tcpClient(server.ioContext);
+  tcpClient.connect(server.Tcp());
+  std::vector<uint8_t> framed = {0, uint8_t(sizes[3])};
+  framed.insert(framed.end(), queries[3], queries[3] + sizes[3]);
+  boost::asio::write(tcpClient, boost::asio::buffer(framed));
+
+  // All of them wait on a single upstream query
+  REQUIRE(server.run([&server]() { return server.upstream.available() > 0; }));
+  server.ioContext.restart();
+  server.ioContext.run_for(100ms);
+  std::vector<uint8_t> reply = server.answer();
+  CHECK(server.upstream.available() == 0);
+
+  REQUIRE(server.run([&]() {
+    for (auto &c : clients) {
+      if (c->available() == 0) {
+        return false;
+      }
+    }
+    return tcpClient.available() > 0;
+  }));
+
+  // One datagram each, byte for byte what that client asked for
+  for (int i = 0; i < 3; i++) {
+    uint8_t got[MAX_PACKET_SZ];
+    std::size_t size = clients[i]->receive(boost::asio::buffer(got));
+    CHECK(std::vector<uint8_t>(got, got + size) ==
+          replyFor(reply, queries[i], nameSize));
+    CHECK(clients[i]->available() == 0);
+  }
+
+  // The TCP client gets its own framed copy
+  uint8_t prefix[2];
+  boost::asio::read(tcpClient, boost::asio::buffer(prefix));
+  std::vector<uint8_t> got((prefix[0] << 8) | prefix[1]);
+  boost::asio::read(tcpClient, boost::asio::buffer(got));
+  CHECK(got == replyFor(reply, queries[3], nameSize));
+}
+
+TEST_CASE("batched replies go to the client which asked") {
+  ForwardingServer server(4);
+
+  // More datagrams than a batch holds, from clients of both families when
+  // this host has IPv6 so the endpoints come in different sizes
+  std::vector<std::unique_ptr<udp::socket>> clients;
+  for (int i = 0; i < 5; i++) {
+    clients.push_back(
+        std::make_unique<udp::socket>(server.ioContext, udp::v4()));
+  }
+  auto v6 = std::make_unique<udp::socket>(server.ioContext, udp::v6());
+  boost::system::error_code ec;
+  v6->bind({boost::asio::ip::address_v6::loopback(), 0}, ec);
+  if (!ec) {
+    clients.push_back(std::move(v6));
+  }
+
+  std::map<uint16_t, std::string> asked;
+  for (std::size_t i = 0; i < clients.size(); i++) {
+    for (int k = 0; k < 3; k++) {
+      uint16_t id = uint16_t(((i + 1) << 8) | k);
+      std::string name = "c" + std::to_string(i) + "-" + std::to_string(k) +
+                         ".example.test";
+      uint8_t query[64];
+      std::size_t size = bench::MakeQuery(query, id, name);
+      clients[i]->send_to(boost::asio::buffer(query, size),
+                          server.Udp(i < 5));
+      asked[id] = std::string((char *)query + 12, name.size() + 2);
+    }
+  }
+
+  // Answers whatever was forwarded meanwhile and collects the replies
+  std::vector<std::vector<std::vector<uint8_t>>> replies(clients.size());
+  std::size_t received = 0;
+  REQUIRE(server.run([&]() {
+    while (server.upstream.available() > 0) {
+      server.answer();
+    }
+    for (std::size_t i = 0; i < clients.size(); i++) {
+      while (clients[i]->available() > 0) {
+        uint8_t got[MAX_PACKET_SZ];
+        std::size_t size = clients[i]->receive(boost::asio::buffer(got));
+        replies[i].emplace_back(got, got + size);
+        received++;
+      }
+    }
+    return received == asked.size();
+  }));
+
+  // Each client gets an answer to each of its own queries and nothing else
+  for (std::size_t i = 0; i < clients.size(); i++) {
+    REQUIRE(replies[i].size() == 3);
+    std::vector<bool> seen(3, false);
+    for (auto &reply : replies[i]) {
+      REQUIRE(reply.size() > 12);
+      uint16_t id = uint16_t((reply[0] << 8) | reply[1]);
+      CHECK((id >> 8) == i + 1);
+      CHECK((id & 0xff) < 3);
+      seen[(id & 0xff) % 3] = true;
+      const std::string &name = asked[id];
+      CHECK(reply.size() >= 12 + name.size());
+      CHECK(std::string((char *)reply.data() + 12, name.size()) == name);
+      CHECK(reply[7] == 1);
+    }
+    CHECK(seen == std::vector<bool>(3, true));
+  }
+}
+
+#endif /* __linux */
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#include "bookkeeping/slab.hpp"
+#include <set>
+
+struct Item {
+  int value = 7;
+};
+
+TEST_CASE("slab hands out each object once") {
+  Slab<Item> slab(4);
+  std::set<Item *> seen;
+
+  for (std::size_t i = 0; i < 4; i++) {
+    Item *item = slab.Get();
+    REQUIRE(item != nullptr);
+    CHECK(item->value == 7);
+    CHECK(reinterpret_cast<uintptr_t>(item) % CACHE_LINE_SIZE == 0);
+    CHECK(slab.IndexOf(item) == i);
+    CHECK(&slab[i] == item);
+    seen.insert(item);
+  }
+  CHECK(seen.size() == 4);
+  CHECK(slab.Available() == 0);
+  CHECK(slab.Get() == nullptr);
+
+  Item *item = &slab[2];
+  item->value = 9;
+  slab.Put(item);
+  CHECK(slab.InUse() == 3);
+  Item *again = slab.Get();
+  CHECK(again == item);
+  CHECK(again->value == 9);
+}
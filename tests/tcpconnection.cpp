@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#include "dns/tcpconnection.hpp"
+#include <algorithm>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+static void put(TcpFramer &framer, const std::vector<uint8_t> &bytes) {
+  std::span<uint8_t> free = framer.Free();
+  REQUIRE(free.size() >= bytes.size());
+  std::memcpy(free.data(), bytes.data(), bytes.size());
+  framer.Commit(bytes.size());
+}
+
+TEST_CASE("messages are split at their length prefix") {
+  TcpFramer framer;
+  std::span<const uint8_t> message;
+
+  // Two whole messages and the start of a third in one read
+  put(framer, {0, 3, 'a', 'b', 'c', 0, 1, 'd', 0, 2, 'e'});
+  REQUIRE(framer.Next(message));
+  CHECK(message.size() == 3);
+  CHECK(message[0] == 'a');
+  REQUIRE(framer.Next(message));
+  CHECK(message.size() == 1);
+  CHECK(message[0] == 'd');
+  CHECK(!framer.Next(message));
+
+  // The rest of it, then a prefix split across reads
+  put(framer, {'f', 0});
+  REQUIRE(framer.Next(message));
+  CHECK(message.size() == 2);
+  CHECK(message[0] == 'e');
+  CHECK(message[1] == 'f');
+  CHECK(!framer.Next(message));
+  put(framer, {1, 'g'});
+  REQUIRE(framer.Next(message));
+  CHECK(message[0] == 'g');
+}
+
+TEST_CASE("messages up to the largest length are read whole") {
+  TcpFramer framer;
+  std::span<const uint8_t> message;
+
+  // The buffer grows once the length is known, then takes the rest in a few
+  // reads of what is free
+  put(framer, {0xff, 0xff});
+  std::size_t left = 0xffff;
+  while (left > 0) {
+    std::span<uint8_t> free = framer.Free();
+    REQUIRE(free.size() > 0);
+    std::size_t n = std::min(free.size(), left);
+    std::memset(free.data(), 0xee, n);
+    framer.Commit(n);
+    left -= n;
+  }
+  REQUIRE(framer.Next(message));
+  CHECK(message.size() == 0xffff);
+  CHECK(message[0xfffe] == 0xee);
+
+  // And shrinks back once it is gone
+  CHECK(framer.Free().size() == TCP_BUFFER_SIZE);
+  put(framer, {0, 1, 'a'});
+  REQUIRE(framer.Next(message));
+  CHECK(message[0] == 'a');
+}
+
+// A connected pair over loopback, the server end wrapped in a TcpConnection
+struct Loopback {
+  Loopback()
+      : wheel(io_context, 10ms), acceptor(io_context, {tcp::v4(), 0}),
+        client(io_context), closed(false) {
+    client.connect({boost::asio::ip::address_v4::loopback(),
+                    acceptor.local_endpoint().port()});
+    tcp::socket socket(io_context);
+    acceptor.accept(socket);
+    connection = std::make_shared<TcpConnection>(
+        std::move(socket), 1, wheel, 200ms,
+        [this](TcpConnection &, std::span<const uint8_t> m) {
+          queries.emplace_back(m.begin(), m.end());
+        },
+        [this](TcpConnection &) { closed = true; });
+  }
+
+  // Disarms the idle timer before the wheel goes
+  ~Loopback() { connection->Close(); }
+
+  boost::asio::io_context io_context;
+  TimerWheel wheel;
+  tcp::acceptor acceptor;
+  tcp::socket client;
+  std::shared_ptr<TcpConnection> connection;
+  std::vector<std::vector<uint8_t>> queries;
+  bool closed;
+};
+
+TEST_CASE("pipelined queries are answered in any order") {
+  Loopback l;
+  l.connection->Start();
+
+  const uint8_t sent[] = {0, 2, 1, 1, 0, 2, 2, 2, 0, 2, 3, 3};
+  boost::asio::write(l.client, boost::asio::buffer(sent));
+  while (l.queries.size() < 3) {
+    l.io_context.run_one();
+  }
+  CHECK(l.connection->InFlight() == 3);
+
+  // Replies go out as they become available
+  for (int i = 2; i >= 0; i--) {
+    l.connection->Send(l.queries[i].data(), l.queries[i].size());
+  }
+  CHECK(l.connection->InFlight() == 0);
+  l.io_context.poll();
+
+  uint8_t received[sizeof(sent)];
+  boost::asio::read(l.client, boost::asio::buffer(received));
+  const uint8_t expected[] = {0, 2, 3, 3, 0, 2, 2, 2, 0, 2, 1, 1};
+  CHECK(std::memcmp(received, expected, sizeof(expected)) == 0);
+  CHECK(!l.closed);
+}
+
+TEST_CASE("queries without a reply give their pipeline slot back") {
+  Loopback l;
+  l.connection->Start();
+
+  // One query more than the pipeline takes, it waits for a free slot
+  std::vector<uint8_t> sent;
+  for (int i = 0; i <= TCP_PIPELINE; i++) {
+    sent.insert(sent.end(), {0, 2, uint8_t(i), uint8_t(i)});
+  }
+  boost::asio::write(l.client, boost::asio::buffer(sent));
+  while (l.queries.size() < TCP_PIPELINE) {
+    l.io_context.run_one();
+  }
+  l.io_context.poll();
+  CHECK(l.queries.size() == TCP_PIPELINE);
+  CHECK(l.connection->InFlight() == TCP_PIPELINE);
+
+  // What the server does for queries it drops without an answer
+  for (int i = 0; i < TCP_PIPELINE; i++) {
+    l.connection->Unanswered();
+  }
+  while (l.queries.size() < TCP_PIPELINE + 1) {
+    l.io_context.run_one();
+  }
+  CHECK(l.queries.back()[0] == TCP_PIPELINE);
+  CHECK(l.connection->InFlight() == 1);
+  CHECK(!l.closed);
+}
+
+TEST_CASE("idle connections are closed") {
+  Loopback l;
+  l.connection->Start();
+
+  auto deadline = std::chrono::steady_clock::now() + 2s;
+  while (!l.closed && std::chrono::steady_clock::now() < deadline) {
+    l.io_context.run_one_for(100ms);
+  }
+  CHECK(l.closed);
+
+  uint8_t b;
+  boost::system::error_code ec;
+  l.client.read_some(boost::asio::buffer(&b, 1), ec);
+  CHECK(ec == boost::asio::error::eof);
+}
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#include "dns/tcpupstream.hpp"
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/write.hpp>
+#include <cstring>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+static const uint8_t queries[] = {0, 12, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                  0, 12, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                  0, 12, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+TEST_CASE("queries share a connection and replies come back in any order") {
+  boost::asio::io_context io_context;
+  TimerWheel wheel(io_context, 10ms);
+  tcp::acceptor acceptor(io_context, {boost::asio::ip::address_v4::loopback(),
+                                      0});
+
+  std::vector<uint16_t> ids;
+  TcpUpstream upstream(
+      io_context, wheel, acceptor.local_endpoint(), 2, 1s, 1s,
+      [&ids](std::span<const uint8_t> reply) {
+        ids.push_back(uint16_t(reply[0] << 8 | reply[1]));
+      });
+
+  // Sent before the connection is up
+  for (int i = 0; i < 3; i++) {
+    CHECK(upstream.Send(queries + i * 14 + 2, 12));
+  }
+  CHECK(upstream.Open() == 1);
+
+  tcp::socket server(io_context);
+  acceptor.accept(server);
+  server.non_blocking(true);
+  uint8_t received[sizeof(queries)];
+  std::size_t n = 0;
+  while (n < sizeof(received)) {
+    io_context.poll();
+    boost::system::error_code ec;
+    n += server.read_some(
+        boost::asio::buffer(received + n, sizeof(received) - n), ec);
+  }
+  CHECK(std::memcmp(received, queries, sizeof(queries)) == 0);
+
+  // Answered last to first
+  uint8_t replies[sizeof(queries)];
+  for (int i = 0; i < 3; i++) {
+    std::memcpy(replies + i * 14, queries + (2 - i) * 14, 14);
+    replies[i * 14 + 4] = 0x80;
+  }
+  boost::asio::write(server, boost::asio::buffer(replies));
+  while (ids.size() < 3) {
+    io_context.run_one();
+  }
+
+  CHECK(ids == std::vector<uint16_t>{3, 2, 1});
+  CHECK(upstream.stats.connects == 1);
+  CHECK(upstream.stats.queries == 3);
+  CHECK(upstream.stats.replies == 3);
+}
+
+TEST_CASE("replies larger than the packet buffers come back whole") {
+  boost::asio::io_context io_context;
+  TimerWheel wheel(io_context, 10ms);
+  tcp::acceptor acceptor(io_context, {boost::asio::ip::address_v4::loopback(),
+                                      0});
+
+  std::vector<std::size_t> sizes;
+  TcpUpstream upstream(
+      io_context, wheel, acceptor.local_endpoint(), 1, 1s, 1s,
+      [&sizes](std::span<const uint8_t> reply) {
+        sizes.push_back(reply.size());
+      });
+  CHECK(upstream.Send(queries + 2, 12));
+
+  tcp::socket server(io_context);
+  acceptor.accept(server);
+  server.non_blocking(true);
+  uint8_t received[14];
+  std::size_t n = 0;
+  while (n < sizeof(received)) {
+    io_context.poll();
+    boost::system::error_code ec;
+    n += server.read_some(
+        boost::asio::buffer(received + n, sizeof(received) - n), ec);
+  }
+
+  // Largest the length prefix allows
+  std::vector<uint8_t> reply(2 + 0xffff, 0);
+  reply[0] = reply[1] = 0xff;
+  std::memcpy(reply.data() + 2, received + 2, 12);
+  reply[4] = 0x80;
+  // Written while the upstream reads, it may not fit the socket buffers
+  boost::asio::async_write(server, boost::asio::buffer(reply),
+                           [](boost::system::error_code, std::size_t) {});
+  while (sizes.empty()) {
+    io_context.run_one();
+  }
+
+  CHECK(sizes == std::vector<std::size_t>{0xffff});
+  CHECK(upstream.stats.replies == 1);
+}
+
+TEST_CASE("connecting again backs off after failures") {
+  boost::asio::io_context io_context;
+  TimerWheel wheel(io_context, 10ms);
+  tcp::endpoint closed;
+  {
+    // Nothing listens here once it is closed
+    tcp::acceptor acceptor(io_context,
+                           {boost::asio::ip::address_v4::loopback(), 0});
+    closed = acceptor.local_endpoint();
+  }
+
+  TcpUpstream upstream(io_context, wheel, closed, 1, 1s, 1s,
+                       [](std::span<const uint8_t>) {});
+
+  CHECK(upstream.Send(queries + 2, 12));
+  while (upstream.stats.failures < 1) {
+    io_context.run_one();
+  }
+  CHECK(upstream.Open() == 0);
+  CHECK(!upstream.Send(queries + 2, 12));
+
+  std::this_thread::sleep_for(UPSTREAM_BACKOFF_MIN * 1ms + 20ms);
+  CHECK(upstream.Send(queries + 2, 12));
+  while (upstream.stats.failures < 2) {
+    io_context.run_one();
+  }
+
+  // Twice as long this time
+  std::this_thread::sleep_for(UPSTREAM_BACKOFF_MIN * 1ms + 20ms);
+  CHECK(!upstream.Send(queries + 2, 12));
+  std::this_thread::sleep_for(UPSTREAM_BACKOFF_MIN * 1ms);
+  CHECK(upstream.Send(queries + 2, 12));
+  CHECK(upstream.stats.connects == 0);
+}
+
+namespace ssl = boost::asio::ssl;
+
+// Self-signed certificate for dns.test and 127.0.0.1, with its key
+static void selfSigned(std::string &certPem, std::string &keyPem) {
+  EVP_PKEY *key = EVP_EC_gen("P-256");
+  X509 *cert = X509_new();
+  X509_set_version(cert, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+  X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+  X509_set_pubkey(cert, key);
+  X509_NAME *name = X509_get_subject_name(cert);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                             (const unsigned char *)"dns.test", -1, -1, 0);
+  X509_set_issuer_name(cert, name);
+
+  X509V3_CTX ctx;
+  X509V3_set_ctx_nodb(&ctx);
+  X509V3_set_ctx(&ctx, cert, cert, nullptr, nullptr, 0);
+  X509_EXTENSION *san = X509V3_EXT_conf_nid(
+      nullptr, &ctx, NID_subject_alt_name, "DNS:dns.test,IP:127.0.0.1");
+  X509_add_ext(cert, san, -1);
+  X509_EXTENSION_free(san);
+  X509_sign(cert, key, EVP_sha256());
+
+  BIO *bio = BIO_new(BIO_s_mem());
+  char *data;
+  PEM_write_bio_X509(bio, cert);
+  certPem.assign(data, BIO_get_mem_data(bio, &data));
+  (void)BIO_reset(bio);
+  PEM_write_bio_PrivateKey(bio, key, nullptr, nullptr, 0, nullptr, nullptr);
+  keyPem.assign(data, BIO_get_mem_data(bio, &data));
+  BIO_free(bio);
+  X509_free(cert);
+  EVP_PKEY_free(key);
+}
+
+// DNS over TLS server answering on its own thread. Each connection reads
+// the given number of queries, answers them last to first and is closed.
+class TlsStandIn {
+public:
+  TlsStandIn(std::vector<std::size_t> connections)
+      : server(ssl::context::tls_server), client(ssl::context::tls_client),
+        handshakes(0),
+        acceptor(ioContext, {boost::asio::ip::address_v4::loopback(), 0}) {
+    std::string cert, key;
+    selfSigned(cert, key);
+    server.use_certificate(boost::asio::buffer(cert), ssl::context::pem);
+    server.use_private_key(boost::asio::buffer(key), ssl::context::pem);
+    client.add_certificate_authority(boost::asio::buffer(cert));
+    client.set_verify_mode(ssl::verify_peer);
+
+    thread = std::thread([this, connections]() {
+      for (std::size_t queries : connections) {
+        serve(queries);
+      }
+    });
+  }
+
+  ~TlsStandIn() { thread.join(); }
+
+  tcp::endpoint Endpoint() const { return acceptor.local_endpoint(); }
+
+  ssl::context server;
+  // For the upstream, trusts the certificate of the server
+  ssl::context client;
+  std::atomic<int> handshakes;
+
+private:
+  void serve(std::size_t queries) {
+    ssl::stream<tcp::socket> stream(ioContext, server);
+    acceptor.accept(stream.next_layer());
+    boost::system::error_code ec;
+    stream.handshake(ssl::stream_base::server, ec);
+    if (ec) {
+      return;
+    }
+    handshakes++;
+
+    std::vector<uint8_t> received(queries * 14);
+    boost::asio::read(stream, boost::asio::buffer(received), ec);
+    std::vector<uint8_t> replies(received.size());
+    for (std::size_t i = 0; i < queries; i++) {
+      std::memcpy(&replies[i * 14], &received[(queries - 1 - i) * 14], 14);
+      replies[i * 14 + 4] = 0x80;
+    }
+    boost::asio::write(stream, boost::asio::buffer(replies), ec);
+    // Sessions of connections cut off without close_notify are not resumed
+    stream.shutdown(ec);
+  }
+
+  boost::asio::io_context ioContext;
+  tcp::acceptor acceptor;
+  std::thread thread;
+};
+
+TEST_CASE("queries are pipelined over TLS and reconnects resume the session") {
+  TlsStandIn standIn({3, 1});
+  boost::asio::io_context io_context;
+  TimerWheel wheel(io_context, 10ms);
+
+  std::vector<uint16_t> ids;
+  // Verified against the address without a name
+  TcpUpstream upstream(
+      io_context, wheel, standIn.Endpoint(), 2, 1s, 1s,
+      [&ids](std::span<const uint8_t> reply) {
+        ids.push_back(uint16_t(reply[0] << 8 | reply[1]));
+      },
+      &standIn.client);
+  CHECK(upstream.Tls());
+
+  for (int i = 0; i < 3; i++) {
+    CHECK(upstream.Send(queries + i * 14 + 2, 12));
+  }
+  CHECK(upstream.InFlight() == std::vector<unsigned int>{3});
+  while (ids.size() < 3) {
+    io_context.run_one();
+  }
+  CHECK(ids == std::vector<uint16_t>{3, 2, 1});
+  CHECK(upstream.stats.handshakes == 1);
+  CHECK(upstream.stats.resumed == 0);
+  CHECK(upstream.stats.maxInFlight == 3);
+
+  // Closed by the server after answering
+  while (upstream.Open() > 0) {
+    io_context.run_one();
+  }
+
+  CHECK(upstream.Send(queries + 2, 12));
+  while (ids.size() < 4) {
+    io_context.run_one();
+  }
+  CHECK(standIn.handshakes == 2);
+  CHECK(upstream.stats.connects == 2);
+  CHECK(upstream.stats.handshakes == 1);
+  CHECK(upstream.stats.resumed == 1);
+}
+
+TEST_CASE("TLS servers with a certificate for another name are refused") {
+  TlsStandIn standIn({1});
+  boost::asio::io_context io_context;
+  TimerWheel wheel(io_context, 10ms);
+
+  TcpUpstream upstream(
+      io_context, wheel, standIn.Endpoint(), 1, 1s, 1s,
+      [](std::span<const uint8_t>) {}, &standIn.client, "other.test");
+
+  CHECK(upstream.Send(queries + 2, 12));
+  while (upstream.stats.failures < 1) {
+    io_context.run_one();
+  }
+  CHECK(upstream.Open() == 0);
+  CHECK(upstream.stats.connects == 0);
+  CHECK(upstream.stats.handshakes == 0);
+  CHECK(standIn.handshakes == 0);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2024 Neeraj Jakhar
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "doctest/doctest.h"
+
+#include "bookkeeping/timerwheel.hpp"
+#include <vector>
+
+using namespace std::chrono_literals;
+typedef TimerWheel::Clock Clock;
+
+TEST_CASE("timers fire once their deadline has passed") {
+  boost::asio::io_context io_context;
+  TimerWheel wheel(io_context, 10ms);
+  Clock::time_point start = Clock::now();
+
+  // Spread over every level of the wheel
+  std::vector<Clock::duration> after = {5ms, 640ms, 700ms, 45s, 50min, 30h};
+  std::vector<TimerWheel::Timer> timers(after.size());
+  std::vector<Clock::time_point> fired(after.size());
+  Clock::time_point now = start;
+  for (std::size_t i = 0; i < after.size(); i++) {
+    wheel.Schedule(timers[i], start + after[i],
+                   [&fired, &now, i]() { fired[i] = now; });
+  }
+  CHECK(wheel.Armed() == after.size());
+
+  for (now = start; now < start + 31h; now += 10ms) {
+    wheel.Advance(now);
+  }
+
+  CHECK(wheel.Armed() == 0);
+  for (std::size_t i = 0; i < after.size(); i++) {
+    CHECK(fired[i] >= start + after[i]);
+    CHECK(fired[i] < start + after[i] + 20ms);
+  }
+}
+
+TEST_CASE("cancelled and moved timers") {
+  boost::asio::io_context io_context;
+  TimerWheel wheel(io_context, 10ms);
+  Clock::time_point start = Clock::now();
+  int a = 0, b = 0;
+
+  TimerWheel::Timer first, second;
+  wheel.Schedule(first, start + 100ms, [&a]() { a++; });
+  wheel.Schedule(second, start + 100ms, [&b]() { b++; });
+  first.Cancel();
+  CHECK(!first.Armed());
+  wheel.Schedule(second, start + 2s, [&b]() { b += 10; });
+  CHECK(wheel.Armed() == 1);
+
+  wheel.Advance(start + 1s);
+  CHECK(a == 0);
+  CHECK(b == 0);
+  wheel.Advance(start + 2s + 10ms);
+  CHECK(b == 10);
+  CHECK(!second.Armed());
+}
+
+TEST_CASE("a callback can arm its own timer again") {
+  boost::asio::io_context io_context;
+  TimerWheel wheel(io_context, 10ms);
+  Clock::time_point start = Clock::now();
+  TimerWheel::Timer timer;
+  int runs = 0;
+
+  std::function<void()> again = [&]() {
+    if (++runs < 3) {
+      wheel.Schedule(timer, start, again); // Already due
+    }
+  };
+  wheel.Schedule(timer, start + 50ms, again);
+
+  wheel.Advance(start + 60ms);
+  CHECK(runs == 1);
+  wheel.Advance(start + 70ms);
+  wheel.Advance(start + 80ms);
+  CHECK(runs == 3);
+  CHECK(wheel.Armed() == 0);
+}
+
+TEST_CASE("the io_context drives the wheel") {
+  boost::asio::io_context io_context;
+  TimerWheel wheel(io_context, 1ms);
+  TimerWheel::Timer timer;
+  Clock::time_point fired;
+  Clock::time_point start = Clock::now();
+
+  wheel.Schedule(timer, 30ms, [&fired]() { fired = Clock::now(); });
+  io_context.run();
+
+  CHECK(fired >= start + 30ms);
+  CHECK(fired < start + 1s);
+}